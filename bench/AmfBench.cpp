@@ -0,0 +1,98 @@
+//
+//  rtmp_relay
+//
+
+#include "Bench.hpp"
+#include "Amf.hpp"
+
+namespace relay
+{
+    namespace bench
+    {
+        // command object sent by encoders when connecting
+        static std::vector<amf::Node> createConnect()
+        {
+            amf::Node argument1;
+            argument1["app"] = std::string("live");
+            argument1["type"] = std::string("nonprivate");
+            argument1["flashVer"] = std::string("FMLE/3.0 (compatible; FMSc/1.0)");
+            argument1["swfUrl"] = std::string("rtmp://127.0.0.1:1935/live");
+            argument1["tcUrl"] = std::string("rtmp://127.0.0.1:1935/live");
+            argument1["fpad"] = false;
+            argument1["capabilities"] = 239.0;
+            argument1["audioCodecs"] = 3575.0;
+            argument1["videoCodecs"] = 252.0;
+            argument1["videoFunction"] = 1.0;
+            argument1["objectEncoding"] = 0.0;
+
+            return { amf::Node(std::string("connect")), amf::Node(1.0), argument1 };
+        }
+
+        // meta data sent by encoders with @setDataFrame
+        static std::vector<amf::Node> createMetaData()
+        {
+            amf::Node argument2(amf::Node::Type::Dictionary);
+            argument2["duration"] = 0.0;
+            argument2["fileSize"] = 0.0;
+            argument2["width"] = 1920.0;
+            argument2["height"] = 1080.0;
+            argument2["videocodecid"] = 7.0;
+            argument2["videodatarate"] = 6000.0;
+            argument2["framerate"] = 30.0;
+            argument2["audiocodecid"] = 10.0;
+            argument2["audiodatarate"] = 160.0;
+            argument2["audiosamplerate"] = 48000.0;
+            argument2["audiosamplesize"] = 16.0;
+            argument2["audiochannels"] = 2.0;
+            argument2["stereo"] = true;
+            argument2["2.1"] = false;
+            argument2["3.1"] = false;
+            argument2["4.0"] = false;
+            argument2["4.1"] = false;
+            argument2["5.1"] = false;
+            argument2["7.1"] = false;
+            argument2["encoder"] = std::string("obs-output module (libobs version 27.0.1)");
+
+            return { amf::Node(std::string("@setDataFrame")), amf::Node(std::string("onMetaData")), argument2 };
+        }
+
+        static void runPayload(Runner& runner, const std::string& name, amf::Version version, const std::vector<amf::Node>& nodes)
+        {
+            std::vector<uint8_t> encoded;
+            for (const amf::Node& node : nodes)
+            {
+                node.encode(version, encoded);
+            }
+
+            std::string suffix = name + ((version == amf::Version::AMF0) ? "/amf0" : "/amf3");
+
+            std::vector<uint8_t> buffer;
+
+            runner.run("amf::Node::encode/" + suffix, encoded.size(), [&]() {
+                buffer.clear();
+                for (const amf::Node& node : nodes)
+                {
+                    node.encode(version, buffer);
+                }
+                doNotOptimize(buffer.data());
+            });
+
+            runner.run("amf::Node::decode/" + suffix, encoded.size(), [&]() {
+                uint32_t offset = 0;
+                for (size_t i = 0; i < nodes.size(); ++i)
+                {
+                    amf::Node node;
+                    offset += node.decode(version, encoded, offset);
+                    doNotOptimize(node);
+                }
+            });
+        }
+
+        void runAmfBenchmarks(Runner& runner)
+        {
+            runPayload(runner, "connect", amf::Version::AMF0, createConnect());
+            runPayload(runner, "connect", amf::Version::AMF3, createConnect());
+            runPayload(runner, "onMetaData", amf::Version::AMF0, createMetaData());
+        }
+    }
+}
@@ -0,0 +1,112 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace relay
+{
+    namespace bench
+    {
+        // keeps the compiler from optimizing away the benchmarked work
+        template <class T>
+        inline void doNotOptimize(const T& value)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            asm volatile("" : : "r,m"(value) : "memory");
+#else
+            static volatile const void* sink;
+            sink = &value;
+#endif
+        }
+
+        struct Result
+        {
+            std::string name;
+            uint64_t iterations = 0;
+            uint64_t bytesPerOperation = 0;
+            double nsPerOperation = 0.0; // median of the repetitions
+            double minNsPerOperation = 0.0;
+        };
+
+        class Runner
+        {
+        public:
+            bool init(int argc, const char* argv[]);
+
+            // function is called once per iteration, bytesPerOperation is used to report throughput
+            template <class F>
+            void run(const std::string& name, uint64_t bytesPerOperation, F function)
+            {
+                if (!filter.empty() && name.find(filter) == std::string::npos) return;
+
+                function(); // warm up caches and allocations
+
+                uint64_t iterations = 1;
+                double elapsed = measure(iterations, function);
+
+                // grow the batch until one repetition takes long enough to time reliably
+                while (elapsed < minTime / repetitions && iterations < (1ULL << 40))
+                {
+                    uint64_t multiplier = (elapsed > 0.0) ? static_cast<uint64_t>(minTime / repetitions / elapsed * 1.2) : 10;
+                    if (multiplier < 2) multiplier = 2;
+                    if (multiplier > 100) multiplier = 100;
+                    iterations *= multiplier;
+                    elapsed = measure(iterations, function);
+                }
+
+                std::vector<double> samples;
+                for (uint32_t i = 0; i < repetitions; ++i)
+                {
+                    samples.push_back(measure(iterations, function) * 1e9 / static_cast<double>(iterations));
+                }
+
+                addResult(name, iterations, bytesPerOperation, samples);
+            }
+
+            void report() const;
+
+        private:
+            template <class F>
+            static double measure(uint64_t iterations, F& function)
+            {
+                auto start = std::chrono::steady_clock::now();
+
+                for (uint64_t i = 0; i < iterations; ++i)
+                {
+                    function();
+                }
+
+                auto end = std::chrono::steady_clock::now();
+
+                return std::chrono::duration<double>(end - start).count();
+            }
+
+            void addResult(const std::string& name, uint64_t iterations, uint64_t bytesPerOperation, std::vector<double>& samples);
+
+            enum class Format
+            {
+                JSON,
+                CSV,
+                TEXT
+            };
+
+            Format format = Format::JSON;
+            std::string filter;
+            double minTime = 0.5; // seconds per benchmark
+            uint32_t repetitions = 5;
+
+            std::vector<Result> results;
+        };
+
+        void runRTMPBenchmarks(Runner& runner);
+        void runAmfBenchmarks(Runner& runner);
+        void runUtilsBenchmarks(Runner& runner);
+        void runHandshakeBenchmarks(Runner& runner);
+    }
+}
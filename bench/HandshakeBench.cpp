@@ -0,0 +1,114 @@
+//
+//  rtmp_relay
+//
+
+#include <cstring>
+#include <random>
+#include "Bench.hpp"
+#include "Constants.hpp"
+#include "Handshake.hpp"
+
+namespace relay
+{
+    namespace bench
+    {
+        static std::mt19937_64 generator;
+
+        // the same bulk fill Relay::fillRandom does
+        static void fillRandom(uint8_t* buffer, size_t size)
+        {
+            size_t i = 0;
+
+            for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+            {
+                uint64_t value = generator();
+                memcpy(buffer + i, &value, sizeof(value));
+            }
+
+            if (i < size)
+            {
+                uint64_t value = generator();
+                memcpy(buffer + i, &value, size - i);
+            }
+        }
+
+        // time, version and random bytes, like Connection::writeChallenge
+        static void writeChallenge(uint8_t* buffer, const uint8_t* version)
+        {
+            memset(buffer, 0, 4);
+            memcpy(buffer + 4, version, 4);
+            fillRandom(buffer + 8, rtmp::HANDSHAKE_SIZE - 8);
+        }
+
+        void runHandshakeBenchmarks(Runner& runner)
+        {
+            static const uint8_t ZERO_VERSION[4] = {0, 0, 0, 0};
+
+            // what the server sends in reply to C1: S1 and S2
+            std::vector<uint8_t> reply(rtmp::HANDSHAKE_SIZE * 2);
+
+            std::vector<uint8_t> simpleChallenge(rtmp::HANDSHAKE_SIZE);
+            writeChallenge(simpleChallenge.data(), ZERO_VERSION);
+
+            std::vector<uint8_t> digestChallenge(rtmp::HANDSHAKE_SIZE);
+            writeChallenge(digestChallenge.data(), RTMP_CLIENT_VERSION);
+            rtmp::writeDigest(digestChallenge.data(), rtmp::Peer::CLIENT, rtmp::DigestScheme::SCHEME0);
+
+            // a non-zero version without a digest is checked against both schemes before falling back
+            std::vector<uint8_t> unsignedChallenge(rtmp::HANDSHAKE_SIZE);
+            writeChallenge(unsignedChallenge.data(), RTMP_CLIENT_VERSION);
+
+            runner.run("handshake/server/simple", 0, [&]() {
+                writeChallenge(reply.data(), RTMP_SERVER_VERSION);
+                memcpy(reply.data() + rtmp::HANDSHAKE_SIZE, simpleChallenge.data(), rtmp::HANDSHAKE_SIZE);
+                doNotOptimize(reply.data());
+            });
+
+            auto replyToDigest = [&](const std::vector<uint8_t>& challenge) {
+                uint32_t digestOffset = 0;
+                rtmp::DigestScheme scheme = rtmp::findDigest(challenge.data(), rtmp::Peer::CLIENT, digestOffset);
+
+                writeChallenge(reply.data(), RTMP_SERVER_VERSION);
+
+                if (scheme == rtmp::DigestScheme::NONE)
+                {
+                    memcpy(reply.data() + rtmp::HANDSHAKE_SIZE, challenge.data(), rtmp::HANDSHAKE_SIZE);
+                }
+                else
+                {
+                    rtmp::writeDigest(reply.data(), rtmp::Peer::SERVER, scheme);
+                    fillRandom(reply.data() + rtmp::HANDSHAKE_SIZE, rtmp::HANDSHAKE_SIZE);
+                    rtmp::writeAckDigest(reply.data() + rtmp::HANDSHAKE_SIZE, rtmp::Peer::SERVER, challenge.data() + digestOffset);
+                }
+
+                doNotOptimize(reply.data());
+            };
+
+            runner.run("handshake/server/digest", 0, [&]() { replyToDigest(digestChallenge); });
+            runner.run("handshake/server/digest-fallback", 0, [&]() { replyToDigest(unsignedChallenge); });
+
+            // C1, then C2 in reply to a signed S1
+            std::vector<uint8_t> serverChallenge(rtmp::HANDSHAKE_SIZE);
+            writeChallenge(serverChallenge.data(), RTMP_SERVER_VERSION);
+            rtmp::writeDigest(serverChallenge.data(), rtmp::Peer::SERVER, rtmp::DigestScheme::SCHEME1);
+
+            std::vector<uint8_t> challenge(rtmp::HANDSHAKE_SIZE);
+            std::vector<uint8_t> ack(rtmp::HANDSHAKE_SIZE);
+
+            runner.run("handshake/client/digest", 0, [&]() {
+                writeChallenge(challenge.data(), RTMP_CLIENT_VERSION);
+                rtmp::writeDigest(challenge.data(), rtmp::Peer::CLIENT, rtmp::DigestScheme::SCHEME0);
+
+                uint32_t digestOffset = 0;
+                if (rtmp::findDigest(serverChallenge.data(), rtmp::Peer::SERVER, digestOffset) != rtmp::DigestScheme::NONE)
+                {
+                    fillRandom(ack.data(), ack.size());
+                    rtmp::writeAckDigest(ack.data(), rtmp::Peer::CLIENT, serverChallenge.data() + digestOffset);
+                }
+
+                doNotOptimize(challenge.data());
+                doNotOptimize(ack.data());
+            });
+        }
+    }
+}
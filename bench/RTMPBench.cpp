@@ -0,0 +1,72 @@
+//
+//  rtmp_relay
+//
+
+#include "Bench.hpp"
+#include "RTMP.hpp"
+
+namespace relay
+{
+    namespace bench
+    {
+        static rtmp::Packet createVideoPacket(uint32_t size)
+        {
+            rtmp::Packet packet;
+            packet.channel = rtmp::Channel::VIDEO;
+            packet.messageType = rtmp::MessageType::VIDEO_PACKET;
+            packet.messageStreamId = 1;
+            packet.timestamp = 1000;
+            packet.data.resize(size);
+
+            for (uint32_t i = 0; i < size; ++i)
+            {
+                packet.data[i] = static_cast<uint8_t>(i * 31);
+            }
+
+            return packet;
+        }
+
+        void runRTMPBenchmarks(Runner& runner)
+        {
+            // audio frame, small video frame, typical inter frame, keyframe
+            const uint32_t messageSizes[] = { 64, 1024, 16384, 262144 };
+            // default chunk size, common encoder chunk size, maximum used by the relay
+            const uint32_t chunkSizes[] = { 128, 4096, 65536 };
+
+            for (uint32_t messageSize : messageSizes)
+            {
+                for (uint32_t chunkSize : chunkSizes)
+                {
+                    std::string suffix = "/message:" + std::to_string(messageSize) + "/chunk:" + std::to_string(chunkSize);
+
+                    rtmp::Packet packet = createVideoPacket(messageSize);
+
+                    {
+                        rtmp::HeaderMap previousPackets;
+                        std::vector<uint8_t> buffer;
+
+                        runner.run("rtmp::Packet::encode" + suffix, messageSize, [&]() {
+                            buffer.clear();
+                            packet.timestamp += 40; // consecutive frames of one stream
+                            doNotOptimize(packet.encode(buffer, chunkSize, previousPackets));
+                        });
+                    }
+
+                    {
+                        // a self-contained message starting with a full header
+                        rtmp::HeaderMap encodePreviousPackets;
+                        std::vector<uint8_t> buffer;
+                        packet.encode(buffer, chunkSize, encodePreviousPackets);
+
+                        rtmp::HeaderMap previousPackets;
+                        rtmp::Packet decoded;
+
+                        runner.run("rtmp::Packet::decode" + suffix, messageSize, [&]() {
+                            doNotOptimize(decoded.decode(buffer, 0, chunkSize, previousPackets));
+                        });
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,131 @@
+//
+//  rtmp_relay
+//
+
+#include "Bench.hpp"
+#include "Utils.hpp"
+
+namespace relay
+{
+    namespace bench
+    {
+        static const uint32_t VALUE_COUNT = 1024;
+
+        template <class T>
+        static void runIntCodec(Runner& runner, const std::string& name, uint32_t size)
+        {
+            std::vector<uint8_t> buffer;
+            std::vector<uint8_t> encoded;
+            for (uint32_t i = 0; i < VALUE_COUNT; ++i)
+            {
+                encodeIntBE(encoded, size, static_cast<T>(i * 2654435761U));
+            }
+
+            runner.run("encodeIntBE/" + name, VALUE_COUNT * size, [&]() {
+                buffer.clear();
+                for (uint32_t i = 0; i < VALUE_COUNT; ++i)
+                {
+                    encodeIntBE(buffer, size, static_cast<T>(i));
+                }
+                doNotOptimize(buffer.data());
+            });
+
+            runner.run("decodeIntBE/" + name, VALUE_COUNT * size, [&]() {
+                T sum = 0;
+                for (uint32_t offset = 0; offset < encoded.size(); offset += size)
+                {
+                    T value = 0;
+                    decodeIntBE(encoded, offset, size, value);
+                    sum += value;
+                }
+                doNotOptimize(sum);
+            });
+
+            runner.run("encodeIntLE/" + name, VALUE_COUNT * size, [&]() {
+                buffer.clear();
+                for (uint32_t i = 0; i < VALUE_COUNT; ++i)
+                {
+                    encodeIntLE(buffer, size, static_cast<T>(i));
+                }
+                doNotOptimize(buffer.data());
+            });
+
+            runner.run("decodeIntLE/" + name, VALUE_COUNT * size, [&]() {
+                T sum = 0;
+                for (uint32_t offset = 0; offset < encoded.size(); offset += size)
+                {
+                    T value = 0;
+                    decodeIntLE(encoded, offset, size, value);
+                    sum += value;
+                }
+                doNotOptimize(sum);
+            });
+        }
+
+        void runUtilsBenchmarks(Runner& runner)
+        {
+            runIntCodec<uint8_t>(runner, "1", 1);
+            runIntCodec<uint16_t>(runner, "2", 2);
+            runIntCodec<uint32_t>(runner, "3", 3); // timestamps and message lengths
+            runIntCodec<uint32_t>(runner, "4", 4);
+
+            std::vector<uint8_t> buffer;
+            std::vector<uint8_t> encoded;
+            for (uint32_t i = 0; i < VALUE_COUNT; ++i)
+            {
+                encodeDouble(encoded, i * 0.5);
+            }
+
+            runner.run("encodeDouble", VALUE_COUNT * sizeof(double), [&]() {
+                buffer.clear();
+                for (uint32_t i = 0; i < VALUE_COUNT; ++i)
+                {
+                    encodeDouble(buffer, i * 0.5);
+                }
+                doNotOptimize(buffer.data());
+            });
+
+            runner.run("decodeDouble", VALUE_COUNT * sizeof(double), [&]() {
+                double sum = 0.0;
+                for (uint32_t offset = 0; offset < encoded.size(); offset += sizeof(double))
+                {
+                    double value = 0.0;
+                    decodeDouble(encoded, offset, value);
+                    sum += value;
+                }
+                doNotOptimize(sum);
+            });
+
+            // values spread over all four U29 lengths
+            std::vector<uint32_t> values;
+            encoded.clear();
+            for (uint32_t i = 0; i < VALUE_COUNT; ++i)
+            {
+                uint32_t value = (i * 2654435761U) >> ((i % 4) * 7 + 3);
+                values.push_back(value);
+                encodeU29(encoded, value);
+            }
+
+            runner.run("encodeU29", encoded.size(), [&]() {
+                buffer.clear();
+                for (uint32_t value : values)
+                {
+                    encodeU29(buffer, value);
+                }
+                doNotOptimize(buffer.data());
+            });
+
+            runner.run("decodeU29", encoded.size(), [&]() {
+                uint32_t sum = 0;
+                uint32_t offset = 0;
+                for (uint32_t i = 0; i < VALUE_COUNT; ++i)
+                {
+                    uint32_t value = 0;
+                    offset += decodeU29(encoded, offset, value);
+                    sum += value;
+                }
+                doNotOptimize(sum);
+            });
+        }
+    }
+}
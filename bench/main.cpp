@@ -0,0 +1,179 @@
+//
+//  rtmp_relay
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "Bench.hpp"
+#include "Json.hpp"
+#include "Log.hpp"
+#include "Version.hpp"
+
+namespace relay
+{
+    namespace bench
+    {
+        bool Runner::init(int argc, const char* argv[])
+        {
+            for (int i = 1; i < argc; ++i)
+            {
+                if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+                {
+                    filter = argv[++i];
+                }
+                else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+                {
+                    minTime = atof(argv[++i]);
+                    if (minTime <= 0.0) return false;
+                }
+                else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc)
+                {
+                    repetitions = static_cast<uint32_t>(atoi(argv[++i]));
+                    if (repetitions == 0) return false;
+                }
+                else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+                {
+                    ++i;
+                    if (strcmp(argv[i], "json") == 0) format = Format::JSON;
+                    else if (strcmp(argv[i], "csv") == 0) format = Format::CSV;
+                    else if (strcmp(argv[i], "text") == 0) format = Format::TEXT;
+                    else return false;
+                }
+                else
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        void Runner::addResult(const std::string& name, uint64_t iterations, uint64_t bytesPerOperation, std::vector<double>& samples)
+        {
+            std::sort(samples.begin(), samples.end());
+
+            Result result;
+            result.name = name;
+            result.iterations = iterations;
+            result.bytesPerOperation = bytesPerOperation;
+            result.nsPerOperation = samples[samples.size() / 2];
+            result.minNsPerOperation = samples.front();
+
+            // progress goes to stderr so stdout stays machine-readable
+            std::cerr << name << ": " << result.nsPerOperation << " ns/op" << std::endl;
+
+            results.push_back(result);
+        }
+
+        static double getMegabytesPerSecond(const Result& result)
+        {
+            if (result.bytesPerOperation == 0 || result.nsPerOperation <= 0.0) return 0.0;
+
+            return static_cast<double>(result.bytesPerOperation) * 1000.0 / result.nsPerOperation;
+        }
+
+        static double getOperationsPerSecond(const Result& result)
+        {
+            if (result.nsPerOperation <= 0.0) return 0.0;
+
+            return 1e9 / result.nsPerOperation;
+        }
+
+        void Runner::report() const
+        {
+            std::string output;
+
+            switch (format)
+            {
+                case Format::JSON:
+                {
+                    JsonWriter writer(output);
+                    writer.beginObject();
+                    writer.key("version").value(VERSION);
+                    writer.key("benchmarks").beginArray();
+
+                    for (const Result& result : results)
+                    {
+                        writer.beginObject();
+                        writer.key("name").value(result.name);
+                        writer.key("iterations").value(result.iterations);
+                        writer.key("ns_per_op").value(result.nsPerOperation);
+                        writer.key("min_ns_per_op").value(result.minNsPerOperation);
+                        writer.key("bytes_per_op").value(result.bytesPerOperation);
+                        writer.key("mb_per_s").value(getMegabytesPerSecond(result));
+                        writer.key("ops_per_s").value(getOperationsPerSecond(result));
+                        writer.endObject();
+                    }
+
+                    writer.endArray();
+                    writer.endObject();
+                    output.push_back('\n');
+                    break;
+                }
+
+                case Format::CSV:
+                {
+                    output = "name,iterations,ns_per_op,min_ns_per_op,bytes_per_op,mb_per_s,ops_per_s\n";
+
+                    for (const Result& result : results)
+                    {
+                        char line[256];
+                        snprintf(line, sizeof(line), ",%llu,%.3f,%.3f,%llu,%.3f,%.1f\n",
+                                 static_cast<unsigned long long>(result.iterations),
+                                 result.nsPerOperation,
+                                 result.minNsPerOperation,
+                                 static_cast<unsigned long long>(result.bytesPerOperation),
+                                 getMegabytesPerSecond(result),
+                                 getOperationsPerSecond(result));
+                        output += result.name; // names contain no commas
+                        output += line;
+                    }
+                    break;
+                }
+
+                case Format::TEXT:
+                {
+                    for (const Result& result : results)
+                    {
+                        char line[256];
+                        snprintf(line, sizeof(line), "%-48s %14.1f ns/op %10.1f MB/s %14.0f op/s\n",
+                                 result.name.c_str(),
+                                 result.nsPerOperation,
+                                 getMegabytesPerSecond(result),
+                                 getOperationsPerSecond(result));
+                        output += line;
+                    }
+                    break;
+                }
+            }
+
+            std::cout << output;
+        }
+    }
+}
+
+int main(int argc, const char* argv[])
+{
+    relay::bench::Runner runner;
+
+    if (!runner.init(argc, argv))
+    {
+        std::cerr << "Usage: " << argv[0] << " [--filter <substring>] [--min-time <seconds>] [--repetitions <count>] [--format json|csv|text]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // keep logging out of the measurements
+    relay::Log::threshold = relay::Log::Level::ERR;
+
+    relay::bench::runRTMPBenchmarks(runner);
+    relay::bench::runAmfBenchmarks(runner);
+    relay::bench::runUtilsBenchmarks(runner);
+    relay::bench::runHandshakeBenchmarks(runner);
+
+    runner.report();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,32 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace relay
+{
+    namespace fuzz
+    {
+        // each target consumes arbitrary bytes the same way the relay consumes network data,
+        // they are shared by the libFuzzer entry points and the throughput check
+        typedef int (*Target)(const uint8_t* data, size_t size);
+
+        // first byte selects the read size, the rest is a chunk stream fed to Packet::decode
+        // in reads of that size and retried on partial packets, like Connection::handleRead does
+        int fuzzPacket(const uint8_t* data, size_t size);
+
+        // a sequence of chunk headers decoded with decodeHeader
+        int fuzzHeader(const uint8_t* data, size_t size);
+
+        // first byte selects AMF0 or AMF3, the rest is a sequence of values decoded with amf::Node::decode
+        int fuzzAmf(const uint8_t* data, size_t size);
+
+        // modeSize is the number of leading bytes that select the mode of the target instead of being decoded,
+        // returns false for an unknown name
+        bool getTarget(const char* name, Target& target, size_t& modeSize);
+    }
+}
@@ -0,0 +1,11 @@
+//
+//  rtmp_relay
+//
+
+#include "Fuzz.hpp"
+
+// libFuzzer entry point for RTMP chunk header decoding
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    return relay::fuzz::fuzzHeader(data, size);
+}
@@ -0,0 +1,290 @@
+//
+//  rtmp_relay
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "Capture.hpp"
+#include "Log.hpp"
+#include "RTMP.hpp"
+#include "Utils.hpp"
+
+using namespace relay;
+
+static const uint32_t HANDSHAKE_SIZE = 1 + 1536 + 1536; // C0, C1 and C2 sent by the peer
+static const uint32_t MAX_PAYLOAD_SIZE = 2048; // larger payloads are truncated, the content of media frames does not matter to the parser
+static const uint32_t MAX_SEEDS_PER_TYPE = 16;
+static const size_t STREAM_PREFIX_SIZE = 4096;
+
+class Corpus
+{
+public:
+    explicit Corpus(const std::string& aDirectory):
+        directory(aDirectory)
+    {
+    }
+
+    bool init()
+    {
+        for (const char* target : {"", "/packet", "/header", "/amf"})
+        {
+            std::string path = directory + target;
+            if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+            {
+                std::cerr << "Failed to create " << path << std::endl;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // files are named after the hash of their content, so duplicates are written once
+    void write(const char* target, const std::vector<uint8_t>& data, const std::string& name = std::string())
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for (uint8_t b : data)
+        {
+            hash ^= b;
+            hash *= 1099511628211ULL;
+        }
+
+        char hashString[17];
+        snprintf(hashString, sizeof(hashString), "%016llx", static_cast<unsigned long long>(hash));
+
+        if (!hashes.insert(std::string(target) + "/" + hashString).second) return;
+
+        std::string path = directory + "/" + target + "/" + (name.empty() ? std::string(hashString) : name);
+
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            std::cerr << "Failed to write " << path << std::endl;
+            return;
+        }
+
+        fwrite(data.data(), 1, data.size(), file);
+        fclose(file);
+        ++count;
+    }
+
+    uint32_t getCount() const { return count; }
+
+private:
+    std::string directory;
+    std::set<std::string> hashes;
+    uint32_t count = 0;
+};
+
+// re-encodes a packet on its own, so the seed does not depend on the headers before it
+static std::vector<uint8_t> encodeStandalone(rtmp::Packet packet)
+{
+    if (packet.data.size() > MAX_PAYLOAD_SIZE) packet.data.resize(MAX_PAYLOAD_SIZE);
+
+    std::vector<uint8_t> result;
+    rtmp::HeaderMap previousPackets;
+    packet.encode(result, 128, previousPackets);
+
+    return result;
+}
+
+static bool addCapture(Corpus& corpus, const std::string& path)
+{
+    CaptureReader reader;
+    if (!reader.open(path)) return false;
+
+    std::vector<uint8_t> stream;
+    std::vector<uint8_t> data;
+    uint64_t delay;
+
+    while (reader.read(delay, data))
+    {
+        stream.insert(stream.end(), data.begin(), data.end());
+    }
+
+    if (stream.size() <= HANDSHAKE_SIZE)
+    {
+        std::cerr << path << " has no data after the handshake" << std::endl;
+        return true;
+    }
+
+    stream.erase(stream.begin(), stream.begin() + HANDSHAKE_SIZE);
+
+    // the beginning of the stream as received, read in single bytes and in larger reads
+    std::vector<uint8_t> prefix(stream.begin(), stream.begin() + std::min(stream.size(), STREAM_PREFIX_SIZE));
+    for (uint8_t readSize : {0x00, 0x10})
+    {
+        std::vector<uint8_t> seed(1, readSize);
+        seed.insert(seed.end(), prefix.begin(), prefix.end());
+        corpus.write("packet", seed);
+    }
+
+    rtmp::HeaderMap previousPackets;
+    std::map<rtmp::MessageType, uint32_t> seedCounts;
+    uint32_t chunkSize = 128;
+    uint32_t offset = 0;
+
+    while (offset < stream.size())
+    {
+        rtmp::Packet packet;
+        uint32_t ret = packet.decode(stream, offset, chunkSize, previousPackets);
+
+        if (ret == 0) break;
+
+        offset += ret;
+
+        if (packet.messageType == rtmp::MessageType::SET_CHUNK_SIZE)
+        {
+            uint32_t newChunkSize;
+            if (decodeIntBE(packet.data, 0, 4, newChunkSize) && newChunkSize != 0) chunkSize = newChunkSize;
+        }
+
+        if (seedCounts[packet.messageType]++ >= MAX_SEEDS_PER_TYPE) continue;
+
+        std::vector<uint8_t> encoded = encodeStandalone(packet);
+        if (encoded.empty()) continue;
+
+        std::vector<uint8_t> seed(1, 0x10);
+        seed.insert(seed.end(), encoded.begin(), encoded.end());
+        corpus.write("packet", seed);
+
+        rtmp::Header header;
+        rtmp::HeaderMap headerPackets;
+        uint32_t headerSize = rtmp::decodeHeader(encoded, 0, header, headerPackets);
+        if (headerSize) corpus.write("header", std::vector<uint8_t>(encoded.begin(), encoded.begin() + headerSize));
+
+        if (packet.messageType == rtmp::MessageType::AMF0_INVOKE ||
+            packet.messageType == rtmp::MessageType::AMF0_DATA)
+        {
+            std::vector<uint8_t> amfSeed(1, 0x00);
+            amfSeed.insert(amfSeed.end(), packet.data.begin(), packet.data.end());
+            corpus.write("amf", amfSeed);
+        }
+        else if ((packet.messageType == rtmp::MessageType::AMF3_INVOKE ||
+                  packet.messageType == rtmp::MessageType::AMF3_DATA) && !packet.data.empty())
+        {
+            // AMF3 commands start with a format byte followed by AMF0 values
+            std::vector<uint8_t> amfSeed(1, 0x00);
+            amfSeed.insert(amfSeed.end(), packet.data.begin() + 1, packet.data.end());
+            corpus.write("amf", amfSeed);
+        }
+    }
+
+    return true;
+}
+
+// inputs that used to take super-linear time, kept as seeds so the throughput check keeps covering them
+static void addSyntheticSeeds(Corpus& corpus)
+{
+    // a large video frame arriving one byte at a time
+    {
+        rtmp::Packet packet;
+        packet.channel = rtmp::Channel::VIDEO;
+        packet.messageType = rtmp::MessageType::VIDEO_PACKET;
+        packet.messageStreamId = 1;
+        packet.data.assign(16384, 0x27);
+
+        std::vector<uint8_t> seed(1, 0x00);
+        rtmp::HeaderMap previousPackets;
+        packet.encode(seed, 128, previousPackets);
+        corpus.write("packet", seed, "synthetic-byte-reads");
+    }
+
+    // small messages spread over thousands of chunk streams
+    {
+        std::vector<uint8_t> seed(1, 0x10);
+        rtmp::HeaderMap previousPackets;
+
+        for (uint32_t channel = 64; channel < 4096; ++channel)
+        {
+            rtmp::Packet packet;
+            packet.channel = channel;
+            packet.messageType = rtmp::MessageType::AUDIO_PACKET;
+            packet.messageStreamId = 1;
+            packet.data.assign(4, 0xAF);
+            packet.encode(seed, 128, previousPackets);
+        }
+
+        corpus.write("packet", seed, "synthetic-chunk-streams");
+        seed.erase(seed.begin());
+        corpus.write("header", seed, "synthetic-chunk-streams");
+    }
+
+    // deeply nested strict arrays and objects
+    {
+        std::vector<uint8_t> seed(1, 0x00);
+        for (uint32_t i = 0; i < 10000; ++i)
+        {
+            seed.push_back(0x0A); // strict array
+            encodeIntBE(seed, 4, 1);
+        }
+        corpus.write("amf", seed, "synthetic-nested-arrays");
+
+        seed.assign(1, 0x00);
+        for (uint32_t i = 0; i < 10000; ++i)
+        {
+            seed.push_back(0x03); // object
+            encodeIntBE(seed, 2, 1);
+            seed.push_back('a');
+        }
+        corpus.write("amf", seed, "synthetic-nested-objects");
+    }
+}
+
+int main(int argc, const char* argv[])
+{
+    std::string output;
+    std::vector<std::string> captures;
+    bool validArguments = true;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if (argv[i][0] == '-')
+        {
+            validArguments = false;
+        }
+        else
+        {
+            captures.push_back(argv[i]);
+        }
+    }
+
+    if (!validArguments || output.empty())
+    {
+        std::cerr << "Usage: " << argv[0] << " --output <corpus_directory> [<capture_file>...]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Log::threshold = Log::Level::ERR;
+
+    Corpus corpus(output);
+    if (!corpus.init()) return EXIT_FAILURE;
+
+    addSyntheticSeeds(corpus);
+
+    for (const std::string& capture : captures)
+    {
+        if (!addCapture(corpus, capture))
+        {
+            std::cerr << "Failed to read " << capture << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::cout << "Wrote " << corpus.getCount() << " inputs to " << output << std::endl;
+
+    return EXIT_SUCCESS;
+}
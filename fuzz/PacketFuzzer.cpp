@@ -0,0 +1,11 @@
+//
+//  rtmp_relay
+//
+
+#include "Fuzz.hpp"
+
+// libFuzzer entry point for RTMP chunk stream decoding
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    return relay::fuzz::fuzzPacket(data, size);
+}
@@ -0,0 +1,148 @@
+//
+//  rtmp_relay
+//
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <vector>
+#include "Fuzz.hpp"
+#include "Amf.hpp"
+#include "Log.hpp"
+#include "RTMP.hpp"
+#include "Utils.hpp"
+
+namespace relay
+{
+    namespace fuzz
+    {
+        static bool init()
+        {
+            // malformed input is expected, do not spend the time on logging it
+            Log::threshold = Log::Level::OFF;
+            return true;
+        }
+
+        static const bool initialized = init();
+
+        int fuzzPacket(const uint8_t* data, size_t size)
+        {
+            if (size < 1) return 0;
+
+            size_t readSize = 1 + data[0] * 64;
+            ++data;
+            --size;
+
+            std::vector<uint8_t> buffer;
+            rtmp::HeaderMap previousPackets;
+            uint32_t chunkSize = 128;
+
+            for (size_t position = 0; position < size; position += readSize)
+            {
+                size_t length = std::min(readSize, size - position);
+                buffer.insert(buffer.end(), data + position, data + position + length);
+
+                uint32_t offset = 0;
+
+                while (offset < buffer.size())
+                {
+                    rtmp::Packet packet;
+                    uint32_t ret = packet.decode(buffer, offset, chunkSize, previousPackets);
+
+                    if (ret == 0) break;
+
+                    offset += ret;
+
+                    if (packet.messageType == rtmp::MessageType::SET_CHUNK_SIZE)
+                    {
+                        uint32_t newChunkSize;
+                        if (decodeIntBE(packet.data, 0, 4, newChunkSize) &&
+                            newChunkSize != 0 && newChunkSize <= 0x7FFFFFFF)
+                        {
+                            chunkSize = newChunkSize;
+                        }
+                    }
+                }
+
+                buffer.erase(buffer.begin(), buffer.begin() + offset);
+            }
+
+            return 0;
+        }
+
+        int fuzzHeader(const uint8_t* data, size_t size)
+        {
+            std::vector<uint8_t> buffer(data, data + size);
+            rtmp::HeaderMap previousPackets;
+
+            uint32_t offset = 0;
+
+            while (offset < buffer.size())
+            {
+                rtmp::Header header;
+                uint32_t ret = rtmp::decodeHeader(buffer, offset, header, previousPackets);
+
+                if (ret == 0) break;
+
+                offset += ret;
+
+                if (header.type != rtmp::Header::Type::ONE_BYTE)
+                {
+                    previousPackets[header.channel] = header;
+                }
+            }
+
+            return 0;
+        }
+
+        int fuzzAmf(const uint8_t* data, size_t size)
+        {
+            if (size < 1) return 0;
+
+            amf::Version version = (data[0] & 0x01) ? amf::Version::AMF3 : amf::Version::AMF0;
+            std::vector<uint8_t> buffer(data + 1, data + size);
+
+            uint32_t offset = 0;
+
+            while (offset < buffer.size())
+            {
+                amf::Node node;
+                uint32_t ret = node.decode(version, buffer, offset);
+
+                if (ret == 0) break;
+
+                offset += ret;
+
+                // exercise the accessors the relay uses on decoded values
+                node.toString();
+            }
+
+            return 0;
+        }
+
+        bool getTarget(const char* name, Target& target, size_t& modeSize)
+        {
+            if (strcmp(name, "packet") == 0)
+            {
+                target = fuzzPacket;
+                modeSize = 1;
+            }
+            else if (strcmp(name, "header") == 0)
+            {
+                target = fuzzHeader;
+                modeSize = 0;
+            }
+            else if (strcmp(name, "amf") == 0)
+            {
+                target = fuzzAmf;
+                modeSize = 1;
+            }
+            else
+            {
+                return false;
+            }
+
+            return true;
+        }
+    }
+}
@@ -0,0 +1,210 @@
+//
+//  rtmp_relay
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "Fuzz.hpp"
+
+using namespace relay;
+
+struct Options
+{
+    fuzz::Target target = nullptr;
+    size_t modeSize = 0;
+    double maxExponent = 1.5; // time growth when the input is repeated, 1.0 is linear
+    double maxNsPerByte = 200.0;
+    double minNsPerByte = 10.0; // growth is not checked for cheaper inputs, their timings are dominated by fixed costs
+    bool verbose = false;
+    std::vector<std::string> paths;
+};
+
+static bool readFile(const std::string& path, std::vector<uint8_t>& data)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+
+    data.clear();
+    uint8_t buffer[65536];
+    size_t size;
+
+    while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        data.insert(data.end(), buffer, buffer + size);
+    }
+
+    fclose(file);
+    return true;
+}
+
+static void listFiles(const std::string& path, std::vector<std::string>& files)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return;
+
+    if (!S_ISDIR(info.st_mode))
+    {
+        files.push_back(path);
+        return;
+    }
+
+    DIR* dir = opendir(path.c_str());
+    if (!dir) return;
+
+    while (dirent* entry = readdir(dir))
+    {
+        if (entry->d_name[0] == '.') continue;
+        listFiles(path + "/" + entry->d_name, files);
+    }
+
+    closedir(dir);
+}
+
+// nanoseconds per run of the target, the best of three measurements
+static double measure(fuzz::Target target, const std::vector<uint8_t>& data)
+{
+    const std::chrono::nanoseconds minTime(std::chrono::milliseconds(5));
+    double best = 0.0;
+
+    for (int trial = 0; trial < 3; ++trial)
+    {
+        uint64_t runs = 0;
+        auto startTime = std::chrono::steady_clock::now();
+        std::chrono::nanoseconds elapsed(0);
+
+        do
+        {
+            target(data.data(), data.size());
+            ++runs;
+            elapsed = std::chrono::steady_clock::now() - startTime;
+        }
+        while (elapsed < minTime);
+
+        double ns = static_cast<double>(elapsed.count()) / runs;
+        if (trial == 0 || ns < best) best = ns;
+    }
+
+    return best;
+}
+
+static bool parseOptions(int argc, const char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--target") == 0 && i + 1 < argc)
+        {
+            if (!fuzz::getTarget(argv[++i], options.target, options.modeSize)) return false;
+        }
+        else if (strcmp(argv[i], "--max-exponent") == 0 && i + 1 < argc)
+        {
+            options.maxExponent = atof(argv[++i]);
+            if (options.maxExponent <= 0.0) return false;
+        }
+        else if (strcmp(argv[i], "--max-ns-per-byte") == 0 && i + 1 < argc)
+        {
+            options.maxNsPerByte = atof(argv[++i]);
+            if (options.maxNsPerByte <= 0.0) return false;
+        }
+        else if (strcmp(argv[i], "--min-ns-per-byte") == 0 && i + 1 < argc)
+        {
+            options.minNsPerByte = atof(argv[++i]);
+            if (options.minNsPerByte < 0.0) return false;
+        }
+        else if (strcmp(argv[i], "--verbose") == 0)
+        {
+            options.verbose = true;
+        }
+        else if (argv[i][0] == '-')
+        {
+            return false;
+        }
+        else
+        {
+            options.paths.push_back(argv[i]);
+        }
+    }
+
+    return options.target && !options.paths.empty();
+}
+
+int main(int argc, const char* argv[])
+{
+    Options options;
+
+    if (!parseOptions(argc, argv, options))
+    {
+        std::cerr << "Usage: " << argv[0] << " --target packet|header|amf [--max-exponent <exponent>] [--max-ns-per-byte <ns>] [--min-ns-per-byte <ns>] [--verbose] <file or directory>..." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::string> files;
+    for (const std::string& path : options.paths)
+    {
+        listFiles(path, files);
+    }
+
+    std::sort(files.begin(), files.end());
+
+    std::vector<double> nsPerByteValues;
+    uint32_t flagged = 0;
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> repeatedData;
+
+    for (const std::string& file : files)
+    {
+        if (!readFile(file, data) || data.size() <= options.modeSize)
+        {
+            std::cerr << "Failed to read " << file << std::endl;
+            continue;
+        }
+
+        double ns = measure(options.target, data);
+        double nsPerByte = ns / data.size();
+        nsPerByteValues.push_back(nsPerByte);
+
+        // the same input four times in a row should take four times as long, unless state builds up between messages
+        repeatedData = data;
+        for (int i = 0; i < 3; ++i)
+        {
+            repeatedData.insert(repeatedData.end(), data.begin() + options.modeSize, data.end());
+        }
+
+        double repeatedNs = measure(options.target, repeatedData);
+        double exponent = std::log(repeatedNs / ns) / std::log(4.0);
+
+        bool slow = nsPerByte > options.maxNsPerByte ||
+            (exponent > options.maxExponent && repeatedNs / repeatedData.size() > options.minNsPerByte);
+        if (slow) ++flagged;
+
+        if (slow || options.verbose)
+        {
+            char line[128];
+            snprintf(line, sizeof(line), "%zu bytes, %.1f ns/byte, exponent %.2f", data.size(), nsPerByte, exponent);
+            std::cout << (slow ? "SLOW " : "ok ") << file << ": " << line << std::endl;
+        }
+    }
+
+    if (nsPerByteValues.empty())
+    {
+        std::cerr << "No inputs" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::sort(nsPerByteValues.begin(), nsPerByteValues.end());
+
+    char summary[128];
+    snprintf(summary, sizeof(summary), "%zu inputs, median %.1f ns/byte, max %.1f ns/byte, %u flagged",
+             nsPerByteValues.size(), nsPerByteValues[nsPerByteValues.size() / 2], nsPerByteValues.back(), flagged);
+    std::cout << summary << std::endl;
+
+    return flagged ? EXIT_FAILURE : EXIT_SUCCESS;
+}
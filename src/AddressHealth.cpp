@@ -0,0 +1,66 @@
+//
+//  rtmp_relay
+//
+
+#include "AddressHealth.hpp"
+
+namespace relay
+{
+    void AddressHealth::addSuccess(const std::pair<uint32_t, uint16_t>& address, float handshakeTime)
+    {
+        Entry& entry = entries[address];
+
+        entry.handshakeTime = entry.measured ? entry.handshakeTime * 0.7f + handshakeTime * 0.3f : handshakeTime;
+        entry.measured = true;
+        entry.failures = 0;
+    }
+
+    void AddressHealth::addFailure(const std::pair<uint32_t, uint16_t>& address)
+    {
+        Entry& entry = entries[address];
+
+        ++entry.failures;
+        entry.failureTime = std::chrono::steady_clock::now();
+    }
+
+    bool AddressHealth::isBetter(const std::pair<uint32_t, uint16_t>& address, const std::pair<uint32_t, uint16_t>& other) const
+    {
+        auto currentTime = std::chrono::steady_clock::now();
+
+        auto i = entries.find(address);
+        auto j = entries.find(other);
+        const Entry* entry = (i == entries.end()) ? nullptr : &i->second;
+        const Entry* otherEntry = (j == entries.end()) ? nullptr : &j->second;
+
+        uint32_t rank = getRank(entry, currentTime);
+        uint32_t otherRank = getRank(otherEntry, currentTime);
+
+        if (rank != otherRank) return rank < otherRank;
+
+        if (rank == 0) return entry->handshakeTime < otherEntry->handshakeTime;
+        if (rank == 2) return entry->failures < otherEntry->failures;
+
+        return false;
+    }
+
+    bool AddressHealth::isFailing(const std::pair<uint32_t, uint16_t>& address) const
+    {
+        auto i = entries.find(address);
+        const Entry* entry = (i == entries.end()) ? nullptr : &i->second;
+
+        return getRank(entry, std::chrono::steady_clock::now()) == 2;
+    }
+
+    uint32_t AddressHealth::getRank(const Entry* entry, std::chrono::steady_clock::time_point currentTime) const
+    {
+        if (!entry) return 1;
+
+        if (entry->failures > 0 &&
+            std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - entry->failureTime).count() < FAILURE_PENALTY * 1000.0f)
+        {
+            return 2;
+        }
+
+        return entry->measured ? 0 : 1;
+    }
+}
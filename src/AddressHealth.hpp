@@ -0,0 +1,44 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <utility>
+
+namespace relay
+{
+    // handshake times and failures of the addresses client connections race to, shared by all connections
+    // so that the next attempt starts with the fastest address that has not failed recently
+    class AddressHealth
+    {
+    public:
+        // a failed address is tried after the others for this many seconds
+        static constexpr float FAILURE_PENALTY = 30.0f;
+
+        void addSuccess(const std::pair<uint32_t, uint16_t>& address, float handshakeTime);
+        void addFailure(const std::pair<uint32_t, uint16_t>& address);
+
+        // true if address should be tried before other
+        bool isBetter(const std::pair<uint32_t, uint16_t>& address, const std::pair<uint32_t, uint16_t>& other) const;
+        // true if address failed within the last FAILURE_PENALTY seconds
+        bool isFailing(const std::pair<uint32_t, uint16_t>& address) const;
+
+    private:
+        struct Entry
+        {
+            float handshakeTime = 0.0f; // smoothed, in seconds
+            bool measured = false;
+            uint32_t failures = 0; // since the last success
+            std::chrono::steady_clock::time_point failureTime;
+        };
+
+        // 0 for healthy addresses that have been measured, 1 for unknown and 2 for recently failed ones
+        uint32_t getRank(const Entry* entry, std::chrono::steady_clock::time_point currentTime) const;
+
+        std::map<std::pair<uint32_t, uint16_t>, Entry> entries;
+    };
+}
@@ -3,7 +3,9 @@
 //
 
 #include <iostream>
+#include <utility>
 #include "Amf.hpp"
+#include "Profiler.hpp"
 #include "Utils.hpp"
 
 namespace relay
@@ -12,6 +14,21 @@ namespace relay
     {
         static const std::string INDENT = "  ";
 
+        // nesting limit for objects and arrays, deeper input is rejected instead of exhausting the stack
+        static const uint32_t MAX_DEPTH = 64;
+
+        static thread_local uint32_t depth = 0;
+
+        class DepthGuard
+        {
+        public:
+            DepthGuard() { ++depth; }
+            ~DepthGuard() { --depth; }
+
+            DepthGuard(const DepthGuard&) = delete;
+            DepthGuard& operator=(const DepthGuard&) = delete;
+        };
+
         static std::string typeToString(Node::Type type)
         {
             switch (type)
@@ -189,7 +206,7 @@ namespace relay
                     }
                     offset += ret;
 
-                    result[key] = node;
+                    result[key] = std::move(node);
                 }
             }
 
@@ -238,7 +255,7 @@ namespace relay
                     }
                     offset += ret;
                     
-                    result[key] = node;
+                    result[key] = std::move(node);
                 }
             }
             
@@ -301,7 +318,7 @@ namespace relay
 
                     offset += ret;
 
-                    result[key] = node;
+                    result[key] = std::move(node);
 
                     ++currentCount;
                 }
@@ -332,6 +349,11 @@ namespace relay
             offset += ret;
 
             // skip the weakly-referenced flag
+            if (offset >= buffer.size())
+            {
+                return 0;
+            }
+
             offset += 1;
 
             std::string key;
@@ -363,7 +385,7 @@ namespace relay
 
                 offset += ret;
 
-                result[key] = node;
+                result[key] = std::move(node);
             }
 
             return offset - originalOffset;
@@ -397,7 +419,7 @@ namespace relay
 
                 offset += ret;
 
-                result.push_back(node);
+                result.push_back(std::move(node));
             }
 
             return offset - originalOffset;
@@ -431,7 +453,7 @@ namespace relay
 
                 offset += ret;
 
-                result.push_back(node);
+                result.push_back(std::move(node));
             }
             
             return offset - originalOffset;
@@ -922,14 +944,19 @@ namespace relay
 
         uint32_t Node::decode(Version version, const std::vector<uint8_t>& buffer, uint32_t offset)
         {
+            RELAY_PROFILE_SCOPE(AMF_DECODE);
+
             uint32_t originalOffset = offset;
 
+            if (offset >= buffer.size() || depth >= MAX_DEPTH)
+            {
+                return 0;
+            }
+
+            DepthGuard depthGuard;
+
             if (version == Version::AMF0)
             {
-                if (buffer.size() - offset < 1)
-                {
-                    return 0;
-                }
 
                 AMF0Marker marker = *reinterpret_cast<const AMF0Marker*>(buffer.data() + offset);
                 offset += 1;
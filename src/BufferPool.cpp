@@ -0,0 +1,285 @@
+//
+//  rtmp_relay
+//
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <sstream>
+#include "BufferPool.hpp"
+#include "Json.hpp"
+#include "Metrics.hpp"
+#include "Status.hpp"
+
+namespace relay
+{
+    static const size_t CLASS_COUNT = 15; // MIN_SIZE << 14 == MAX_SIZE
+    static const size_t THREAD_CACHE_COUNT = 32; // buffers of a class cached by each thread
+
+    static_assert((BufferPool::MIN_SIZE << (CLASS_COUNT - 1)) == BufferPool::MAX_SIZE, "Size classes must cover MIN_SIZE to MAX_SIZE");
+
+    // statistics of all threads
+    static std::atomic<uint64_t> cachedBytes(0);
+    static std::atomic<uint64_t> reusedCount(0);
+    static std::atomic<uint64_t> allocatedCount(0);
+
+    // buffers of each class, lowWater is the fewest there were since the last trim, that many were not needed
+    struct CacheClass
+    {
+        std::vector<std::vector<uint8_t>> buffers;
+        size_t lowWater = 0;
+
+        std::vector<uint8_t> pop()
+        {
+            std::vector<uint8_t> buffer = std::move(buffers.back());
+            buffers.pop_back();
+            if (buffers.size() < lowWater) lowWater = buffers.size();
+
+            return buffer;
+        }
+
+        // frees the oldest buffers that were not needed, returns the freed bytes
+        size_t trim()
+        {
+            size_t bytes = 0;
+
+            for (size_t i = 0; i < lowWater; ++i)
+            {
+                bytes += buffers[i].capacity();
+            }
+
+            buffers.erase(buffers.begin(), buffers.begin() + static_cast<std::vector<std::vector<uint8_t>>::difference_type>(lowWater));
+            lowWater = buffers.size();
+
+            return bytes;
+        }
+    };
+
+    struct Depot
+    {
+        std::mutex mutex;
+        CacheClass classes[CLASS_COUNT];
+        size_t bytes = 0;
+    };
+
+    // never deleted, threads return their buffers to it when they exit, which can be after static destruction
+    static Depot& getDepot()
+    {
+        static Depot* depot = new Depot();
+        return *depot;
+    }
+
+    struct ThreadCache
+    {
+        ~ThreadCache()
+        {
+            Depot& depot = getDepot();
+            std::lock_guard<std::mutex> lock(depot.mutex);
+
+            for (size_t i = 0; i < CLASS_COUNT; ++i)
+            {
+                for (std::vector<uint8_t>& buffer : classes[i].buffers)
+                {
+                    if (depot.bytes + buffer.capacity() <= BufferPool::DEPOT_SIZE)
+                    {
+                        depot.bytes += buffer.capacity();
+                        depot.classes[i].buffers.push_back(std::move(buffer));
+                    }
+                    else
+                    {
+                        cachedBytes -= buffer.capacity();
+                    }
+                }
+            }
+        }
+
+        CacheClass classes[CLASS_COUNT];
+        size_t bytes = 0;
+    };
+
+    static thread_local ThreadCache threadCache;
+
+    // the smallest class whose buffers can hold size bytes
+    static size_t getAcquireClass(size_t size)
+    {
+        size_t index = 0;
+        while ((BufferPool::MIN_SIZE << index) < size) ++index;
+        return index;
+    }
+
+    // the largest class a buffer of this capacity can serve
+    static size_t getReleaseClass(size_t capacity)
+    {
+        size_t index = 0;
+        while (index + 1 < CLASS_COUNT && (BufferPool::MIN_SIZE << (index + 1)) <= capacity) ++index;
+        return index;
+    }
+
+    std::vector<uint8_t> BufferPool::acquire(size_t size)
+    {
+        std::vector<uint8_t> buffer;
+
+        if (size > MAX_SIZE)
+        {
+            ++allocatedCount;
+            buffer.reserve(size);
+            return buffer;
+        }
+
+        size_t index = getAcquireClass(size);
+        CacheClass& cacheClass = threadCache.classes[index];
+
+        if (cacheClass.buffers.empty())
+        {
+            Depot& depot = getDepot();
+            std::lock_guard<std::mutex> lock(depot.mutex);
+
+            // half of the thread's share, so the next acquires of this class do not lock again
+            CacheClass& depotClass = depot.classes[index];
+            while (!depotClass.buffers.empty() && cacheClass.buffers.size() < THREAD_CACHE_COUNT / 2)
+            {
+                std::vector<uint8_t> depotBuffer = depotClass.pop();
+                depot.bytes -= depotBuffer.capacity();
+                threadCache.bytes += depotBuffer.capacity();
+                cacheClass.buffers.push_back(std::move(depotBuffer));
+            }
+        }
+
+        if (!cacheClass.buffers.empty())
+        {
+            ++reusedCount;
+
+            buffer = cacheClass.pop();
+
+            threadCache.bytes -= buffer.capacity();
+            cachedBytes -= buffer.capacity();
+
+            return buffer;
+        }
+
+        ++allocatedCount;
+        buffer.reserve(MIN_SIZE << index);
+        return buffer;
+    }
+
+    void BufferPool::release(std::vector<uint8_t>&& buffer)
+    {
+        // moving out leaves the caller with an empty buffer without capacity in every case
+        std::vector<uint8_t> released(std::move(buffer));
+        size_t capacity = released.capacity();
+
+        if (capacity < MIN_SIZE || capacity > MAX_SIZE) return;
+
+        released.clear();
+        size_t index = getReleaseClass(capacity);
+        CacheClass& cacheClass = threadCache.classes[index];
+
+        if (cacheClass.buffers.size() < THREAD_CACHE_COUNT &&
+            threadCache.bytes + capacity <= THREAD_CACHE_SIZE)
+        {
+            threadCache.bytes += capacity;
+            cachedBytes += capacity;
+            cacheClass.buffers.push_back(std::move(released));
+            return;
+        }
+
+        Depot& depot = getDepot();
+        std::lock_guard<std::mutex> lock(depot.mutex);
+
+        if (depot.bytes + capacity <= DEPOT_SIZE)
+        {
+            depot.bytes += capacity;
+            cachedBytes += capacity;
+            depot.classes[index].buffers.push_back(std::move(released));
+        }
+    }
+
+    void BufferPool::trim()
+    {
+        for (CacheClass& cacheClass : threadCache.classes)
+        {
+            size_t bytes = cacheClass.trim();
+            threadCache.bytes -= bytes;
+            cachedBytes -= bytes;
+        }
+
+        Depot& depot = getDepot();
+        std::lock_guard<std::mutex> lock(depot.mutex);
+
+        for (CacheClass& depotClass : depot.classes)
+        {
+            size_t bytes = depotClass.trim();
+            depot.bytes -= bytes;
+            cachedBytes -= bytes;
+        }
+    }
+
+    void BufferPool::reserve(std::vector<uint8_t>& buffer, size_t size)
+    {
+        if (size <= buffer.capacity()) return;
+
+        // doubled like the vector would grow itself
+        std::vector<uint8_t> newBuffer = acquire(std::max(size, buffer.capacity() * 2));
+        newBuffer.insert(newBuffer.end(), buffer.begin(), buffer.end());
+
+        release(std::move(buffer));
+        buffer.swap(newBuffer);
+    }
+
+    uint64_t BufferPool::getCachedBytes()
+    {
+        return cachedBytes;
+    }
+
+    void BufferPool::getStats(std::string& str, ReportType reportType)
+    {
+        switch (reportType)
+        {
+            case ReportType::TEXT:
+            {
+                std::stringstream ss;
+                ss << "\nBuffer pool: " << cachedBytes << " bytes cached, "
+                << reusedCount << " buffers reused, " << allocatedCount << " allocated\n";
+
+                str += ss.str();
+                break;
+            }
+            case ReportType::HTML:
+            {
+                std::stringstream ss;
+                ss << "<b>Buffer pool:</b> " << cachedBytes << " bytes cached, "
+                << reusedCount << " buffers reused, " << allocatedCount << " allocated<br>";
+
+                str += ss.str();
+                break;
+            }
+            case ReportType::JSON:
+            {
+                JsonWriter writer(str);
+                getStats(writer);
+                break;
+            }
+        }
+    }
+
+    void BufferPool::getStats(JsonWriter& writer)
+    {
+        writer.beginObject();
+        writer.key("cached_bytes").value(cachedBytes.load());
+        writer.key("reused").value(reusedCount.load());
+        writer.key("allocated").value(allocatedCount.load());
+        writer.endObject();
+    }
+
+    void BufferPool::getMetrics(MetricsWriter& writer)
+    {
+        writer.family("rtmp_relay_buffer_pool_cached_bytes", "gauge", "Bytes of released buffers cached for reuse.");
+        writer.sample("rtmp_relay_buffer_pool_cached_bytes", cachedBytes.load());
+
+        writer.family("rtmp_relay_buffer_pool_reused_total", "counter", "Buffers handed out from the cache.");
+        writer.sample("rtmp_relay_buffer_pool_reused_total", reusedCount.load());
+
+        writer.family("rtmp_relay_buffer_pool_allocated_total", "counter", "Buffers allocated because the cache had none of the size.");
+        writer.sample("rtmp_relay_buffer_pool_allocated_total", allocatedCount.load());
+    }
+}
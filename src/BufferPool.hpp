@@ -0,0 +1,56 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace relay
+{
+    class JsonWriter;
+    class MetricsWriter;
+    enum class ReportType;
+
+    // byte buffers sorted into power of two size classes from MIN_SIZE to MAX_SIZE by their capacity. Each thread
+    // caches released buffers itself and exchanges them with a shared depot when its cache is full or empty, so
+    // the relay thread takes no lock in the steady state. Buffers above the byte limits and buffers that were not
+    // needed during a trim interval are freed, so the memory of a burst is not kept in every socket or in the pool
+    class BufferPool
+    {
+    public:
+        static const size_t MIN_SIZE = 256;
+        static const size_t MAX_SIZE = 4 * 1024 * 1024;
+        static const size_t THREAD_CACHE_SIZE = 4 * 1024 * 1024; // bytes cached by each thread
+        static const size_t DEPOT_SIZE = 16 * 1024 * 1024; // bytes cached for all threads
+        static constexpr float TRIM_INTERVAL = 1.0f;
+        // empty buffers up to this capacity stay with their owner, shrink returns larger ones
+        static const size_t KEEP_CAPACITY = 4096;
+
+        // an empty buffer with a capacity of at least size
+        static std::vector<uint8_t> acquire(size_t size);
+        // the buffer is cleared and cached if its capacity fits a size class
+        static void release(std::vector<uint8_t>&& buffer);
+        // grows the capacity of the buffer to at least size through the pool, keeping its contents
+        static void reserve(std::vector<uint8_t>& buffer, size_t size);
+        // releases the buffer if it is empty and larger than keepCapacity
+        static void shrink(std::vector<uint8_t>& buffer, size_t keepCapacity = KEEP_CAPACITY)
+        {
+            if (buffer.empty() && buffer.capacity() > keepCapacity) release(std::move(buffer));
+        }
+        // frees the buffers of the calling thread's cache and of the depot that stayed unused since the last
+        // trim, threads that use the pool call this every TRIM_INTERVAL
+        static void trim();
+
+        // bytes cached by all threads and the depot
+        static uint64_t getCachedBytes();
+
+        static void getStats(std::string& str, ReportType reportType);
+        static void getStats(JsonWriter& writer);
+        static void getMetrics(MetricsWriter& writer);
+    };
+}
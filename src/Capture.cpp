@@ -0,0 +1,176 @@
+//
+//  rtmp_relay
+//
+
+#include <cstring>
+#include "Capture.hpp"
+#include "Log.hpp"
+#include "Utils.hpp"
+
+namespace relay
+{
+    static const uint8_t CAPTURE_MAGIC[8] = { 'R', 'T', 'M', 'P', 'C', 'A', 'P', 1 };
+    static const size_t CAPTURE_HEADER_SIZE = sizeof(CAPTURE_MAGIC) + 4 + 2 + 4 + 2 + 8;
+    static const uint64_t MAX_RECORD_SIZE = 64 * 1024 * 1024;
+
+    static void encodeVarint(std::vector<uint8_t>& buffer, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            buffer.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+
+        buffer.push_back(static_cast<uint8_t>(value));
+    }
+
+    CaptureWriter::~CaptureWriter()
+    {
+        close();
+    }
+
+    bool CaptureWriter::open(const std::string& path, const CaptureHeader& header)
+    {
+        close();
+
+        file = fopen(path.c_str(), "wb");
+
+        if (!file)
+        {
+            Log(Log::Level::ERR) << "Failed to open capture file " << path;
+            return false;
+        }
+
+        buffer.clear();
+        buffer.insert(buffer.end(), CAPTURE_MAGIC, CAPTURE_MAGIC + sizeof(CAPTURE_MAGIC));
+        // addresses are stored in network byte order like in sockaddr_in
+        encodeIntLE(buffer, 4, header.localIPAddress);
+        encodeIntBE(buffer, 2, header.localPort);
+        encodeIntLE(buffer, 4, header.remoteIPAddress);
+        encodeIntBE(buffer, 2, header.remotePort);
+        encodeIntBE(buffer, 8, header.startTime);
+
+        if (fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size())
+        {
+            Log(Log::Level::ERR) << "Failed to write capture file " << path;
+            close();
+            return false;
+        }
+
+        previousTime = std::chrono::steady_clock::now();
+
+        return true;
+    }
+
+    void CaptureWriter::close()
+    {
+        if (file)
+        {
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+    void CaptureWriter::write(const std::vector<uint8_t>& data)
+    {
+        if (!file) return;
+
+        auto currentTime = std::chrono::steady_clock::now();
+        uint64_t delay = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(currentTime - previousTime).count());
+        previousTime = currentTime;
+
+        buffer.clear();
+        encodeVarint(buffer, delay);
+        encodeVarint(buffer, data.size());
+
+        // the stream is buffered, so small reads do not cost a system call each
+        if (fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size() ||
+            fwrite(data.data(), 1, data.size(), file) != data.size())
+        {
+            Log(Log::Level::ERR) << "Failed to write capture file, stopping capture";
+            close();
+        }
+    }
+
+    CaptureReader::~CaptureReader()
+    {
+        close();
+    }
+
+    bool CaptureReader::open(const std::string& path)
+    {
+        close();
+
+        file = fopen(path.c_str(), "rb");
+
+        if (!file)
+        {
+            Log(Log::Level::ERR) << "Failed to open capture file " << path;
+            return false;
+        }
+
+        std::vector<uint8_t> buffer(CAPTURE_HEADER_SIZE);
+
+        if (fread(buffer.data(), 1, buffer.size(), file) != buffer.size() ||
+            memcmp(buffer.data(), CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0)
+        {
+            Log(Log::Level::ERR) << "Invalid capture file " << path;
+            close();
+            return false;
+        }
+
+        uint32_t offset = sizeof(CAPTURE_MAGIC);
+        offset += decodeIntLE(buffer, offset, 4, header.localIPAddress);
+        offset += decodeIntBE(buffer, offset, 2, header.localPort);
+        offset += decodeIntLE(buffer, offset, 4, header.remoteIPAddress);
+        offset += decodeIntBE(buffer, offset, 2, header.remotePort);
+        offset += decodeIntBE(buffer, offset, 8, header.startTime);
+
+        return true;
+    }
+
+    void CaptureReader::close()
+    {
+        if (file)
+        {
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+    bool CaptureReader::readVarint(uint64_t& result)
+    {
+        result = 0;
+
+        for (uint32_t shift = 0; shift < 64; shift += 7)
+        {
+            int c = fgetc(file);
+            if (c == EOF) return false;
+
+            result |= static_cast<uint64_t>(c & 0x7F) << shift;
+
+            if (!(c & 0x80)) return true;
+        }
+
+        return false;
+    }
+
+    bool CaptureReader::read(uint64_t& delay, std::vector<uint8_t>& data)
+    {
+        if (!file) return false;
+
+        uint64_t size;
+
+        if (!readVarint(delay) || !readVarint(size)) return false;
+
+        if (size > MAX_RECORD_SIZE)
+        {
+            Log(Log::Level::ERR) << "Invalid capture record size " << size;
+            return false;
+        }
+
+        data.resize(static_cast<size_t>(size));
+
+        return fread(data.data(), 1, data.size(), file) == data.size();
+    }
+}
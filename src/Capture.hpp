@@ -0,0 +1,72 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace relay
+{
+    // captures store the data received by a connection and when it arrived:
+    // an 8-byte magic, local and remote address, start time,
+    // then a record per read with the delay since the previous read and the data length as varints
+    struct CaptureHeader
+    {
+        uint32_t localIPAddress = 0;
+        uint16_t localPort = 0;
+        uint32_t remoteIPAddress = 0;
+        uint16_t remotePort = 0;
+        uint64_t startTime = 0; // milliseconds since the epoch
+    };
+
+    class CaptureWriter
+    {
+    public:
+        CaptureWriter() {}
+        ~CaptureWriter();
+
+        CaptureWriter(const CaptureWriter&) = delete;
+        CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+        bool open(const std::string& path, const CaptureHeader& header);
+        void close();
+
+        bool isOpen() const { return file != nullptr; }
+
+        void write(const std::vector<uint8_t>& data);
+
+    private:
+        FILE* file = nullptr;
+        std::chrono::steady_clock::time_point previousTime;
+        std::vector<uint8_t> buffer;
+    };
+
+    class CaptureReader
+    {
+    public:
+        CaptureReader() {}
+        ~CaptureReader();
+
+        CaptureReader(const CaptureReader&) = delete;
+        CaptureReader& operator=(const CaptureReader&) = delete;
+
+        bool open(const std::string& path);
+        void close();
+
+        const CaptureHeader& getHeader() const { return header; }
+
+        // returns false at the end of the file or on a truncated record
+        bool read(uint64_t& delay, std::vector<uint8_t>& data);
+
+    private:
+        bool readVarint(uint64_t& result);
+
+        FILE* file = nullptr;
+        CaptureHeader header;
+    };
+}
@@ -2,19 +2,66 @@
 //  rtmp_relay
 //
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
 
 #include "Connection.hpp"
+#include "BufferPool.hpp"
 #include "Relay.hpp"
 #include "Server.hpp"
 #include "Endpoint.hpp"
 #include "Constants.hpp"
+#include "Handshake.hpp"
+#include "Json.hpp"
 #include "Log.hpp"
+#include "Profiler.hpp"
 
 namespace relay
 {
+    // number of chunks a message of the given size is split into
+    static uint64_t getChunkCount(size_t size, uint32_t chunkSize, uint64_t minimum)
+    {
+        uint64_t chunks = (size + chunkSize - 1) / chunkSize;
+        return chunks < minimum ? minimum : chunks;
+    }
+
+    static ObjectPool& getConnectionPool()
+    {
+        static ObjectPool& pool = ObjectPool::create("connection", sizeof(Connection));
+        return pool;
+    }
+
+    void* Connection::operator new(size_t)
+    {
+        return getConnectionPool().allocate();
+    }
+
+    void Connection::operator delete(void* ptr, size_t)
+    {
+        getConnectionPool().deallocate(ptr);
+    }
+
+    // the size of a session is only known to its operator new and delete
+    static ObjectPool& getSessionPool(size_t size)
+    {
+        static ObjectPool& pool = ObjectPool::create("session", size);
+        return pool;
+    }
+
+    void* Connection::Session::operator new(size_t size)
+    {
+        return getSessionPool(size).allocate();
+    }
+
+    void Connection::Session::operator delete(void* ptr, size_t size)
+    {
+        getSessionPool(size).deallocate(ptr);
+    }
+
     Connection::Connection(Relay& aRelay,
                            Socket& client):
         relay(aRelay),
@@ -26,8 +73,27 @@ namespace relay
         Log(Log::Level::INFO) << idString << "Create connection";
 
         socket.setReadCallback(std::bind(&Connection::handleRead, this, std::placeholders::_1, std::placeholders::_2));
+        // no buffers are kept between reads and writes until the session starts
+        socket.setKeepCapacity(0);
         socket.setCloseCallback(std::bind(&Connection::handleClose, this, std::placeholders::_1));
         socket.startRead();
+
+        if (!relay.getCaptureDirectory().empty())
+        {
+            CaptureHeader header;
+            header.localIPAddress = socket.getLocalIPAddress();
+            header.localPort = socket.getLocalPort();
+            header.remoteIPAddress = socket.getRemoteIPAddress();
+            header.remotePort = socket.getRemotePort();
+            header.startTime = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+
+            std::string path = relay.getCaptureDirectory() + "/" + std::to_string(header.startTime) + "_" + std::to_string(id) + ".rtmpcap";
+
+            if (capture.open(path, header))
+            {
+                Log(Log::Level::INFO) << idString << "Capturing to " << path;
+            }
+        }
     }
 
     Connection::Connection(Relay& aRelay,
@@ -51,6 +117,8 @@ namespace relay
         amfVersion = endpoint->amfVersion;
 
         socket.setReadCallback(std::bind(&Connection::handleRead, this, std::placeholders::_1, std::placeholders::_2));
+        // no buffers are kept between reads and writes until the session starts
+        socket.setKeepCapacity(0);
         socket.setCloseCallback(std::bind(&Connection::handleClose, this, std::placeholders::_1));
         socket.setConnectTimeout(endpoint->connectionTimeout);
         socket.setConnectCallback(std::bind(&Connection::handleConnect, this, std::placeholders::_1));
@@ -59,6 +127,8 @@ namespace relay
 
     Connection::~Connection()
     {
+        relay.getResolver().cancel(resolveRequestId);
+        stopRace();
         close();
         Log(Log::Level::INFO) << idString << "Delete connection";
     }
@@ -76,16 +146,25 @@ namespace relay
         closed = closed || forceClose;
         socket.close(forceClose);
 
+        relay.getResolver().cancel(resolveRequestId);
+        resolveRequestId = 0;
+        connectNextAddress = false;
+        stopRace();
+
         reset();
     }
 
     void Connection::reset()
     {
+        if (isHandshaking()) count(&Counters::handshakeFailures);
+
         if (stream && streaming) stream->stop(*this);
         streaming = false;
 
         state = State::UNINITIALIZED;
+        throttled = false;
         data.clear();
+        BufferPool::shrink(data);
         receivedPackets.clear();
         sentPackets.clear();
         inChunkSize = 128;
@@ -94,17 +173,23 @@ namespace relay
         receivedPackets.clear();
         sentPackets.clear();
         invokeId = 0;
-        invokes.clear();
-        timeSinceMeasure = 0.0f;
         connected = false;
         videoFrameSent = false;
-        metaData = amf::Node();
-        currentAudioBytes = 0;
-        currentVideoBytes = 0;
-        audioRate = 0;
-        videoRate = 0;
         amfVersion = amf::Version::AMF0;
 
+        // a send that fails resets the connection, so the session is kept for the next one instead of being deleted
+        if (session)
+        {
+            session->invokes.clear();
+            session->timeSincePing = 0.0f;
+            session->timeSinceMeasure = 0.0f;
+            session->metaData = amf::Node();
+            session->currentAudioBytes = 0;
+            session->currentVideoBytes = 0;
+            session->audioRate = 0;
+            session->videoRate = 0;
+        }
+
         // disconnect all host connections
         if (type == Type::HOST)
         {
@@ -115,6 +200,22 @@ namespace relay
         }
     }
 
+    void Connection::startSession()
+    {
+        if (session) return;
+
+        session.reset(new Session());
+
+        socket.setLatencyHistogram(&session->egressLatency);
+        socket.setKeepCapacity(BufferPool::KEEP_CAPACITY);
+    }
+
+    const LatencyHistogram& Connection::getEgressLatency() const
+    {
+        static const LatencyHistogram empty;
+        return session ? session->egressLatency : empty;
+    }
+
     bool Connection::isClosed() const
     {
         // host connections are closed if the client disconnected
@@ -140,16 +241,16 @@ namespace relay
         {
             if (connected && pingInterval > 0.0f)
             {
-                timeSincePing += delta;
-                timeSincePong += delta;
+                session->timeSincePing += delta;
+                session->timeSincePong += delta;
 
-                if (timeSincePing >= pingInterval)
+                if (session->timeSincePing >= pingInterval)
                 {
-                    timeSincePing = 0.0f;
+                    session->timeSincePing = 0.0f;
                     sendUserControl(rtmp::UserControlType::PING);
                 }
 
-                if (timeSincePong >= 2 * pingInterval)
+                if (session->timeSincePong >= 2 * pingInterval)
                 {
                     Log(Log::Level::INFO) << idString << "Disconnecting as no pong";
                     close(true);
@@ -160,20 +261,62 @@ namespace relay
         {
             if (!endpoint) return;
 
+            if (connectNextAddress)
+            {
+                connectNextAddress = false;
+                ++resolvedIndex;
+                connectResolved();
+            }
+
+            if (raceWinner)
+            {
+                finishRace();
+            }
+            else if (!raceCandidates.empty())
+            {
+                timeSinceRaceStart += delta;
+
+                if (raceAdvance || timeSinceRaceStart >= endpoint->connectRaceDelay)
+                {
+                    raceAdvance = false;
+                    startRaceCandidate();
+                }
+            }
+
             if (socket.isReady() && state == State::HANDSHAKE_DONE)
             {
                 timeSinceConnect = 0.0f;
+                reconnectScheduled = false;
+            }
+            else if (isAttemptInProgress())
+            {
+                // the backoff starts only after the attempt has failed, so a slow but healthy attempt is not aborted by it
+                timeSinceAttempt += delta;
+
+                if (timeSinceAttempt >= endpoint->connectionTimeout)
+                {
+                    Log(Log::Level::INFO) << idString << "Connection attempt timed out after " << timeSinceAttempt << "s";
+                    abortAttempt();
+                }
             }
             else
             {
+                if (!reconnectScheduled)
+                {
+                    reconnectDelay = getReconnectDelay();
+                    ++reconnectAttempts;
+                    reconnectScheduled = true;
+                }
+
                 timeSinceConnect += delta;
 
-                if (timeSinceConnect >= endpoint->reconnectInterval)
+                if (timeSinceConnect >= reconnectDelay)
                 {
                     timeSinceConnect = 0.0f;
-                    state = State::UNINITIALIZED;
+                    reconnectScheduled = false;
+                    count(&Counters::reconnects);
 
-                    if (connectCount >= reconnectCount)
+                    if (connectCount >= reconnectCount && !addressPinned)
                     {
                         connectCount = 0;
                         ++addressIndex;
@@ -184,25 +327,25 @@ namespace relay
                         addressIndex = 0;
                     }
 
-                    if (addressIndex < endpoint->addresses.size())
-                    {
-                        socket.connect(endpoint->addresses[addressIndex].ipAddresses.first,
-                                       endpoint->addresses[addressIndex].ipAddresses.second);
-                    }
+                    if (endpoint->connectRaceDelay > 0.0f && !addressPinned) startRace();
+                    else resolve();
                 }
             }
         }
 
-        timeSinceMeasure += delta;
+        // idle connections have no rates to measure
+        if (!session) return;
+
+        session->timeSinceMeasure += delta;
 
-        if (timeSinceMeasure >= 1.0f)
+        if (session->timeSinceMeasure >= 1.0f)
         {
-            timeSinceMeasure = 0.0f;
-            audioRate = currentAudioBytes;
-            videoRate = currentVideoBytes;
+            session->timeSinceMeasure = 0.0f;
+            session->audioRate = session->currentAudioBytes;
+            session->videoRate = session->currentVideoBytes;
 
-            currentAudioBytes = 0;
-            currentVideoBytes = 0;
+            session->currentAudioBytes = 0;
+            session->currentVideoBytes = 0;
         }
     }
 
@@ -242,12 +385,13 @@ namespace relay
 
                 ss << " " << std::setw(6) << (stream ? std::to_string(stream->getServer().getId()) : "") << " ";
 
-                if (metaData.getType() == amf::Node::Type::Dictionary ||
-                    metaData.getType() == amf::Node::Type::Object)
+                if (session &&
+                    (session->metaData.getType() == amf::Node::Type::Dictionary ||
+                     session->metaData.getType() == amf::Node::Type::Object))
                 {
                     bool first = true;
 
-                    for (const std::pair<std::string, amf::Node>& value : metaData.asMap())
+                    for (const std::pair<std::string, amf::Node>& value : session->metaData.asMap())
                     {
                         if (!first) ss << ", ";
                         first = false;
@@ -293,12 +437,13 @@ namespace relay
 
                 str += "</td><td>" + (stream ? std::to_string(stream->getServer().getId()) : "") + "</td><td>";
 
-                if (metaData.getType() == amf::Node::Type::Dictionary ||
-                    metaData.getType() == amf::Node::Type::Object)
+                if (session &&
+                    (session->metaData.getType() == amf::Node::Type::Dictionary ||
+                     session->metaData.getType() == amf::Node::Type::Object))
                 {
                     bool first = true;
 
-                    for (const std::pair<std::string, amf::Node>& value : metaData.asMap())
+                    for (const std::pair<std::string, amf::Node>& value : session->metaData.asMap())
                     {
                         if (!first) str += "<br/>";
                         first = false;
@@ -311,83 +456,201 @@ namespace relay
             }
             case ReportType::JSON:
             {
-                str += "{\"id\":" + std::to_string(id) + "," +
-                    "\"name\":\"" + streamName + "\","
-                    "\"application\":\"" + applicationName + "\"," +
-                    "\"status\":" + (socket.isReady() ? "\"connected\"" : "\"not connected\"") + "," +
-                    "\"address\":\"" + ipToString(socket.getRemoteIPAddress()) + ":" + std::to_string(socket.getRemotePort()) + "\"," +
-                    "\"connection\":";
+                JsonWriter writer(str);
+                getStats(writer);
+                break;
+            }
+        }
+    }
 
-                switch (type)
-                {
-                    case Type::HOST: str += "\"HOST\""; break;
-                    case Type::CLIENT: str += "\"CLIENT\""; break;
-                }
+    void Connection::getStats(JsonWriter& writer) const
+    {
+        writer.beginObject();
+        writer.key("id").value(id);
+        writer.key("name").value(streamName);
+        writer.key("application").value(applicationName);
+        writer.key("status").value(socket.isReady() ? "connected" : "not connected");
+        writer.key("address").value(ipToString(socket.getRemoteIPAddress()) + ":" + std::to_string(socket.getRemotePort()));
 
-                str += ",\"state\":";
+        writer.key("connection");
+        switch (type)
+        {
+            case Type::HOST: writer.value("HOST"); break;
+            case Type::CLIENT: writer.value("CLIENT"); break;
+        }
 
-                switch (state)
-                {
-                    case State::UNINITIALIZED: str += "\"UNINITIALIZED\""; break;
-                    case State::VERSION_RECEIVED: str += "\"VERSION_RECEIVED\""; break;
-                    case State::VERSION_SENT: str += "\"VERSION_SENT\""; break;
-                    case State::ACK_SENT: str += "\"ACK_SENT\","; break;
-                    case State::HANDSHAKE_DONE: str += "\"HANDSHAKE_DONE\""; break;
-                }
+        writer.key("state");
+        switch (state)
+        {
+            case State::UNINITIALIZED: writer.value("UNINITIALIZED"); break;
+            case State::VERSION_RECEIVED: writer.value("VERSION_RECEIVED"); break;
+            case State::VERSION_SENT: writer.value("VERSION_SENT"); break;
+            case State::ACK_SENT: writer.value("ACK_SENT"); break;
+            case State::HANDSHAKE_DONE: writer.value("HANDSHAKE_DONE"); break;
+        }
 
-                str += ",\"direction\":";
+        writer.key("direction");
+        switch (direction)
+        {
+            case Direction::NONE: writer.value("NONE"); break;
+            case Direction::INPUT: writer.value("INPUT"); break;
+            case Direction::OUTPUT: writer.value("OUTPUT"); break;
+        }
 
-                switch (direction)
-                {
-                    case Direction::NONE: str += "\"NONE\""; break;
-                    case Direction::INPUT: str += "\"INPUT\""; break;
-                    case Direction::OUTPUT: str += "\"OUTPUT\""; break;
-                }
+        if (stream) writer.key("serverId").value(stream->getServer().getId());
+        if (type == Type::CLIENT && direction == Direction::OUTPUT) writer.key("standby").value(standby);
 
-                if (stream) str += ",\"serverId\":" + std::to_string(stream->getServer().getId());
+        writer.key("audioRate").value(session ? session->audioRate : 0);
+        writer.key("videoRate").value(session ? session->videoRate : 0);
+        writer.key("bytesReceived").value(counters.bytesReceived);
+        writer.key("bytesSent").value(counters.bytesSent);
+        writer.key("queuedBytes").value(socket.getQueuedBytes());
+        writer.key("framesForwarded").value(counters.framesForwarded);
+        writer.key("framesDropped").value(counters.framesDropped);
 
-                if (metaData.getType() == amf::Node::Type::Dictionary ||
-                    metaData.getType() == amf::Node::Type::Object)
-                {
-                    str += ",\"metaData\":{";
-                    bool first = true;
+        if (direction == Direction::OUTPUT)
+        {
+            writer.key("throttled").value(throttled);
+            writer.key("egressLatency");
+            getEgressLatency().getStats(writer);
+        }
 
-                    for (const std::pair<std::string, amf::Node>& value : metaData.asMap())
-                    {
-                        if (!first) str += ", ";
-                        first = false;
-                        if (value.second.getType() == amf::Node::Type::Boolean)
-                        {
-                            str += "\"" + escapeString(value.first) + "\":" + (value.second.asBool() ? "true" : "false");
-                        }
-                        else if (value.second.isNumber())
-                        {
-                            str += "\"" + escapeString(value.first) + "\":" + value.second.toString();
-                        }
-                        else
-                        {
-                            str += "\"" + escapeString(value.first) + "\":\"" + escapeString(value.second.toString()) + "\"";
-                        }
-                    }
+        if (session &&
+            (session->metaData.getType() == amf::Node::Type::Dictionary ||
+             session->metaData.getType() == amf::Node::Type::Object))
+        {
+            writer.key("metaData").beginObject();
 
-                    str += "}";
-                }
+            for (const auto& value : session->metaData.asMap())
+            {
+                writer.key(value.first);
 
-                str += "}";
-                break;
+                if (value.second.getType() == amf::Node::Type::Boolean)
+                {
+                    writer.value(value.second.asBool());
+                }
+                else if (value.second.isNumber())
+                {
+                    writer.value(value.second.asDouble());
+                }
+                else
+                {
+                    writer.value(value.second.toString());
+                }
             }
+
+            writer.endObject();
         }
+
+        writer.endObject();
+    }
+
+    void Connection::appendMetricLabels(std::string& labels) const
+    {
+        MetricsWriter::appendLabel(labels, "connection", std::to_string(id));
+        MetricsWriter::appendLabel(labels, "type", (type == Type::HOST) ? "host" : "client");
+        MetricsWriter::appendLabel(labels, "address", ipToString(socket.getRemoteIPAddress()) + ":" + std::to_string(socket.getRemotePort()));
     }
 
     void Connection::connect()
     {
         if (!endpoint) return;
 
-        if (addressIndex < endpoint->addresses.size())
+        if (endpoint->connectRaceDelay > 0.0f && !addressPinned) startRace();
+        else resolve();
+    }
+
+    bool Connection::isReconnectPending() const
+    {
+        // waiting for an attempt in progress is not waiting for the reconnect timer
+        return type == Type::CLIENT && endpoint && reconnectScheduled && !isAttemptInProgress();
+    }
+
+    bool Connection::isAttemptInProgress() const
+    {
+        if (socket.isConnecting() || isHandshaking() || resolveRequestId || connectNextAddress) return true;
+
+        for (uint64_t requestId : raceResolveRequestIds)
         {
-            socket.connect(endpoint->addresses[addressIndex].ipAddresses.first,
-                           endpoint->addresses[addressIndex].ipAddresses.second);
+            if (requestId) return true;
         }
+
+        // candidates that were not started yet are still part of the race
+        for (const std::unique_ptr<RaceCandidate>& candidate : raceCandidates)
+        {
+            if (!candidate->failed) return true;
+        }
+
+        return false;
+    }
+
+    void Connection::abortAttempt()
+    {
+        relay.getResolver().cancel(resolveRequestId);
+        resolveRequestId = 0;
+        connectNextAddress = false;
+        stopRace();
+
+        // the socket does not call back when it is closed locally
+        socket.close(true);
+        reset();
+    }
+
+    float Connection::getReconnectDelay()
+    {
+        // the cap never shortens the base interval
+        float delay = std::min(endpoint->reconnectInterval * std::pow(endpoint->reconnectMultiplier, static_cast<float>(reconnectAttempts)),
+                               std::max(endpoint->reconnectInterval, endpoint->reconnectMaxInterval));
+
+        // full jitter: anywhere between 0 and the backoff, so connections that dropped together reconnect apart
+        if (endpoint->reconnectJitter)
+        {
+            std::uniform_real_distribution<float> distribution(0.0f, delay);
+            delay = distribution(relay.getGenerator());
+        }
+
+        return delay;
+    }
+
+    void Connection::resolve()
+    {
+        if (addressIndex >= endpoint->addresses.size()) return;
+
+        // a request still waiting for the previous attempt is replaced, so the records are never older than the TTL
+        relay.getResolver().cancel(resolveRequestId);
+        connectNextAddress = false;
+        timeSinceAttempt = 0.0f;
+
+        resolveRequestId = relay.getResolver().resolve(endpoint->addresses[addressIndex].url,
+                                                       std::bind(&Connection::handleResolve, this, std::placeholders::_1));
+    }
+
+    void Connection::handleResolve(const std::vector<std::pair<uint32_t, uint16_t>>& addresses)
+    {
+        resolveRequestId = 0;
+
+        if (closed || !endpoint) return;
+
+        resolvedAddresses = addresses;
+        resolvedIndex = 0;
+
+        if (resolvedAddresses.empty())
+        {
+            Log(Log::Level::ERR) << idString << "Failed to resolve " << endpoint->addresses[addressIndex].url;
+            return;
+        }
+
+        connectResolved();
+    }
+
+    void Connection::connectResolved()
+    {
+        if (resolvedIndex >= resolvedAddresses.size()) return;
+
+        timeSinceAttempt = 0.0f;
+
+        socket.connect(resolvedAddresses[resolvedIndex].first,
+                       resolvedAddresses[resolvedIndex].second);
     }
 
     void Connection::handleConnect(Socket&)
@@ -403,46 +666,211 @@ namespace relay
         {
             Log(Log::Level::INFO) << idString << "Connected to " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort();
 
-            // C0
-            std::vector<uint8_t> version;
-            version.push_back(RTMP_VERSION);
-            socket.send(version);
+            uint8_t* buffer = prepareData(sizeof(RTMP_VERSION) + sizeof(rtmp::Challenge));
+            if (!buffer) return;
 
-            Log(Log::Level::ALL) << idString << "Sending version message " << RTMP_VERSION;
+            writeClientChallenge(buffer);
 
-            // C1
-            rtmp::Challenge challenge;
-            challenge.time = 0;
-            std::copy(RTMP_SERVER_VERSION, RTMP_SERVER_VERSION + sizeof(RTMP_SERVER_VERSION), challenge.version);
+            RELAY_LOG(Log::Level::ALL) << idString << "Sending version message " << RTMP_VERSION;
+            RELAY_LOG(Log::Level::ALL) << idString << "Sending challenge message";
 
-            for (size_t i = 0; i < sizeof(challenge.randomBytes); ++i)
-            {
-                uint32_t randomValue = std::uniform_int_distribution<uint32_t>{0, 255}(relay.getGenerator());
+            state = State::VERSION_SENT;
+        }
+    }
 
-                challenge.randomBytes[i] = static_cast<uint8_t>(randomValue);
-            }
+    void Connection::startRace()
+    {
+        stopRace();
+        timeSinceAttempt = 0.0f;
+
+        for (uint32_t i = 0; i < endpoint->addresses.size(); ++i)
+        {
+            raceResolveRequestIds.push_back(relay.getResolver().resolve(endpoint->addresses[i].url,
+                                                                        std::bind(&Connection::handleRaceResolve, this, i, std::placeholders::_1)));
+        }
+    }
+
+    void Connection::stopRace()
+    {
+        for (uint64_t requestId : raceResolveRequestIds)
+        {
+            relay.getResolver().cancel(requestId);
+        }
+
+        raceResolveRequestIds.clear();
+        raceCandidates.clear(); // closes the sockets of the attempts that did not win
+        raceWinner = nullptr;
+        raceAdvance = false;
+        timeSinceRaceStart = 0.0f;
+    }
 
-            std::vector<uint8_t> challengeMessage;
-            challengeMessage.insert(challengeMessage.begin(),
-                                    reinterpret_cast<uint8_t*>(&challenge),
-                                    reinterpret_cast<uint8_t*>(&challenge) + sizeof(challenge));
-            socket.send(challengeMessage);
+    void Connection::handleRaceResolve(uint32_t raceAddressIndex, const std::vector<std::pair<uint32_t, uint16_t>>& addresses)
+    {
+        raceResolveRequestIds[raceAddressIndex] = 0;
 
-            Log(Log::Level::ALL) << idString << "Sending challenge message";
+        if (closed || !endpoint) return;
 
-            state = State::VERSION_SENT;
+        if (addresses.empty())
+        {
+            Log(Log::Level::ERR) << idString << "Failed to resolve " << endpoint->addresses[raceAddressIndex].url;
+            return;
+        }
+
+        bool inProgress = false;
+
+        for (const std::unique_ptr<RaceCandidate>& candidate : raceCandidates)
+        {
+            if (candidate->started && !candidate->failed) inProgress = true;
+        }
+
+        for (const std::pair<uint32_t, uint16_t>& address : addresses)
+        {
+            auto i = std::find_if(raceCandidates.begin(), raceCandidates.end(),
+                                  [&address](const std::unique_ptr<RaceCandidate>& candidate) { return candidate->address == address; });
+
+            if (i != raceCandidates.end()) continue;
+
+            std::unique_ptr<RaceCandidate> candidate(new RaceCandidate(relay.getNetwork()));
+            candidate->addressIndex = raceAddressIndex;
+            candidate->address = address;
+            raceCandidates.push_back(std::move(candidate));
+        }
+
+        // the first attempt does not wait for the delay
+        if (!inProgress) raceAdvance = true;
+    }
+
+    void Connection::startRaceCandidate()
+    {
+        AddressHealth& addressHealth = relay.getAddressHealth();
+        RaceCandidate* next = nullptr;
+
+        // ties keep the order of the configuration and of the records
+        for (const std::unique_ptr<RaceCandidate>& candidate : raceCandidates)
+        {
+            if (candidate->started) continue;
+
+            if (!next || addressHealth.isBetter(candidate->address, next->address)) next = candidate.get();
+        }
+
+        if (!next) return;
+
+        Log(Log::Level::INFO) << idString << "Racing to " << ipToString(next->address.first) << ":" << next->address.second;
+
+        RaceCandidate& candidate = *next;
+        candidate.started = true;
+        candidate.startTime = std::chrono::steady_clock::now();
+        timeSinceRaceStart = 0.0f;
+        timeSinceAttempt = 0.0f;
+
+        candidate.socket.setConnectTimeout(endpoint->connectionTimeout);
+        candidate.socket.setConnectCallback([this, &candidate](Socket&) { handleRaceConnect(candidate); });
+        candidate.socket.setConnectErrorCallback([this, &candidate](Socket&) { handleRaceFailure(candidate); });
+        candidate.socket.setReadCallback([this, &candidate](Socket&, const std::vector<uint8_t>& newData) { handleRaceRead(candidate, newData); });
+        candidate.socket.setCloseCallback([this, &candidate](Socket&) { handleRaceFailure(candidate); });
+
+        // a failure inside connect only sets raceAdvance, so this is not re-entered
+        candidate.socket.connect(candidate.address.first, candidate.address.second);
+    }
+
+    void Connection::handleRaceConnect(RaceCandidate& candidate)
+    {
+        uint8_t* buffer = candidate.socket.prepareSend(sizeof(RTMP_VERSION) + sizeof(rtmp::Challenge));
+        if (!buffer) return;
+
+        count(&Counters::bytesSent, sizeof(RTMP_VERSION) + sizeof(rtmp::Challenge));
+        writeClientChallenge(buffer);
+    }
+
+    void Connection::handleRaceRead(RaceCandidate& candidate, const std::vector<uint8_t>& newData)
+    {
+        if (candidate.failed || raceWinner) return;
+
+        candidate.data.insert(candidate.data.end(), newData.begin(), newData.end());
+
+        if (candidate.data.front() != RTMP_VERSION)
+        {
+            Log(Log::Level::ERR) << idString << "Unsupported version (" << static_cast<uint32_t>(candidate.data.front()) << ") from " <<
+                ipToString(candidate.address.first) << ":" << candidate.address.second;
+            candidate.socket.close(true);
+            handleRaceFailure(candidate);
+            return;
+        }
+
+        // the socket is moved in the next update, not while the network is reading from it
+        if (candidate.data.size() >= sizeof(RTMP_VERSION) + sizeof(rtmp::Challenge) + sizeof(rtmp::Ack))
+        {
+            raceWinner = &candidate;
         }
     }
 
+    void Connection::handleRaceFailure(RaceCandidate& candidate)
+    {
+        if (candidate.failed || raceWinner == &candidate) return;
+
+        Log(Log::Level::INFO) << idString << "Failed to race to " << ipToString(candidate.address.first) << ":" << candidate.address.second;
+
+        candidate.failed = true;
+        relay.getAddressHealth().addFailure(candidate.address);
+        raceAdvance = true;
+    }
+
+    void Connection::finishRace()
+    {
+        RaceCandidate& winner = *raceWinner;
+
+        float handshakeTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - winner.startTime).count() / 1000000.0f;
+        relay.getAddressHealth().addSuccess(winner.address, handshakeTime);
+
+        size_t startedCount = 0;
+        raceAddresses.clear();
+        for (const std::unique_ptr<RaceCandidate>& candidate : raceCandidates)
+        {
+            if (candidate->started) ++startedCount;
+            raceAddresses.push_back(candidate->address);
+        }
+
+        Log(Log::Level::INFO) << idString << "Connected to " << ipToString(winner.address.first) << ":" << winner.address.second <<
+            " in " << handshakeTime << "s, " << startedCount << " of " << raceCandidates.size() << " addresses tried";
+
+        socket = std::move(winner.socket);
+        socket.setReadCallback(std::bind(&Connection::handleRead, this, std::placeholders::_1, std::placeholders::_2));
+        socket.setCloseCallback(std::bind(&Connection::handleClose, this, std::placeholders::_1));
+        socket.setConnectCallback(std::bind(&Connection::handleConnect, this, std::placeholders::_1));
+        socket.setConnectErrorCallback(std::bind(&Connection::handleConnectError, this, std::placeholders::_1));
+
+        addressIndex = winner.addressIndex;
+        std::vector<uint8_t> winnerData;
+        winnerData.swap(winner.data);
+
+        stopRace();
+
+        // C0 and C1 were sent by the race, the rest of the handshake goes through the usual states
+        state = State::VERSION_SENT;
+        data.clear();
+        handleRead(socket, winnerData);
+    }
+
     void Connection::handleConnectError(Socket&)
     {
+        // this can be called from inside Socket::connect, so the next record is tried on the next update
+        if (type == Type::CLIENT && resolvedIndex + 1 < resolvedAddresses.size())
+        {
+            Log(Log::Level::INFO) << idString << "Trying the next address of " << endpoint->addresses[addressIndex].url;
+            connectNextAddress = true;
+        }
     }
 
     void Connection::handleRead(Socket&, const std::vector<uint8_t>& newData)
     {
+        capture.write(newData);
+        receiveTime = std::chrono::steady_clock::now();
+
+        BufferPool::reserve(data, data.size() + newData.size());
         data.insert(data.end(), newData.begin(), newData.end());
+        count(&Counters::bytesReceived, newData.size());
 
-        Log(Log::Level::ALL) << idString << "Got " << std::to_string(newData.size()) << " bytes";
+        RELAY_LOG(Log::Level::ALL) << idString << "Got " << std::to_string(newData.size()) << " bytes";
 
         uint32_t offset = 0;
 
@@ -451,19 +879,27 @@ namespace relay
             if (state == State::HANDSHAKE_DONE)
             {
                 rtmp::Packet packet;
+                packet.data = BufferPool::acquire(inChunkSize);
+                uint32_t ret;
 
-                uint32_t ret = packet.decode(data, offset, inChunkSize, receivedPackets);
+                {
+                    RELAY_PROFILE_SCOPE(CHUNK_DECODE);
+                    ret = packet.decode(data, offset, inChunkSize, receivedPackets);
+                }
 
                 if (ret > 0)
                 {
-                    Log(Log::Level::ALL) << idString << "Total packet size: " << ret;
+                    RELAY_LOG(Log::Level::ALL) << idString << "Total packet size: " << ret;
 
                     offset += ret;
+                    count(&Counters::chunksReceived, getChunkCount(packet.data.size(), inChunkSize, 1));
 
                     handlePacket(packet);
+                    BufferPool::release(std::move(packet.data));
                 }
                 else
                 {
+                    BufferPool::release(std::move(packet.data));
                     break;
                 }
             }
@@ -477,20 +913,22 @@ namespace relay
                         uint8_t version = *(data.data() + offset);
                         offset += sizeof(version);
 
-                        Log(Log::Level::ALL) << idString << "Got version " << static_cast<uint32_t>(version);
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got version " << static_cast<uint32_t>(version);
 
                         if (version != 0x03)
                         {
                             Log(Log::Level::ERR) << idString << "Unsupported version(" << version << "), disconnecting";
+                            count(&Counters::handshakeFailures);
                             close();
                             break;
                         }
 
                         // S0
-                        std::vector<uint8_t> reply;
-                        reply.push_back(RTMP_VERSION);
-                        socket.send(reply);
-                        Log(Log::Level::ALL) << idString << "Sending reply version " << RTMP_VERSION;
+                        uint8_t* buffer = prepareData(sizeof(RTMP_VERSION));
+                        if (!buffer) break;
+
+                        *buffer = RTMP_VERSION;
+                        RELAY_LOG(Log::Level::ALL) << idString << "Sending reply version " << RTMP_VERSION;
 
                         state = State::VERSION_SENT;
                     }
@@ -507,42 +945,46 @@ namespace relay
                         rtmp::Challenge* challenge = reinterpret_cast<rtmp::Challenge*>(data.data() + offset);
                         offset += sizeof(*challenge);
 
-                        Log(Log::Level::ALL) << idString << "Got challenge message, time: " << challenge->time <<
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got challenge message, time: " << challenge->time <<
                         ", version: " << static_cast<uint32_t>(challenge->version[0]) << "." <<
                         static_cast<uint32_t>(challenge->version[1]) << "." <<
                         static_cast<uint32_t>(challenge->version[2]) << "." <<
                         static_cast<uint32_t>(challenge->version[3]);
 
-                        // S1
-                        rtmp::Challenge replyChallenge;
-                        replyChallenge.time = 0;
-                        std::copy(RTMP_SERVER_VERSION, RTMP_SERVER_VERSION + sizeof(RTMP_SERVER_VERSION), replyChallenge.version);
+                        // clients that send a zero version do not sign C1
+                        uint32_t digestOffset = 0;
+                        rtmp::DigestScheme scheme = rtmp::DigestScheme::NONE;
 
-                        for (size_t i = 0; i < sizeof(replyChallenge.randomBytes); ++i)
+                        if (challenge->version[0] || challenge->version[1] || challenge->version[2] || challenge->version[3])
                         {
-                            uint32_t randomValue = std::uniform_int_distribution<uint32_t>{0, 255}(relay.getGenerator());
-                            replyChallenge.randomBytes[i] = static_cast<uint8_t>(randomValue);
+                            scheme = rtmp::findDigest(reinterpret_cast<const uint8_t*>(challenge), rtmp::Peer::CLIENT, digestOffset);
                         }
 
-                        std::vector<uint8_t> reply;
-                        reply.insert(reply.begin(),
-                                     reinterpret_cast<uint8_t*>(&replyChallenge),
-                                     reinterpret_cast<uint8_t*>(&replyChallenge) + sizeof(replyChallenge));
-                        socket.send(reply);
+                        // S1 and S2
+                        uint8_t* buffer = prepareData(sizeof(rtmp::Challenge) + sizeof(rtmp::Ack));
+                        if (!buffer) break;
 
-                        Log(Log::Level::ALL) << idString << "Sending challange reply message";
+                        writeChallenge(buffer);
 
-                        // S2
-                        rtmp::Ack ack;
-                        ack.time = challenge->time;
-                        std::copy(challenge->version, challenge->version + sizeof(ack.version), ack.version);
-                        std::copy(challenge->randomBytes, challenge->randomBytes + sizeof(ack.randomBytes), ack.randomBytes);
+                        if (scheme == rtmp::DigestScheme::NONE)
+                        {
+                            // S2 echoes the time, version and random bytes of C1
+                            memcpy(buffer + sizeof(rtmp::Challenge), challenge, sizeof(rtmp::Ack));
+                        }
+                        else
+                        {
+                            RELAY_LOG(Log::Level::ALL) << idString << "Challenge has a digest, scheme " << (scheme == rtmp::DigestScheme::SCHEME0 ? 0 : 1);
+
+                            // S1 is signed with the same scheme, S2 is random bytes signed with the digest of C1
+                            rtmp::writeDigest(buffer, rtmp::Peer::SERVER, scheme);
 
-                        std::vector<uint8_t> ackData(reinterpret_cast<uint8_t*>(&ack),
-                                                     reinterpret_cast<uint8_t*>(&ack) + sizeof(ack));
-                        socket.send(ackData);
+                            uint8_t* ack = buffer + sizeof(rtmp::Challenge);
+                            relay.fillRandom(ack, sizeof(rtmp::Ack));
+                            rtmp::writeAckDigest(ack, rtmp::Peer::SERVER, reinterpret_cast<const uint8_t*>(challenge) + digestOffset);
+                        }
 
-                        Log(Log::Level::ALL) << idString << "Sending Ack message";
+                        RELAY_LOG(Log::Level::ALL) << idString << "Sending challange reply message";
+                        RELAY_LOG(Log::Level::ALL) << idString << "Sending Ack message";
 
                         state = State::ACK_SENT;
                     }
@@ -559,12 +1001,12 @@ namespace relay
                         rtmp::Ack* ack = reinterpret_cast<rtmp::Ack*>(data.data() + offset);
                         offset += sizeof(*ack);
 
-                        Log(Log::Level::ALL) << idString << "Got Ack reply message, time: " << ack->time <<
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got Ack reply message, time: " << ack->time <<
                             ", version: " << static_cast<uint32_t>(ack->version[0]) << "." <<
                         static_cast<uint32_t>(ack->version[1]) << "." <<
                         static_cast<uint32_t>(ack->version[2]) << "." <<
                         static_cast<uint32_t>(ack->version[3]);
-                        Log(Log::Level::ALL) << idString << "Handshake done";
+                        RELAY_LOG(Log::Level::ALL) << idString << "Handshake done";
 
                         state = State::HANDSHAKE_DONE;
                     }
@@ -584,7 +1026,7 @@ namespace relay
                         uint8_t version = *(data.data() + offset);
                         offset += sizeof(version);
 
-                        Log(Log::Level::ALL) << idString << "Got reply version " << static_cast<uint32_t>(version);
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got reply version " << static_cast<uint32_t>(version);
 
                         if (version != 0x03)
                         {
@@ -608,23 +1050,34 @@ namespace relay
                         rtmp::Challenge* challenge = reinterpret_cast<rtmp::Challenge*>(data.data() + offset);
                         offset += sizeof(*challenge);
 
-                        Log(Log::Level::ALL) << idString << "Got challenge reply message, time: " << challenge->time <<
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got challenge reply message, time: " << challenge->time <<
                             ", version: " << static_cast<uint32_t>(challenge->version[0]) << "." <<
                         static_cast<uint32_t>(challenge->version[1]) << "." <<
                         static_cast<uint32_t>(challenge->version[2]) << "." <<
                         static_cast<uint32_t>(challenge->version[3]);
 
+                        uint32_t digestOffset = 0;
+                        rtmp::DigestScheme scheme = rtmp::findDigest(reinterpret_cast<const uint8_t*>(challenge), rtmp::Peer::SERVER, digestOffset);
+
                         // C2
-                        rtmp::Ack ack;
-                        ack.time = challenge->time;
-                        std::copy(challenge->version, challenge->version + sizeof(ack.version), ack.version);
-                        std::copy(challenge->randomBytes, challenge->randomBytes + sizeof(ack.randomBytes), ack.randomBytes);
+                        uint8_t* buffer = prepareData(sizeof(rtmp::Ack));
+                        if (!buffer) break;
 
-                        std::vector<uint8_t> ackData(reinterpret_cast<uint8_t*>(&ack),
-                                                     reinterpret_cast<uint8_t*>(&ack) + sizeof(ack));
-                        socket.send(ackData);
+                        if (scheme == rtmp::DigestScheme::NONE)
+                        {
+                            // echoes the time, version and random bytes of S1
+                            memcpy(buffer, challenge, sizeof(rtmp::Ack));
+                        }
+                        else
+                        {
+                            RELAY_LOG(Log::Level::ALL) << idString << "Challenge reply has a digest, scheme " << (scheme == rtmp::DigestScheme::SCHEME0 ? 0 : 1);
 
-                        Log(Log::Level::ALL) << "[" << id << ", " << name << " " << applicationName << "/" << streamName << "] " << "Sending Ack message";
+                            // random bytes signed with the digest of S1
+                            relay.fillRandom(buffer, sizeof(rtmp::Ack));
+                            rtmp::writeAckDigest(buffer, rtmp::Peer::CLIENT, reinterpret_cast<const uint8_t*>(challenge) + digestOffset);
+                        }
+
+                        RELAY_LOG(Log::Level::ALL) << "[" << id << ", " << name << " " << applicationName << "/" << streamName << "] " << "Sending Ack message";
 
                         state = State::ACK_SENT;
                     }
@@ -641,16 +1094,16 @@ namespace relay
                         rtmp::Ack* ack = reinterpret_cast<rtmp::Ack*>(data.data() + offset);
                         offset += sizeof(*ack);
 
-                        Log(Log::Level::ALL) << idString << "Got Ack reply message, time: " << ack->time <<
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got Ack reply message, time: " << ack->time <<
                             ", version: " << static_cast<uint32_t>(ack->version[0]) << "." <<
                             static_cast<uint32_t>(ack->version[1]) << "." <<
                             static_cast<uint32_t>(ack->version[2]) << "." <<
                             static_cast<uint32_t>(ack->version[3]);
-                        Log(Log::Level::ALL) << idString << "Handshake done";
+                        RELAY_LOG(Log::Level::ALL) << idString << "Handshake done";
                         
                         state = State::HANDSHAKE_DONE;
 
-                        Log(Log::Level::ALL) << idString << "Connecting to application " << applicationName;
+                        RELAY_LOG(Log::Level::ALL) << idString << "Connecting to application " << applicationName;
 
                         sendConnect();
                     }
@@ -675,36 +1128,152 @@ namespace relay
         {
             data.erase(data.begin(), data.begin() + offset);
             
-            Log(Log::Level::ALL) << idString << "Remaining data " << data.size();
+            RELAY_LOG(Log::Level::ALL) << idString << "Remaining data " << data.size();
         }
+
+        // a burst of large messages does not keep its buffer in every idle connection, and connections without a
+        // session do not keep the buffer of the handshake
+        BufferPool::shrink(data, session ? BufferPool::KEEP_CAPACITY : 0);
     }
 
     void Connection::handleClose(Socket&)
     {
         Log(Log::Level::INFO) << idString << "Handle close connection at " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " disconnected";
 
+        bool wasConnected = (type == Type::CLIENT && state == State::HANDSHAKE_DONE);
+
         reset();
 
-        timeSincePing = 0.0f;
         timeSinceConnect = 0.0f;
+
+        if (wasConnected && endpoint && endpoint->connectRaceDelay > 0.0f)
+        {
+            AddressHealth& addressHealth = relay.getAddressHealth();
+            std::pair<uint32_t, uint16_t> address(socket.getRemoteIPAddress(), socket.getRemotePort());
+            addressHealth.addFailure(address);
+
+            bool healthyAddress = false;
+            for (const std::pair<uint32_t, uint16_t>& raceAddress : raceAddresses)
+            {
+                if (raceAddress != address && !addressHealth.isFailing(raceAddress)) healthyAddress = true;
+            }
+
+            // racing endpoints fail over right away to another healthy address, but only once after an established session,
+            // a connection that keeps dropping waits for the backoff
+            if (healthyAddress && reconnectAttempts == 0)
+            {
+                reconnectDelay = 0.0f;
+                reconnectScheduled = true;
+                ++reconnectAttempts;
+            }
+        }
+    }
+
+    void Connection::count(uint64_t Counters::* counter, uint64_t value)
+    {
+        counters.*counter += value;
+        relay.getCounters().*counter += value;
+    }
+
+    bool Connection::sendData(const std::vector<uint8_t>& buffer)
+    {
+        if (!socket.send(buffer)) return false;
+
+        count(&Counters::bytesSent, buffer.size());
+        return true;
+    }
+
+    uint8_t* Connection::prepareData(size_t size)
+    {
+        uint8_t* buffer = socket.prepareSend(size);
+        if (buffer) count(&Counters::bytesSent, size);
+
+        return buffer;
+    }
+
+    static_assert(sizeof(rtmp::Challenge) == rtmp::HANDSHAKE_SIZE && sizeof(rtmp::Ack) == rtmp::HANDSHAKE_SIZE, "Handshake messages are written and read as raw bytes");
+
+    // C1 and S1: zero time, our version and random bytes
+    void Connection::writeChallenge(uint8_t* buffer)
+    {
+        memset(buffer, 0, sizeof(rtmp::Challenge::time));
+        buffer += sizeof(rtmp::Challenge::time);
+
+        memcpy(buffer, RTMP_SERVER_VERSION, sizeof(RTMP_SERVER_VERSION));
+        buffer += sizeof(RTMP_SERVER_VERSION);
+
+        relay.fillRandom(buffer, sizeof(rtmp::Challenge::randomBytes));
+    }
+
+    void Connection::writeClientChallenge(uint8_t* buffer)
+    {
+        *buffer = RTMP_VERSION;
+        writeChallenge(buffer + sizeof(RTMP_VERSION));
+
+        // servers that only do the simple handshake ignore the digest
+        rtmp::writeDigest(buffer + sizeof(RTMP_VERSION), rtmp::Peer::CLIENT, rtmp::DigestScheme::SCHEME0);
+    }
+
+    bool Connection::sendPacket(const rtmp::Packet& packet)
+    {
+        // the payload and the largest header (basic, message header and extended timestamp) of every chunk
+        uint64_t chunks = getChunkCount(packet.data.size(), outChunkSize, 1);
+        std::vector<uint8_t> buffer = BufferPool::acquire(packet.data.size() + chunks * 18);
+        packet.encode(buffer, outChunkSize, sentPackets);
+
+        bool result = sendData(buffer);
+        BufferPool::release(std::move(buffer));
+
+        if (!result) return false;
+
+        count(&Counters::chunksSent, getChunkCount(packet.data.size(), outChunkSize, 0));
+        return true;
     }
 
     bool Connection::handlePacket(const rtmp::Packet& packet)
     {
+        RELAY_PROFILE_SCOPE(HANDLE_PACKET);
+
+        // only protocol control messages and the connect command come before the session
+        if (!session &&
+            packet.messageType != rtmp::MessageType::SET_CHUNK_SIZE &&
+            packet.messageType != rtmp::MessageType::ABORT &&
+            packet.messageType != rtmp::MessageType::BYTES_READ &&
+            packet.messageType != rtmp::MessageType::USER_CONTROL &&
+            packet.messageType != rtmp::MessageType::SERVER_BANDWIDTH &&
+            packet.messageType != rtmp::MessageType::CLIENT_BANDWIDTH &&
+            packet.messageType != rtmp::MessageType::AMF0_INVOKE &&
+            packet.messageType != rtmp::MessageType::AMF3_INVOKE)
+        {
+            Log(Log::Level::INFO) << idString << "Invalid message before connect received, disconnecting";
+            close();
+            return false;
+        }
+
         switch (packet.messageType)
         {
             case rtmp::MessageType::SET_CHUNK_SIZE:
             {
                 uint32_t offset = 0;
 
-                uint32_t ret = decodeIntBE(packet.data, offset, 4, inChunkSize);
+                uint32_t newChunkSize;
+                uint32_t ret = decodeIntBE(packet.data, offset, 4, newChunkSize);
 
                 if (ret == 0)
                 {
                     return false;
                 }
 
-                Log(Log::Level::ALL) << idString << "Received SET_CHUNK_SIZE, parameter: " << inChunkSize;
+                // the most significant bit must be zero
+                if (newChunkSize == 0 || newChunkSize > 0x7FFFFFFF)
+                {
+                    Log(Log::Level::ERR) << idString << "Invalid chunk size: " << newChunkSize;
+                    return false;
+                }
+
+                inChunkSize = newChunkSize;
+
+                RELAY_LOG(Log::Level::ALL) << idString << "Received SET_CHUNK_SIZE, parameter: " << inChunkSize;
 
                 if (type == Type::CLIENT)
                 {
@@ -716,7 +1285,7 @@ namespace relay
 
             case rtmp::MessageType::ABORT:
             {
-                Log(Log::Level::ALL) << idString << "Received ABORT";
+                RELAY_LOG(Log::Level::ALL) << idString << "Received ABORT";
                 break;
             }
 
@@ -732,7 +1301,7 @@ namespace relay
                     return false;
                 }
 
-                Log(Log::Level::ALL) << idString << "Received BYTES_READ, parameter: " << bytesRead;
+                RELAY_LOG(Log::Level::ALL) << idString << "Received BYTES_READ, parameter: " << bytesRead;
 
                 break;
             }
@@ -763,6 +1332,7 @@ namespace relay
 
                 offset += ret;
 
+                if (Log::isEnabled(Log::Level::ALL))
                 {
                     Log log(Log::Level::ALL);
                     log << idString << "Received PING, type: ";
@@ -774,14 +1344,17 @@ namespace relay
                         case rtmp::UserControlType::CLIENT_BUFFER_TIME: log << "CLIENT_BUFFER_TIME"; break;
                         case rtmp::UserControlType::RESET_STREAM: log << "RESET_STREAM"; break;
                         case rtmp::UserControlType::PING: log << "PING"; break;
-                        case rtmp::UserControlType::PONG: log << "PONG";
-                            timeSincePong = 0;
-                            break;
+                        case rtmp::UserControlType::PONG: log << "PONG"; break;
                     }
 
                     log << ", param: " << param;
                 }
 
+                if (userControlType == rtmp::UserControlType::PONG && session)
+                {
+                    session->timeSincePong = 0;
+                }
+
                 if (userControlType == rtmp::UserControlType::PING)
                 {
                     sendUserControl(rtmp::UserControlType::PONG, packet.timestamp);
@@ -804,7 +1377,7 @@ namespace relay
 
                 offset += ret;
 
-                Log(Log::Level::ALL) << idString << "Received SERVER_BANDWIDTH, parameter: " << bandwidth;
+                RELAY_LOG(Log::Level::ALL) << idString << "Received SERVER_BANDWIDTH, parameter: " << bandwidth;
 
                 break;
             }
@@ -833,7 +1406,7 @@ namespace relay
 
                 offset += ret;
 
-                Log(Log::Level::ALL) << idString << "Received CLIENT_BANDWIDTH, parameter: " << bandwidth << ", type: " << bandwidthType;
+                RELAY_LOG(Log::Level::ALL) << idString << "Received CLIENT_BANDWIDTH, parameter: " << bandwidth << ", type: " << bandwidthType;
 
                 break;
             }
@@ -877,6 +1450,7 @@ namespace relay
 
                     offset += ret;
 
+                    if (Log::isEnabled(Log::Level::ALL))
                     {
                         Log log(Log::Level::ALL);
                         log << idString << "Received NOTIFY, command: ";
@@ -889,9 +1463,12 @@ namespace relay
                     {
                         offset += ret;
 
-                        Log log(Log::Level::ALL);
-                        log << idString << "Argument 1: ";
-                        argument1.dump(log);
+                        if (Log::isEnabled(Log::Level::ALL))
+                        {
+                            Log log(Log::Level::ALL);
+                            log << idString << "Argument 1: ";
+                            argument1.dump(log);
+                        }
                     }
 
                     amf::Node argument2;
@@ -900,9 +1477,12 @@ namespace relay
                     {
                         offset += ret;
 
-                        Log log(Log::Level::ALL);
-                        log << idString << "Argument 2: ";
-                        argument2.dump(log);
+                        if (Log::isEnabled(Log::Level::ALL))
+                        {
+                            Log log(Log::Level::ALL);
+                            log << idString << "Argument 2: ";
+                            argument2.dump(log);
+                        }
                     }
 
                     if (command.asString() == "@setDataFrame" &&
@@ -910,28 +1490,28 @@ namespace relay
                         (argument2.getType() == amf::Node::Type::Dictionary ||
                          argument2.getType() == amf::Node::Type::Object))
                     {
-                        metaData = argument2;
+                        session->metaData = argument2;
 
-                        if (metaData.hasElement("audiocodecid"))
+                        if (Log::isEnabled(Log::Level::ALL) && session->metaData.hasElement("audiocodecid"))
                         {
-                            if (metaData["audiocodecid"].isNumber())
-                                Log(Log::Level::ALL) << "Audio codec: " << getAudioCodec(static_cast<AudioCodec>(metaData["audiocodecid"].asUInt32()));
-                            else if (metaData["audiocodecid"].isString())
-                                Log(Log::Level::ALL) << "Audio codec: " << metaData["audiocodecid"].asString();
+                            if (session->metaData["audiocodecid"].isNumber())
+                                Log(Log::Level::ALL) << "Audio codec: " << getAudioCodec(static_cast<AudioCodec>(session->metaData["audiocodecid"].asUInt32()));
+                            else if (session->metaData["audiocodecid"].isString())
+                                Log(Log::Level::ALL) << "Audio codec: " << session->metaData["audiocodecid"].asString();
                         }
 
-                        if (metaData.hasElement("videocodecid"))
+                        if (Log::isEnabled(Log::Level::ALL) && session->metaData.hasElement("videocodecid"))
                         {
-                            if (metaData["videocodecid"].isNumber())
-                                Log(Log::Level::ALL) << "Video codec: " << getVideoCodec(static_cast<VideoCodec>(metaData["videocodecid"].asUInt32()));
-                            else if (metaData["videocodecid"].isString())
-                                Log(Log::Level::ALL) << "Video codec: " << metaData["videocodecid"].asString();
+                            if (session->metaData["videocodecid"].isNumber())
+                                Log(Log::Level::ALL) << "Video codec: " << getVideoCodec(static_cast<VideoCodec>(session->metaData["videocodecid"].asUInt32()));
+                            else if (session->metaData["videocodecid"].isString())
+                                Log(Log::Level::ALL) << "Video codec: " << session->metaData["videocodecid"].asString();
                         }
 
                         // forward notify packet
                         if (stream)
                         {
-                            stream->sendMetaData(metaData);
+                            stream->sendMetaData(session->metaData);
                             timeSinceLastData = 0;
                         }
                         else
@@ -945,28 +1525,28 @@ namespace relay
                              (argument1.getType() == amf::Node::Type::Dictionary ||
                               argument1.getType() == amf::Node::Type::Object))
                     {
-                        metaData = argument1;
+                        session->metaData = argument1;
 
-                        if (metaData.hasElement("audiocodecid"))
+                        if (Log::isEnabled(Log::Level::ALL) && session->metaData.hasElement("audiocodecid"))
                         {
-                            if (metaData["audiocodecid"].isNumber())
-                                Log(Log::Level::ALL) << "Audio codec: " << getAudioCodec(static_cast<AudioCodec>(metaData["audiocodecid"].asUInt32()));
-                            else if (metaData["audiocodecid"].isString())
-                                Log(Log::Level::ALL) << "Audio codec: " << metaData["audiocodecid"].asString();
+                            if (session->metaData["audiocodecid"].isNumber())
+                                Log(Log::Level::ALL) << "Audio codec: " << getAudioCodec(static_cast<AudioCodec>(session->metaData["audiocodecid"].asUInt32()));
+                            else if (session->metaData["audiocodecid"].isString())
+                                Log(Log::Level::ALL) << "Audio codec: " << session->metaData["audiocodecid"].asString();
                         }
 
-                        if (metaData.hasElement("videocodecid"))
+                        if (Log::isEnabled(Log::Level::ALL) && session->metaData.hasElement("videocodecid"))
                         {
-                            if (metaData["videocodecid"].isNumber())
-                                Log(Log::Level::ALL) << "Video codec: " << getVideoCodec(static_cast<VideoCodec>(metaData["videocodecid"].asUInt32()));
-                            else if (metaData["videocodecid"].isString())
-                                Log(Log::Level::ALL) << "Video codec: " << metaData["videocodecid"].asString();
+                            if (session->metaData["videocodecid"].isNumber())
+                                Log(Log::Level::ALL) << "Video codec: " << getVideoCodec(static_cast<VideoCodec>(session->metaData["videocodecid"].asUInt32()));
+                            else if (session->metaData["videocodecid"].isString())
+                                Log(Log::Level::ALL) << "Video codec: " << session->metaData["videocodecid"].asString();
                         }
 
                         // forward notify packet
                         if (stream)
                         {
-                            stream->sendMetaData(metaData);
+                            stream->sendMetaData(session->metaData);
                             timeSinceLastData = 0;
                         }
                         else
@@ -1005,13 +1585,14 @@ namespace relay
                 // only input can receive audio packets
                 if (direction == Direction::INPUT)
                 {
+                    if (Log::isEnabled(Log::Level::ALL))
                     {
                         Log log(Log::Level::ALL);
                         log << idString << "Received AUDIO_PACKET";
                         if (isCodecHeader(packet.data)) log << "(header)";
                     }
 
-                    currentAudioBytes += packet.data.size();
+                    session->currentAudioBytes += packet.data.size();
                     timeSinceLastData = 0;
 
                     if (isCodecHeader(packet.data))
@@ -1020,7 +1601,7 @@ namespace relay
                         AudioCodec codec = static_cast<AudioCodec>((format & 0xf0) >> 4);
                         uint32_t channels = (format & 0x01) + 1;
                         uint32_t sampleSize = (format & 0x02) ? 2 : 1;
-                        Log(Log::Level::ALL) << "Codec: " << getAudioCodec(codec) << ", channels: " << channels << ", sampleSize: " << sampleSize * 8;
+                        RELAY_LOG(Log::Level::ALL) << "Codec: " << getAudioCodec(codec) << ", channels: " << channels << ", sampleSize: " << sampleSize * 8;
 
                         if (stream)
                         {
@@ -1064,6 +1645,7 @@ namespace relay
                 {
                     VideoFrameType frameType = getVideoFrameType(packet.data);
 
+                    if (Log::isEnabled(Log::Level::ALL))
                     {
                         Log log(Log::Level::ALL);
                         log << idString << "Received VIDEO_PACKET";
@@ -1084,14 +1666,14 @@ namespace relay
                         }
                     }
 
-                    currentVideoBytes += packet.data.size();
+                    session->currentVideoBytes += packet.data.size();
                     timeSinceLastData = 0;
 
                     if (isCodecHeader(packet.data))
                     {
                         uint8_t format = packet.data[0];
                         VideoCodec codec = static_cast<VideoCodec>(format & 0x0f);
-                        Log(Log::Level::ALL) << "Codec: " << getVideoCodec(codec);
+                        RELAY_LOG(Log::Level::ALL) << "Codec: " << getVideoCodec(codec);
 
                         if (stream)
                         {
@@ -1110,7 +1692,7 @@ namespace relay
                         // forward video packet
                         if (stream)
                         {
-                            stream->sendVideoFrame(packet.timestamp, packet.data, frameType);
+                            stream->sendVideoFrame(packet.timestamp, packet.data, frameType, receiveTime);
                         }
                         else
                         {
@@ -1165,6 +1747,7 @@ namespace relay
 
                 offset += ret;
 
+                if (Log::isEnabled(Log::Level::ALL))
                 {
                     Log log(Log::Level::ALL);
                     log << idString << "Received INVOKE, command: ";
@@ -1182,6 +1765,7 @@ namespace relay
 
                 offset += ret;
 
+                if (Log::isEnabled(Log::Level::ALL))
                 {
                     Log log(Log::Level::ALL);
                     log << idString << "Transaction ID: ";
@@ -1194,15 +1778,27 @@ namespace relay
                 {
                     offset += ret;
 
-                    Log log(Log::Level::ALL);
-                    log << idString << "Argument 1: ";
-                    argument1.dump(log);
+                    if (Log::isEnabled(Log::Level::ALL))
+                    {
+                        Log log(Log::Level::ALL);
+                        log << idString << "Argument 1: ";
+                        argument1.dump(log);
+                    }
+                }
+
+                if (!session && (type != Type::HOST || command.asString() != "connect"))
+                {
+                    Log(Log::Level::INFO) << idString << "Invalid message (\"" << command.asString() << "\") before connect received, disconnecting";
+                    close();
+                    return false;
                 }
 
                 if (command.asString() == "connect")
                 {
                     if (type == Type::HOST)
                     {
+                        startSession();
+
                         applicationName = argument1["app"].asString();
 
                         if (argument1.hasElement("objectEncoding"))
@@ -1223,9 +1819,12 @@ namespace relay
                         Log(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " sent connect, application: \"" << argument1["app"].asString() << "\"";
 
 #ifdef DEBUG
-                        Log log(Log::Level::ALL);
-                        log << "Connect argument: ";
-                        argument1.dump(log);
+                        if (Log::isEnabled(Log::Level::ALL))
+                        {
+                            Log log(Log::Level::ALL);
+                            log << "Connect argument: ";
+                            argument1.dump(log);
+                        }
 #endif
                     }
                     else
@@ -1382,9 +1981,12 @@ namespace relay
                         {
                             offset += ret;
 
-                            Log log(Log::Level::ALL);
-                            log << idString << "Argument 2: ";
-                            argument2.dump(log);
+                            if (Log::isEnabled(Log::Level::ALL))
+                            {
+                                Log log(Log::Level::ALL);
+                                log << idString << "Argument 2: ";
+                                argument2.dump(log);
+                            }
                         }
 
                         streamName = argument2.asString();
@@ -1468,9 +2070,12 @@ namespace relay
                     {
                         offset += ret;
 
-                        Log log(Log::Level::ALL);
-                        log << idString << "Argument 2: ";
-                        argument2.dump(log);
+                        if (Log::isEnabled(Log::Level::ALL))
+                        {
+                            Log log(Log::Level::ALL);
+                            log << idString << "Argument 2: ";
+                            argument2.dump(log);
+                        }
                     }
 
                     Log(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " sent play, stream: \"" << argument2.asString() << "\"";
@@ -1532,9 +2137,12 @@ namespace relay
                     {
                         offset += ret;
 
-                        Log log(Log::Level::ALL);
-                        log << idString << "Argument 2: ";
-                        argument2.dump(log);
+                        if (Log::isEnabled(Log::Level::ALL))
+                        {
+                            Log log(Log::Level::ALL);
+                            log << idString << "Argument 2: ";
+                            argument2.dump(log);
+                        }
                     }
 
                     // TODO: paarbaudiit - izskataas nepareizi
@@ -1555,6 +2163,7 @@ namespace relay
                         }
 
                         streaming = true;
+                        reconnectAttempts = 0; // the session is established, the next drop backs off from the base interval
                         stream->start(*this);
                     }
                     else if (argument2["code"].asString() == "NetStream.Play.Start")
@@ -1582,49 +2191,53 @@ namespace relay
                         }
 
                         streaming = true;
+                        reconnectAttempts = 0;
                         stream->start(*this);
                     }
 
                 }
                 else if (command.asString() == "_error")
                 {
-                    auto i = invokes.find(static_cast<uint32_t>(transactionId.asDouble()));
+                    auto i = session->invokes.find(static_cast<uint32_t>(transactionId.asDouble()));
 
-                    if (i != invokes.end())
+                    if (i != session->invokes.end())
                     {
-                        Log(Log::Level::ALL) << idString << i->second << " error";
+                        RELAY_LOG(Log::Level::ALL) << idString << i->second << " error";
 
-                        invokes.erase(i);
+                        session->invokes.erase(i);
                     }
                     else
                     {
-                        Log(Log::Level::ALL) << idString << i->second << "Invalid _error received";
+                        RELAY_LOG(Log::Level::ALL) << idString << "Invalid _error received";
                     }
                 }
                 else if (command.asString() == "_result")
                 {
-                    auto i = invokes.find(static_cast<uint32_t>(transactionId.asDouble()));
+                    auto i = session->invokes.find(static_cast<uint32_t>(transactionId.asDouble()));
 
-                    if (i != invokes.end())
+                    if (i != session->invokes.end())
                     {
-                        Log(Log::Level::ALL) << idString << i->second << " result";
+                        RELAY_LOG(Log::Level::ALL) << idString << i->second << " result";
 
                         if (i->second == "connect")
                         {
                             connected = true;
 
+                            // without a stream the session is established by the connect
+                            if (streamName.empty()) reconnectAttempts = 0;
+
                             if (!streamName.empty())
                             {
                                 if (direction == Direction::OUTPUT)
                                 {
-                                    Log(Log::Level::ALL) << idString << "Publishing stream " << streamName;
+                                    RELAY_LOG(Log::Level::ALL) << idString << "Publishing stream " << streamName;
 
                                     sendReleaseStream();
                                     sendFCPublish();
                                 }
                                 else if (direction == Direction::INPUT)
                                 {
-                                    Log(Log::Level::ALL) << idString << "Subscribing to stream " << streamName;
+                                    RELAY_LOG(Log::Level::ALL) << idString << "Subscribing to stream " << streamName;
 
                                     sendFCSubscribe();
                                 }
@@ -1646,9 +2259,12 @@ namespace relay
                             {
                                 offset += ret;
 
-                                Log log(Log::Level::ALL);
-                                log << idString << "Argument 2: ";
-                                argument2.dump(log);
+                                if (Log::isEnabled(Log::Level::ALL))
+                                {
+                                    Log log(Log::Level::ALL);
+                                    log << idString << "Argument 2: ";
+                                    argument2.dump(log);
+                                }
                             }
 
                             streamId = static_cast<uint32_t>(argument2.asDouble());
@@ -1664,17 +2280,17 @@ namespace relay
                                 sendPublish();
                             }
 
-                            Log(Log::Level::ALL) << idString << "Created stream " << streamId;
+                            RELAY_LOG(Log::Level::ALL) << idString << "Created stream " << streamId;
                         }
                         else if (i->second == "deleteStream")
                         {
                         }
 
-                        invokes.erase(i);
+                        session->invokes.erase(i);
                     }
                     else
                     {
-                        Log(Log::Level::ALL) << idString << "Invalid _result received, transaction ID: " << static_cast<uint32_t>(transactionId.asDouble());
+                        RELAY_LOG(Log::Level::ALL) << idString << "Invalid _result received, transaction ID: " << static_cast<uint32_t>(transactionId.asDouble());
                     }
                 }
                 break;
@@ -1683,13 +2299,13 @@ namespace relay
             case rtmp::MessageType::AMF0_SHARED_OBJECT:
             case rtmp::MessageType::AMF3_SHARED_OBJECT:
             {
-                Log(Log::Level::ALL) << idString << "Received shared object";
+                RELAY_LOG(Log::Level::ALL) << idString << "Received shared object";
                 break;
             }
 
             case rtmp::MessageType::AGGREGATE:
             {
-                Log(Log::Level::ALL) << idString << "Received aggregated messages";
+                RELAY_LOG(Log::Level::ALL) << idString << "Received aggregated messages";
                 break;
             }
 
@@ -1778,12 +2394,9 @@ namespace relay
 
         encodeIntBE(packet.data, 4, serverBandwidth);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending SERVER_BANDWIDTH";
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending SERVER_BANDWIDTH";
 
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendClientBandwidth()
@@ -1796,12 +2409,9 @@ namespace relay
         encodeIntBE(packet.data, 4, serverBandwidth);
         encodeIntBE(packet.data, 1, 2); // dynamic
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending CLIENT_BANDWIDTH";
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending CLIENT_BANDWIDTH";
 
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendUserControl(rtmp::UserControlType userControlType, uint64_t timestamp, uint32_t parameter1, uint32_t parameter2)
@@ -1815,26 +2425,26 @@ namespace relay
         encodeIntBE(packet.data, 4, parameter1); // parameter 1
         if (parameter2 != 0) encodeIntBE(packet.data, 4, parameter2); // parameter 2
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        if (Log::isEnabled(Log::Level::ALL))
+        {
+            Log log(Log::Level::ALL);
+            log << idString << "Sending USER_CONTROL of type: ";
 
-        Log log(Log::Level::ALL);
-        log << idString << "Sending USER_CONTROL of type: ";
+            switch (userControlType)
+            {
+                case rtmp::UserControlType::CLEAR_STREAM: log << "CLEAR_STREAM"; break;
+                case rtmp::UserControlType::CLEAR_BUFFER: log << "CLEAR_BUFFER"; break;
+                case rtmp::UserControlType::CLIENT_BUFFER_TIME: log << "CLIENT_BUFFER_TIME"; break;
+                case rtmp::UserControlType::RESET_STREAM: log << "RESET_STREAM"; break;
+                case rtmp::UserControlType::PING: log << "PING"; break;
+                case rtmp::UserControlType::PONG: log << "PONG"; break;
+            }
 
-        switch (userControlType)
-        {
-            case rtmp::UserControlType::CLEAR_STREAM: log << "CLEAR_STREAM"; break;
-            case rtmp::UserControlType::CLEAR_BUFFER: log << "CLEAR_BUFFER"; break;
-            case rtmp::UserControlType::CLIENT_BUFFER_TIME: log << "CLIENT_BUFFER_TIME"; break;
-            case rtmp::UserControlType::RESET_STREAM: log << "RESET_STREAM"; break;
-            case rtmp::UserControlType::PING: log << "PING"; break;
-            case rtmp::UserControlType::PONG: log << "PONG"; break;
+            log << ", parameter 1: " << parameter1;
+            if (parameter2 != 0) log << ", parameter 2: " << parameter2;
         }
 
-        log << ", parameter 1: " << parameter1;
-        if (parameter2 != 0) log << ", parameter 2: " << parameter2;
-
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendSetChunkSize()
@@ -1846,12 +2456,9 @@ namespace relay
 
         encodeIntBE(packet.data, 4, outChunkSize);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending SET_CHUNK_SIZE";
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending SET_CHUNK_SIZE";
         
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendOnBWDone()
@@ -1882,14 +2489,11 @@ namespace relay
         amf::Node argument2 = 0.0;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        if (!sendPacket(packet)) return false;
 
-        if (!socket.send(buffer)) return false;
-
-        invokes[invokeId] = commandName.asString();
+        session->invokes[invokeId] = commandName.asString();
 
         return true;
     }
@@ -1919,14 +2523,11 @@ namespace relay
         amf::Node argument1(amf::Node::Type::Null);
         argument1.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
 
-        invokes[invokeId] = commandName.asString();
+        session->invokes[invokeId] = commandName.asString();
 
         return true;
     }
@@ -1956,12 +2557,9 @@ namespace relay
         amf::Node argument1(amf::Node::Type::Null);
         argument1.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
         
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendCreateStream()
@@ -1989,14 +2587,11 @@ namespace relay
         amf::Node argument1(amf::Node::Type::Null);
         argument1.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        if (!sendPacket(packet)) return false;
 
-        if (!socket.send(buffer)) return false;
-
-        invokes[invokeId] = commandName.asString();
+        session->invokes[invokeId] = commandName.asString();
 
         return true;
     }
@@ -2035,12 +2630,9 @@ namespace relay
         amf::Node argument2 = static_cast<double>(streamId);
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendReleaseStream()
@@ -2071,14 +2663,11 @@ namespace relay
         amf::Node argument2 = streamName;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        if (!sendPacket(packet)) return false;
 
-        if (!socket.send(buffer)) return false;
-
-        invokes[invokeId] = commandName.asString();
+        session->invokes[invokeId] = commandName.asString();
 
         return true;
     }
@@ -2108,12 +2697,9 @@ namespace relay
         amf::Node argument1(amf::Node::Type::Null);
         argument1.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
-
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendDeleteStream()
@@ -2144,14 +2730,11 @@ namespace relay
         amf::Node argument2 = static_cast<double>(streamId);
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
         
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
         
-        invokes[invokeId] = commandName.asString();
+        session->invokes[invokeId] = commandName.asString();
 
         return true;
     }
@@ -2160,6 +2743,8 @@ namespace relay
     {
         if (!endpoint) return false;
 
+        startSession();
+
         rtmp::Packet packet;
         packet.channel = rtmp::Channel::SYSTEM;
         packet.timestamp = 0;
@@ -2189,14 +2774,11 @@ namespace relay
 
         argument1.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
 
-        invokes[invokeId] = commandName.asString();
+        session->invokes[invokeId] = commandName.asString();
         timeSinceLastData = 0;
 
         return true;
@@ -2237,13 +2819,10 @@ namespace relay
 
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
         timeSinceLastData = 0;
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendFCPublish()
@@ -2274,14 +2853,11 @@ namespace relay
         amf::Node argument2 = streamName;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        if (!sendPacket(packet)) return false;
 
-        if (!socket.send(buffer)) return false;
-
-        invokes[invokeId] = commandName.asString();
+        session->invokes[invokeId] = commandName.asString();
 
         return true;
     }
@@ -2305,12 +2881,9 @@ namespace relay
         amf::Node commandName = std::string("onFCPublish");
         commandName.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendFCUnpublish()
@@ -2341,14 +2914,11 @@ namespace relay
         amf::Node argument2 = streamName;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
 
-        invokes[invokeId] = commandName.asString();
+        session->invokes[invokeId] = commandName.asString();
 
         close();
 
@@ -2374,12 +2944,9 @@ namespace relay
         amf::Node commandName = std::string("onFCUnpublish");
         commandName.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendFCSubscribe()
@@ -2410,14 +2977,11 @@ namespace relay
         amf::Node argument2 = streamName;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
 
-        invokes[invokeId] = commandName.asString();
+        session->invokes[invokeId] = commandName.asString();
 
         return true;
     }
@@ -2451,12 +3015,9 @@ namespace relay
         argument2["level"] = std::string("status");
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendFCUnsubscribe()
@@ -2487,14 +3048,11 @@ namespace relay
         amf::Node argument2 = streamName;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        if (!sendPacket(packet)) return false;
 
-        if (!socket.send(buffer)) return false;
-
-        invokes[invokeId] = commandName.asString();
+        session->invokes[invokeId] = commandName.asString();
 
         return true;
     }
@@ -2518,12 +3076,9 @@ namespace relay
         amf::Node commandName = std::string("onFCUnsubscribe");
         commandName.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendPublish()
@@ -2558,14 +3113,11 @@ namespace relay
         amf::Node argument3 = std::string("live");
         argument3.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
 
-        invokes[invokeId] = commandName.asString();
+        session->invokes[invokeId] = commandName.asString();
 
         Log(Log::Level::INFO) << idString << "Published stream \"" << streamName << "\" (ID: " << streamId << ") to " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort();
 
@@ -2606,12 +3158,9 @@ namespace relay
         argument2["level"] = std::string("status");
         argument2.encode((amfVersion == amf::Version::AMF3) ? amf::Version::AMF3 : amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
         
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendUnublishStatus(double transactionId)
@@ -2647,12 +3196,9 @@ namespace relay
         argument2["level"] = std::string("status");
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
         
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendAudioHeader(const std::vector<uint8_t>& headerData)
@@ -2674,26 +3220,90 @@ namespace relay
 
     bool Connection::sendAudioFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData)
     {
-        if (!streaming) return false;
+        if (!streaming || !endpoint)
+        {
+            count(&Counters::framesDropped);
+            return false;
+        }
 
         timeSinceLastData = 0;
-        return sendAudioData(timestamp, frameData);
+
+        if (!endpoint->audioStream) return true;
+
+        if (!checkThrottle())
+        {
+            count(&Counters::framesDropped);
+            return false;
+        }
+
+        if (!sendAudioData(timestamp, frameData))
+        {
+            count(&Counters::framesDropped);
+            return false;
+        }
+
+        count(&Counters::framesForwarded);
+        return true;
     }
 
-    bool Connection::sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData, VideoFrameType frameType)
+    bool Connection::sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData, VideoFrameType frameType,
+                                    std::chrono::steady_clock::time_point ingestTime)
     {
-        if (!streaming) return false;
+        if (!streaming || !endpoint)
+        {
+            count(&Counters::framesDropped);
+            return false;
+        }
 
-        if (!endpoint) return false;
+        if (!endpoint->videoStream) return true;
 
-        if (endpoint->videoStream &&
-            (videoFrameSent || frameType == VideoFrameType::KEY))
+        if (!checkThrottle())
         {
-            videoFrameSent = true;
-            timeSinceLastData = 0;
-            return sendVideoData(timestamp, frameData);
+            count(&Counters::framesDropped);
+            return false;
+        }
+
+        // frames before the first key frame can not be decoded by the receiver
+        if (!videoFrameSent && frameType != VideoFrameType::KEY)
+        {
+            count(&Counters::framesDropped);
+            return false;
+        }
+
+        videoFrameSent = true;
+        timeSinceLastData = 0;
+
+        if (!sendVideoData(timestamp, frameData))
+        {
+            count(&Counters::framesDropped);
+            return false;
         }
 
+        socket.markIngestTime(ingestTime);
+
+        count(&Counters::framesForwarded);
+        return true;
+    }
+
+    void Connection::throttle()
+    {
+        if (throttled) return;
+
+        Log(Log::Level::WARN) << idString << "Output queue of " << socket.getQueuedBytes() << " bytes is over the memory budget, dropping frames until it is written";
+
+        throttled = true;
+        count(&Counters::memoryThrottles);
+    }
+
+    bool Connection::checkThrottle()
+    {
+        if (!throttled) return true;
+        if (socket.getQueuedBytes() > 0) return false;
+
+        Log(Log::Level::INFO) << idString << "Output queue written, resuming from the next key frame";
+
+        throttled = false;
+        videoFrameSent = false;
         return true;
     }
 
@@ -2701,12 +3311,12 @@ namespace relay
     {
         if (state != State::HANDSHAKE_DONE) return false;
 
-        if (!endpoint) return false;
+        if (!endpoint || !session) return false;
 
         if (newMetaData.getType() == amf::Node::Type::Dictionary ||
             newMetaData.getType() == amf::Node::Type::Object)
         {
-            metaData = amf::Node::Type::Dictionary;
+            session->metaData = amf::Node::Type::Dictionary;
 
             for (const std::pair<std::string, amf::Node>& value : newMetaData.asMap())
             {
@@ -2726,7 +3336,7 @@ namespace relay
                                                value.first == "videocodecid" ||
                                                value.first == "videodatarate")) continue;
 
-                metaData[value.first] = value.second;
+                session->metaData[value.first] = value.second;
             }
 
             rtmp::Packet packet;
@@ -2750,12 +3360,10 @@ namespace relay
             amf::Node argument1 = std::string("onMetaData");
             argument1.encode(amf::Version::AMF0, packet.data);
 
-            amf::Node argument2 = metaData;
+            amf::Node argument2 = session->metaData;
             argument2.encode(amf::Version::AMF0, packet.data);
 
-            std::vector<uint8_t> buffer;
-            packet.encode(buffer, outChunkSize, sentPackets);
-
+            if (Log::isEnabled(Log::Level::ALL))
             {
                 Log log(Log::Level::ALL);
                 log << idString << "Sending meta data " << commandName.asString() << ": ";
@@ -2763,7 +3371,7 @@ namespace relay
             }
 
             timeSinceLastData = 0;
-            return socket.send(buffer);
+            return sendPacket(packet);
         }
 
         return true;
@@ -2796,9 +3404,7 @@ namespace relay
             amf::Node argument1 = textData;
             argument1.encode(amf::Version::AMF0, packet.data);
 
-            std::vector<uint8_t> buffer;
-            packet.encode(buffer, outChunkSize, sentPackets);
-
+            if (Log::isEnabled(Log::Level::ALL))
             {
                 Log log(Log::Level::ALL);
                 log << idString << "Sending text data: ";
@@ -2806,7 +3412,7 @@ namespace relay
             }
 
             timeSinceLastData = 0;
-            return socket.send(buffer);
+            return sendPacket(packet);
         }
 
         return true;
@@ -2840,12 +3446,9 @@ namespace relay
         amf::Node argument2 = streamName;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
         
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendGetStreamLengthResult(double transactionId)
@@ -2876,12 +3479,9 @@ namespace relay
         amf::Node argument2 = 0.0;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
         
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendPlay()
@@ -2913,13 +3513,10 @@ namespace relay
         amf::Node argument2 = streamName;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
         timeSinceLastData = 0;
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendPlayStatus(double transactionId)
@@ -2955,12 +3552,9 @@ namespace relay
         argument2["level"] = std::string("status");
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
-
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendStop()
@@ -2991,12 +3585,9 @@ namespace relay
         amf::Node argument2 = streamName;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendStopStatus(double transactionId)
@@ -3032,12 +3623,9 @@ namespace relay
         argument2["level"] = std::string("status");
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
         
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendAudioData(uint64_t timestamp, const std::vector<uint8_t>& audioData)
@@ -3052,14 +3640,14 @@ namespace relay
             packet.timestamp = timestamp;
             packet.messageType = rtmp::MessageType::AUDIO_PACKET;
 
-            packet.data = audioData;
-
-            std::vector<uint8_t> buffer;
-            packet.encode(buffer, outChunkSize, sentPackets);
+            packet.data = BufferPool::acquire(audioData.size());
+            packet.data.insert(packet.data.end(), audioData.begin(), audioData.end());
 
-            Log(Log::Level::ALL) << idString << "Sending audio packet";
+            RELAY_LOG(Log::Level::ALL) << idString << "Sending audio packet";
 
-            return socket.send(buffer);
+            bool result = sendPacket(packet);
+            BufferPool::release(std::move(packet.data));
+            return result;
         }
 
         return true;
@@ -3077,14 +3665,14 @@ namespace relay
             packet.timestamp = timestamp;
             packet.messageType = rtmp::MessageType::VIDEO_PACKET;
 
-            packet.data = videoData;
+            packet.data = BufferPool::acquire(videoData.size());
+            packet.data.insert(packet.data.end(), videoData.begin(), videoData.end());
 
-            std::vector<uint8_t> buffer;
-            packet.encode(buffer, outChunkSize, sentPackets);
+            RELAY_LOG(Log::Level::ALL) << idString << "Sending video packet";
 
-            Log(Log::Level::ALL) << idString << "Sending video packet";
-            
-            return socket.send(buffer);
+            bool result = sendPacket(packet);
+            BufferPool::release(std::move(packet.data));
+            return result;
         }
 
         return true;
@@ -5,12 +5,16 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <set>
 #include "Socket.hpp"
 #include "RTMP.hpp"
 #include "Amf.hpp"
+#include "Capture.hpp"
+#include "Histogram.hpp"
+#include "Metrics.hpp"
+#include "SlotVector.hpp"
 #include "Status.hpp"
-#include "Stream.hpp"
 #include "Utils.hpp"
 
 namespace relay
@@ -18,6 +22,7 @@ namespace relay
     class Relay;
     class Server;
     class Stream;
+    class JsonWriter;
     struct Endpoint;
 
     class Connection
@@ -59,6 +64,10 @@ namespace relay
 
         ~Connection();
 
+        // connections come from a pool, clients that reconnect reuse the memory of the ones that left
+        static void* operator new(size_t size);
+        static void operator delete(void* ptr, size_t size);
+
         void close(bool forceClose = false);
         void reset();
 
@@ -71,37 +80,139 @@ namespace relay
 
         bool isClosed() const;
         bool isConnected() { return connected; }
+        bool isStreaming() const { return streaming; }
 
         void update(float delta);
 
         void getStats(std::string& str, ReportType reportType) const;
+        void getStats(JsonWriter& writer) const;
 
         void connect();
+        // connects only to this address of the endpoint, used for the connections of warm standby endpoints
+        void pinAddress(uint32_t index) { addressIndex = index; addressPinned = true; }
+        // a published output that the stream does not send media to until the active output fails
+        void setStandby(bool newStandby) { standby = newStandby; }
+        bool isStandby() const { return standby; }
+        // a client connection that is waiting for its backoff before the next attempt
+        bool isReconnectPending() const;
 
         void setStream(Stream* aStream);
         Stream* getStream() { return stream; }
+        // host connections have an endpoint only while publishing or playing
+        const Endpoint* getEndpoint() const { return endpoint; }
         void unpublishStream();
 
         bool sendAudioHeader(const std::vector<uint8_t>& headerData);
         bool sendVideoHeader(const std::vector<uint8_t>& headerData);
         bool sendAudioFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData);
-        bool sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData, VideoFrameType frameType);
+        bool sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData, VideoFrameType frameType,
+                            std::chrono::steady_clock::time_point ingestTime);
         bool sendMetaData(const amf::Node& newMetaData);
         bool sendTextData(uint64_t timestamp, const amf::Node& textData);
 
         bool isDependable();
 
+        const Counters& getCounters() const { return counters; }
+        // appends the id, type and remote address of the connection to the labels of its stream
+        void appendMetricLabels(std::string& labels) const;
+        // time from receiving a video frame until its last byte was written to this connection, empty without a session
+        const LatencyHistogram& getEgressLatency() const;
+
+        size_t getQueuedBytes() const { return socket.getQueuedBytes(); }
+        // bytes held by the output queue of the socket and by the data that has not been decoded yet
+        size_t getOutputQueueMemory() const { return socket.getQueueCapacity(); }
+        size_t getInputMemory() const { return data.capacity(); }
+        bool hasSession() const { return session != nullptr; }
+        size_t getMemoryUsage() const { return getOutputQueueMemory() + getInputMemory(); }
+        // an output over a memory budget gets no frames until its queue has been written, then restarts at a key frame
+        void throttle();
+        bool isThrottled() const { return throttled; }
+
+        // processes data as if it was read from the socket, used to replay captures
+        void replay(const std::vector<uint8_t>& newData) { handleRead(socket, newData); }
+
+        // positions in the SlotVectors that hold the connection
+        size_t ownerSlot = NO_SLOT; // Relay::connections for host connections, Server::connections for client connections
+        size_t streamSlot = NO_SLOT; // Stream::connections
+        size_t outputSlot = NO_SLOT; // Stream::outputConnections
+        size_t standbySlot = NO_SLOT; // Stream::standbyConnections
+
     private:
         void resolveStreamName();
         void updateIdString();
 
+        // state of an RTMP session, which starts with the connect command and lasts as long as the connection.
+        // Connections that are handshaking or have not sent connect yet do not have one and keep no buffers, so a
+        // relay can hold many of them
+        struct Session
+        {
+            // sessions come from a pool like the connections
+            static void* operator new(size_t size);
+            static void operator delete(void* ptr, size_t size);
+
+            std::map<uint32_t, std::string, std::less<uint32_t>, PoolAllocator<std::pair<const uint32_t, std::string>>> invokes;
+            amf::Node metaData;
+            LatencyHistogram egressLatency;
+
+            float timeSincePing = 0.0f;
+            float timeSincePong = 0.0f;
+            float timeSinceMeasure = 0.0f;
+            uint64_t currentAudioBytes = 0;
+            uint64_t currentVideoBytes = 0;
+            uint64_t audioRate = 0;
+            uint64_t videoRate = 0;
+        };
+
+        void startSession();
+
         void handleConnect(Socket&);
         void handleConnectError(Socket&);
+        void resolve();
+        void handleResolve(const std::vector<std::pair<uint32_t, uint16_t>>& addresses);
+        void connectResolved();
+
+        // parallel connects to all addresses of the endpoint, see Endpoint::connectRaceDelay
+        struct RaceCandidate
+        {
+            RaceCandidate(Network& network): socket(network) {}
+
+            uint32_t addressIndex = 0; // in endpoint->addresses
+            std::pair<uint32_t, uint16_t> address;
+            Socket socket;
+            std::vector<uint8_t> data; // S0, S1 and S2, handed to handleRead by the winner
+            std::chrono::steady_clock::time_point startTime;
+            bool started = false;
+            bool failed = false;
+        };
+
+        float getReconnectDelay();
+        bool isAttemptInProgress() const;
+        void abortAttempt();
+
+        void startRace();
+        void stopRace();
+        void handleRaceResolve(uint32_t raceAddressIndex, const std::vector<std::pair<uint32_t, uint16_t>>& addresses);
+        void startRaceCandidate();
+        void handleRaceConnect(RaceCandidate& candidate);
+        void handleRaceRead(RaceCandidate& candidate, const std::vector<uint8_t>& newData);
+        void handleRaceFailure(RaceCandidate& candidate);
+        void finishRace();
         void handleRead(Socket&, const std::vector<uint8_t>& newData);
         void handleClose(Socket&);
 
         bool handlePacket(const rtmp::Packet& packet);
 
+        void count(uint64_t Counters::* counter, uint64_t value = 1);
+        bool isHandshaking() const { return state != State::UNINITIALIZED && state != State::HANDSHAKE_DONE; }
+
+        bool sendData(const std::vector<uint8_t>& buffer);
+        // space in the send buffer for messages built in place, nullptr if the socket is closed
+        uint8_t* prepareData(size_t size);
+        void writeChallenge(uint8_t* buffer);
+        // C0 and C1 signed with the Flash Player key
+        void writeClientChallenge(uint8_t* buffer);
+        bool sendPacket(const rtmp::Packet& packet);
+
         bool sendServerBandwidth();
         bool sendClientBandwidth();
         bool sendUserControl(rtmp::UserControlType userControlType, uint64_t timestamp = 0, uint32_t parameter1 = 0, uint32_t parameter2 = 0);
@@ -141,6 +252,9 @@ namespace relay
         bool sendStop();
         bool sendStopStatus(double transactionId);
 
+        // clears the throttle once the output queue has been written, returns false while it is throttled
+        bool checkThrottle();
+
         bool sendAudioData(uint64_t timestamp, const std::vector<uint8_t>& audioData);
         bool sendVideoData(uint64_t timestamp, const std::vector<uint8_t>& videoData);
 
@@ -154,12 +268,30 @@ namespace relay
         uint32_t bufferSize = 3000;
         Socket socket;
 
-        float timeSincePing = 0.0f;
-        float timeSincePong = 0.0f;
         float timeSinceConnect = 0.0f;
         float timeSinceLastData = 0.0f;
         uint32_t connectCount = 0;
         uint32_t addressIndex = 0;
+        bool addressPinned = false;
+        bool standby = false;
+
+        uint32_t reconnectAttempts = 0; // since the last established session
+        float timeSinceAttempt = 0.0f; // since the current attempt to connect was started, limited by Endpoint::connectionTimeout
+        float reconnectDelay = 0.0f;
+        bool reconnectScheduled = false;
+
+        // records of the current address, a failed connect moves on to the next one
+        uint64_t resolveRequestId = 0;
+        std::vector<std::pair<uint32_t, uint16_t>> resolvedAddresses;
+        size_t resolvedIndex = 0;
+        bool connectNextAddress = false;
+
+        std::vector<uint64_t> raceResolveRequestIds;
+        std::vector<std::unique_ptr<RaceCandidate>> raceCandidates;
+        RaceCandidate* raceWinner = nullptr;
+        std::vector<std::pair<uint32_t, uint16_t>> raceAddresses; // all candidates of the race the connection was won by
+        bool raceAdvance = false; // an attempt failed, the next one starts without waiting for the delay
+        float timeSinceRaceStart = 0.0f; // since the last attempt was started
 
         std::vector<uint8_t> data;
 
@@ -167,11 +299,10 @@ namespace relay
         uint32_t outChunkSize = 128;
         uint32_t serverBandwidth = 2500000;
 
-        std::map<uint32_t, rtmp::Header> receivedPackets;
-        std::map<uint32_t, rtmp::Header> sentPackets;
+        rtmp::HeaderMap receivedPackets;
+        rtmp::HeaderMap sentPackets;
 
         uint32_t invokeId = 0;
-        std::map<uint32_t, std::string> invokes;
 
         uint32_t streamId = 0;
 
@@ -183,15 +314,14 @@ namespace relay
         bool streaming = false;
 
         bool videoFrameSent = false;
-        float timeSinceMeasure = 0.0f;
-        uint64_t currentAudioBytes = 0;
-        uint64_t currentVideoBytes = 0;
-        uint64_t audioRate = 0;
-        uint64_t videoRate = 0;
+        bool throttled = false;
+        Counters counters;
+        CaptureWriter capture;
+        std::chrono::steady_clock::time_point receiveTime; // when the data being processed was read
 
         const Endpoint* endpoint = nullptr;
         Stream* stream = nullptr;
-        amf::Node metaData;
+        std::unique_ptr<Session> session;
 
         amf::Version amfVersion = amf::Version::AMF0;
 
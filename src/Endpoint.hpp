@@ -5,6 +5,8 @@
 #pragma once
 
 #include <cstdint>
+#include <set>
+#include <string>
 #include <vector>
 #include "Connection.hpp"
 #include "Stream.hpp"
@@ -22,11 +24,21 @@ namespace relay
         {
             std::string url;
             std::pair<uint32_t, uint16_t> ipAddresses;
+
+            bool operator==(const Address& other) const
+            {
+                return url == other.url && ipAddresses == other.ipAddresses;
+            }
         };
         std::vector<Address> addresses;
         float connectionTimeout = 5.0f;
-        float reconnectInterval = 5.0f;
+        float reconnectInterval = 5.0f; // the delay before the first reconnect
+        float reconnectMultiplier = 1.0f; // the delay grows by this factor with every failed attempt
+        float reconnectMaxInterval = 60.0f;
+        bool reconnectJitter = false; // waits a random time between 0 and the delay
         uint32_t reconnectCount = 0;
+        float connectRaceDelay = 0.0f; // 0 connects to one address at a time
+        bool warmStandby = false; // client outputs keep a published connection to the second address
         float pingInterval = 60.0f;
         uint32_t bufferSize = 3000;
         amf::Version amfVersion = amf::Version::AMF0;
@@ -38,6 +50,31 @@ namespace relay
         std::string streamName;
         std::set<std::string> metaDataBlacklist;
 
+        // configuration reloads keep the connections of endpoints that compare equal, so every configured field has to be compared
+        bool operator==(const Endpoint& other) const
+        {
+            return connectionType == other.connectionType &&
+                direction == other.direction &&
+                addresses == other.addresses &&
+                connectionTimeout == other.connectionTimeout &&
+                reconnectInterval == other.reconnectInterval &&
+                reconnectMultiplier == other.reconnectMultiplier &&
+                reconnectMaxInterval == other.reconnectMaxInterval &&
+                reconnectJitter == other.reconnectJitter &&
+                reconnectCount == other.reconnectCount &&
+                connectRaceDelay == other.connectRaceDelay &&
+                warmStandby == other.warmStandby &&
+                pingInterval == other.pingInterval &&
+                bufferSize == other.bufferSize &&
+                amfVersion == other.amfVersion &&
+                videoStream == other.videoStream &&
+                audioStream == other.audioStream &&
+                dataStream == other.dataStream &&
+                applicationName == other.applicationName &&
+                streamName == other.streamName &&
+                metaDataBlacklist == other.metaDataBlacklist;
+        }
+
         bool isNameKnown() const
         {
             return !applicationName.empty() && !streamName.empty() &&
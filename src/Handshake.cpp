@@ -0,0 +1,121 @@
+//
+//  rtmp_relay
+//
+
+#include <cstring>
+#include "Handshake.hpp"
+#include "Sha256.hpp"
+
+namespace relay
+{
+    namespace rtmp
+    {
+        static const uint8_t SERVER_KEY[] = {
+            'G', 'e', 'n', 'u', 'i', 'n', 'e', ' ', 'A', 'd', 'o', 'b', 'e', ' ',
+            'F', 'l', 'a', 's', 'h', ' ', 'M', 'e', 'd', 'i', 'a', ' ',
+            'S', 'e', 'r', 'v', 'e', 'r', ' ', '0', '0', '1', // first 36 bytes sign S1
+            0xF0, 0xEE, 0xC2, 0x4A, 0x80, 0x68, 0xBE, 0xE8, 0x2E, 0x00, 0xD0, 0xD1,
+            0x02, 0x9E, 0x7E, 0x57, 0x6E, 0xEC, 0x5D, 0x2D, 0x29, 0x80, 0x6F, 0xAB,
+            0x93, 0xB8, 0xE6, 0x36, 0xCF, 0xEB, 0x31, 0xAE
+        };
+
+        static const uint8_t CLIENT_KEY[] = {
+            'G', 'e', 'n', 'u', 'i', 'n', 'e', ' ', 'A', 'd', 'o', 'b', 'e', ' ',
+            'F', 'l', 'a', 's', 'h', ' ', 'P', 'l', 'a', 'y', 'e', 'r', ' ',
+            '0', '0', '1', // first 30 bytes sign C1
+            0xF0, 0xEE, 0xC2, 0x4A, 0x80, 0x68, 0xBE, 0xE8, 0x2E, 0x00, 0xD0, 0xD1,
+            0x02, 0x9E, 0x7E, 0x57, 0x6E, 0xEC, 0x5D, 0x2D, 0x29, 0x80, 0x6F, 0xAB,
+            0x93, 0xB8, 0xE6, 0x36, 0xCF, 0xEB, 0x31, 0xAE
+        };
+
+        static const uint32_t SERVER_CHALLENGE_KEY_SIZE = 36;
+        static const uint32_t CLIENT_CHALLENGE_KEY_SIZE = 30;
+
+        // the keys are constant, so their HMAC states are computed once
+        static const HmacSha256 serverChallengeHmac(SERVER_KEY, SERVER_CHALLENGE_KEY_SIZE);
+        static const HmacSha256 clientChallengeHmac(CLIENT_KEY, CLIENT_CHALLENGE_KEY_SIZE);
+        static const HmacSha256 serverAckHmac(SERVER_KEY, sizeof(SERVER_KEY));
+        static const HmacSha256 clientAckHmac(CLIENT_KEY, sizeof(CLIENT_KEY));
+
+        static const uint32_t DIGEST_POSITIONS = 728; // each scheme uses a 764-byte block: 4 bytes of position and the digest somewhere in the rest
+
+        static_assert(8 + 4 + DIGEST_POSITIONS - 1 + DIGEST_SIZE <= 772, "Digest of scheme 0 must come before the position of scheme 1");
+        static_assert(772 + 4 + DIGEST_POSITIONS - 1 + DIGEST_SIZE <= HANDSHAKE_SIZE, "Digest must fit in the handshake message");
+
+        static uint32_t getDigestOffset(const uint8_t* challenge, DigestScheme scheme)
+        {
+            uint32_t base = (scheme == DigestScheme::SCHEME0) ? 8 : 772;
+
+            return (static_cast<uint32_t>(challenge[base]) + challenge[base + 1] + challenge[base + 2] + challenge[base + 3]) %
+                DIGEST_POSITIONS + base + 4;
+        }
+
+        static const HmacSha256& getChallengeHmac(Peer peer)
+        {
+            return (peer == Peer::SERVER) ? serverChallengeHmac : clientChallengeHmac;
+        }
+
+        // HMAC of the message without the digest
+        static void calculateDigest(const uint8_t* challenge, uint32_t digestOffset, Peer peer, uint8_t* digest)
+        {
+            const HmacSha256& hmac = getChallengeHmac(peer);
+
+            Sha256 hash = hmac.begin();
+            hash.update(challenge, digestOffset);
+            hash.update(challenge + digestOffset + DIGEST_SIZE, HANDSHAKE_SIZE - digestOffset - DIGEST_SIZE);
+            hmac.finish(hash, digest);
+        }
+
+        DigestScheme findDigest(const uint8_t* challenge, Peer peer, uint32_t& digestOffset)
+        {
+            const HmacSha256& hmac = getChallengeHmac(peer);
+            uint32_t offset0 = getDigestOffset(challenge, DigestScheme::SCHEME0);
+            uint32_t offset1 = getDigestOffset(challenge, DigestScheme::SCHEME1);
+            uint8_t digest[DIGEST_SIZE];
+
+            // the digest of scheme 0 always comes before the one of scheme 1,
+            // so the bytes before it are hashed once for both schemes
+            Sha256 hash0 = hmac.begin();
+            hash0.update(challenge, offset0);
+
+            Sha256 hash1 = hash0;
+            hash1.update(challenge + offset0, offset1 - offset0);
+            hash1.update(challenge + offset1 + DIGEST_SIZE, HANDSHAKE_SIZE - offset1 - DIGEST_SIZE);
+            hmac.finish(hash1, digest);
+
+            if (memcmp(digest, challenge + offset1, DIGEST_SIZE) == 0)
+            {
+                digestOffset = offset1;
+                return DigestScheme::SCHEME1;
+            }
+
+            hash0.update(challenge + offset0 + DIGEST_SIZE, HANDSHAKE_SIZE - offset0 - DIGEST_SIZE);
+            hmac.finish(hash0, digest);
+
+            if (memcmp(digest, challenge + offset0, DIGEST_SIZE) == 0)
+            {
+                digestOffset = offset0;
+                return DigestScheme::SCHEME0;
+            }
+
+            return DigestScheme::NONE;
+        }
+
+        uint32_t writeDigest(uint8_t* challenge, Peer peer, DigestScheme scheme)
+        {
+            uint32_t offset = getDigestOffset(challenge, scheme);
+            calculateDigest(challenge, offset, peer, challenge + offset);
+
+            return offset;
+        }
+
+        void writeAckDigest(uint8_t* ack, Peer peer, const uint8_t* peerDigest)
+        {
+            uint8_t key[DIGEST_SIZE];
+            ((peer == Peer::SERVER) ? serverAckHmac : clientAckHmac).compute(peerDigest, DIGEST_SIZE, key);
+
+            HmacSha256 hmac(key, sizeof(key));
+            hmac.compute(ack, HANDSHAKE_SIZE - DIGEST_SIZE, ack + HANDSHAKE_SIZE - DIGEST_SIZE);
+        }
+    }
+}
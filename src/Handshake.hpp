@@ -0,0 +1,40 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstdint>
+
+namespace relay
+{
+    namespace rtmp
+    {
+        // digest (complex) handshake: C1 and S1 carry an HMAC-SHA256 of their own bytes at a position
+        // that depends on the scheme, C2 and S2 end with an HMAC-SHA256 keyed by the digest of the peer's challenge
+        static const uint32_t HANDSHAKE_SIZE = 1536;
+        static const uint32_t DIGEST_SIZE = 32;
+
+        enum class Peer
+        {
+            CLIENT, // signs with the Flash Player key
+            SERVER // signs with the Flash Media Server key
+        };
+
+        enum class DigestScheme
+        {
+            NONE,
+            SCHEME0, // digest before the key, its position is stored in bytes 8-11
+            SCHEME1 // key before the digest, its position is stored in bytes 772-775
+        };
+
+        // looks for a digest signed by peer in a C1 or S1 message, returns NONE if neither scheme matches
+        DigestScheme findDigest(const uint8_t* challenge, Peer peer, uint32_t& digestOffset);
+
+        // signs a C1 or S1 message which already has its time, version and random bytes, returns the digest offset
+        uint32_t writeDigest(uint8_t* challenge, Peer peer, DigestScheme scheme);
+
+        // signs a C2 or S2 message which already has its random bytes with the digest of the peer's challenge
+        void writeAckDigest(uint8_t* ack, Peer peer, const uint8_t* peerDigest);
+    }
+}
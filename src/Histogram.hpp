@@ -0,0 +1,144 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Json.hpp"
+
+namespace relay
+{
+    // log-linear (HDR style) histogram of latencies in microseconds:
+    // 32 buckets per power of two keep the relative error under 3.2% up to a minute
+    class LatencyHistogram
+    {
+    public:
+        static uint64_t getMicroseconds(std::chrono::steady_clock::time_point start,
+                                        std::chrono::steady_clock::time_point end)
+        {
+            if (end <= start) return 0;
+
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+        }
+
+        void record(uint64_t value)
+        {
+            if (value > MAX_VALUE) value = MAX_VALUE;
+
+            // buckets are allocated on the first sample, so idle connections do not pay for them
+            if (buckets.empty()) buckets.resize(BUCKET_COUNT);
+
+            ++buckets[getBucketIndex(value)];
+            ++count;
+            sum += value;
+            if (value > max) max = value;
+        }
+
+        void merge(const LatencyHistogram& other)
+        {
+            if (other.count == 0) return;
+
+            if (buckets.empty()) buckets.resize(BUCKET_COUNT);
+
+            for (uint32_t i = 0; i < BUCKET_COUNT; ++i)
+            {
+                buckets[i] += other.buckets[i];
+            }
+
+            count += other.count;
+            sum += other.sum;
+            if (other.max > max) max = other.max;
+        }
+
+        uint64_t getCount() const { return count; }
+        uint64_t getSum() const { return sum; }
+        uint64_t getMax() const { return max; }
+
+        // highest value equivalent to the sample at the percentile (0.0 - 1.0)
+        uint64_t getPercentile(double percentile) const
+        {
+            if (count == 0) return 0;
+
+            uint64_t target = static_cast<uint64_t>(percentile * count + 0.5);
+            if (target < 1) target = 1;
+            if (target > count) target = count;
+
+            uint64_t total = 0;
+
+            for (uint32_t i = 0; i < BUCKET_COUNT; ++i)
+            {
+                total += buckets[i];
+
+                if (total >= target)
+                {
+                    uint64_t value = getBucketHighestValue(i);
+                    return (value < max) ? value : max;
+                }
+            }
+
+            return max;
+        }
+
+        // percentiles for text reports, e.g. "p50 120us p99 900us p999 1500us"
+        std::string getSummary() const
+        {
+            return "p50 " + std::to_string(getPercentile(0.5)) +
+                "us p99 " + std::to_string(getPercentile(0.99)) +
+                "us p999 " + std::to_string(getPercentile(0.999)) + "us";
+        }
+
+        // writes count, percentiles and maximum in microseconds as an object
+        void getStats(JsonWriter& writer) const
+        {
+            writer.beginObject();
+            writer.key("count").value(count);
+            writer.key("p50").value(getPercentile(0.5));
+            writer.key("p99").value(getPercentile(0.99));
+            writer.key("p999").value(getPercentile(0.999));
+            writer.key("max").value(max);
+            writer.endObject();
+        }
+
+    private:
+        static const uint32_t SUB_BUCKET_BITS = 5;
+        static const uint32_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+        static const uint32_t SUB_BUCKET_HALF_COUNT = SUB_BUCKET_COUNT / 2;
+        static const uint32_t MAX_VALUE_BITS = 26; // about 67 seconds
+        static const uint64_t MAX_VALUE = (1ULL << MAX_VALUE_BITS) - 1;
+        static const uint32_t BUCKET_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKET_HALF_COUNT + SUB_BUCKET_HALF_COUNT;
+
+        static uint32_t getBucketIndex(uint64_t value)
+        {
+            if (value < SUB_BUCKET_COUNT) return static_cast<uint32_t>(value);
+
+            uint32_t highestBit = 0;
+#if defined(__GNUC__) || defined(__clang__)
+            highestBit = 63 - static_cast<uint32_t>(__builtin_clzll(value));
+#else
+            while (value >> (highestBit + 1)) ++highestBit;
+#endif
+            uint32_t shift = highestBit - SUB_BUCKET_BITS + 1;
+
+            return shift * SUB_BUCKET_HALF_COUNT + static_cast<uint32_t>(value >> shift);
+        }
+
+        static uint64_t getBucketHighestValue(uint32_t index)
+        {
+            if (index < SUB_BUCKET_COUNT) return index;
+
+            uint32_t shift = index / SUB_BUCKET_HALF_COUNT - 1;
+            uint64_t subBucket = index - shift * SUB_BUCKET_HALF_COUNT;
+
+            return ((subBucket + 1) << shift) - 1;
+        }
+
+        std::vector<uint32_t> buckets;
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+    };
+}
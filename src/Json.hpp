@@ -0,0 +1,186 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <type_traits>
+#include "Utils.hpp"
+
+namespace relay
+{
+    // appends JSON to a caller owned buffer, so the buffer can be reused between reports
+    class JsonWriter
+    {
+    public:
+        explicit JsonWriter(std::string& aBuffer):
+            buffer(aBuffer)
+        {
+        }
+
+        JsonWriter(const JsonWriter&) = delete;
+        JsonWriter& operator=(const JsonWriter&) = delete;
+
+        JsonWriter& beginObject()
+        {
+            separate();
+            buffer.push_back('{');
+            needComma = false;
+            return *this;
+        }
+
+        JsonWriter& endObject()
+        {
+            buffer.push_back('}');
+            needComma = true;
+            return *this;
+        }
+
+        JsonWriter& beginArray()
+        {
+            separate();
+            buffer.push_back('[');
+            needComma = false;
+            return *this;
+        }
+
+        JsonWriter& endArray()
+        {
+            buffer.push_back(']');
+            needComma = true;
+            return *this;
+        }
+
+        JsonWriter& key(const char* name)
+        {
+            separate();
+            buffer.push_back('"');
+            buffer += name; // keys are literals and need no escaping
+            buffer += "\":";
+            needComma = false;
+            return *this;
+        }
+
+        JsonWriter& key(const std::string& name)
+        {
+            separate();
+            buffer.push_back('"');
+            appendEscapedString(buffer, name);
+            buffer += "\":";
+            needComma = false;
+            return *this;
+        }
+
+        JsonWriter& value(const char* str)
+        {
+            separate();
+            buffer.push_back('"');
+            buffer += str;
+            buffer.push_back('"');
+            needComma = true;
+            return *this;
+        }
+
+        JsonWriter& value(const std::string& str)
+        {
+            separate();
+            buffer.push_back('"');
+            appendEscapedString(buffer, str);
+            buffer.push_back('"');
+            needComma = true;
+            return *this;
+        }
+
+        JsonWriter& value(bool b)
+        {
+            separate();
+            buffer += b ? "true" : "false";
+            needComma = true;
+            return *this;
+        }
+
+        template <class T, typename std::enable_if<std::is_integral<T>::value>::type* = nullptr>
+        JsonWriter& value(T i)
+        {
+            separate();
+            appendInteger(i, std::is_signed<T>());
+            needComma = true;
+            return *this;
+        }
+
+        JsonWriter& value(double d)
+        {
+            separate();
+
+            if (std::isfinite(d))
+            {
+                char str[32];
+                int length = snprintf(str, sizeof(str), "%.17g", d);
+                buffer.append(str, static_cast<size_t>(length));
+            }
+            else
+            {
+                buffer += "null";
+            }
+
+            needComma = true;
+            return *this;
+        }
+
+        JsonWriter& nullValue()
+        {
+            separate();
+            buffer += "null";
+            needComma = true;
+            return *this;
+        }
+
+    private:
+        void separate()
+        {
+            if (needComma) buffer.push_back(',');
+        }
+
+        template <class T>
+        void appendInteger(T i, std::true_type)
+        {
+            if (i < 0)
+            {
+                buffer.push_back('-');
+                appendUnsigned(0 - static_cast<uint64_t>(i));
+            }
+            else
+            {
+                appendUnsigned(static_cast<uint64_t>(i));
+            }
+        }
+
+        template <class T>
+        void appendInteger(T i, std::false_type)
+        {
+            appendUnsigned(static_cast<uint64_t>(i));
+        }
+
+        void appendUnsigned(uint64_t i)
+        {
+            char str[20];
+            char* end = str + sizeof(str);
+            char* p = end;
+
+            do
+            {
+                *--p = static_cast<char>('0' + i % 10);
+                i /= 10;
+            }
+            while (i);
+
+            buffer.append(p, static_cast<size_t>(end - p));
+        }
+
+        std::string& buffer;
+        bool needComma = false;
+    };
+}
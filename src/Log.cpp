@@ -2,9 +2,15 @@
 //  rtmp_relay
 //
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
 #ifdef _WIN32
 #  include <windows.h>
 #  include <strsafe.h>
@@ -12,6 +18,7 @@
 #  include <sys/syslog.h>
 #endif
 #include "Log.hpp"
+#include "Utils.hpp"
 
 namespace relay
 {
@@ -27,42 +34,286 @@ namespace relay
     bool Log::syslogEnabled = false;
 #endif
 
-    void Log::flush()
+    static void formatTime(time_t t, char* buffer, size_t size)
     {
-        if (!s.empty())
-        {
-            auto n = std::chrono::system_clock::now();
-            auto t = std::chrono::system_clock::to_time_t(n);
-            tm* time = localtime(&t);
-            char buffer[32];
-            strftime(buffer, sizeof(buffer), "%Y.%m.%d %H:%M:%S", time);
-
-            if (level == Level::ERR ||
-                level == Level::WARN)
-                std::cerr << buffer << ": " << s << std::endl;
-            else
-                std::cout << buffer << ": " << s << std::endl;
+        tm* time = localtime(&t);
+        strftime(buffer, size, "%Y.%m.%d %H:%M:%S", time);
+    }
 
+    static void writeSystemLog(Log::Level level, const std::string& s)
+    {
 #ifdef _WIN32
-            wchar_t szBuffer[MAX_PATH];
-            MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, szBuffer, MAX_PATH);
-            StringCchCatW(szBuffer, sizeof(szBuffer), L"\n");
-            OutputDebugStringW(szBuffer);
+        (void)level;
+        wchar_t szBuffer[MAX_PATH];
+        MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, szBuffer, MAX_PATH);
+        StringCchCatW(szBuffer, sizeof(szBuffer), L"\n");
+        OutputDebugStringW(szBuffer);
 #elif defined(LOG_SYSLOG)
-            if (syslogEnabled)
+        if (Log::syslogEnabled)
+        {
+            int priority = 0;
+            switch (level)
+            {
+                case Log::Level::ERR: priority = LOG_ERR; break;
+                case Log::Level::WARN: priority = LOG_WARNING; break;
+                case Log::Level::INFO: priority = LOG_INFO; break;
+                case Log::Level::ALL: priority = LOG_DEBUG; break;
+                default: break;
+            }
+            syslog(priority, "%s", s.c_str());
+        }
+#else
+        (void)level;
+        (void)s;
+#endif
+    }
+
+    // bounded multi-producer single-consumer queue, producers never block and drop messages when it is full
+    class LogWriter
+    {
+    public:
+        static const size_t QUEUE_SIZE = 4096; // must be a power of two
+        static const size_t HIGH_WATER_MARK = QUEUE_SIZE / 2;
+
+        LogWriter()
+        {
+            for (size_t i = 0; i < QUEUE_SIZE; ++i)
             {
-                int priority = 0;
-                switch (level)
+                entries[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        ~LogWriter()
+        {
+            stop();
+        }
+
+        void start()
+        {
+            std::lock_guard<std::mutex> lock(threadMutex);
+
+            if (running) return;
+
+            stopping = false;
+
+            {
+                SignalBlocker signalBlocker;
+                thread = std::thread(&LogWriter::run, this);
+            }
+
+            running = true;
+        }
+
+        void stop()
+        {
+            std::lock_guard<std::mutex> lock(threadMutex);
+
+            if (!running) return;
+
+            running = false;
+            stopping = true;
+            condition.notify_one();
+            thread.join();
+        }
+
+        bool isRunning() const { return running; }
+        uint64_t getDroppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+        bool push(Log::Level level, std::string& message)
+        {
+            size_t position = enqueuePosition.load(std::memory_order_relaxed);
+            Entry* entry;
+
+            for (;;)
+            {
+                entry = &entries[position & (QUEUE_SIZE - 1)];
+                size_t sequence = entry->sequence.load(std::memory_order_acquire);
+                intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+                if (difference == 0)
                 {
-                    case Level::ERR: priority = LOG_ERR; break;
-                    case Level::WARN: priority = LOG_WARNING; break;
-                    case Level::INFO: priority = LOG_INFO; break;
-                    case Level::ALL: priority = LOG_DEBUG; break;
-                    default: break;
+                    if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (difference < 0) // full
+                {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                else
+                {
+                    position = enqueuePosition.load(std::memory_order_relaxed);
                 }
-                syslog(priority, "%s", s.c_str());
             }
-#endif
+
+            entry->level = level;
+            entry->time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+            entry->message.swap(message);
+            entry->sequence.store(position + 1, std::memory_order_release);
+
+            // the writer drains everything it finds, so it only has to be woken up for the first message
+            // and when it falls behind, otherwise it picks the messages up within its wait timeout
+            size_t queued = position + 1 - drainedPosition.load(std::memory_order_relaxed);
+            if (queued == 1 || queued == HIGH_WATER_MARK) condition.notify_one();
+
+            return true;
+        }
+
+    private:
+        struct Entry
+        {
+            std::atomic<size_t> sequence;
+            Log::Level level = Log::Level::INFO;
+            time_t time = 0;
+            std::string message;
+        };
+
+        void run()
+        {
+            while (!stopping)
+            {
+                if (!drain())
+                {
+                    std::unique_lock<std::mutex> lock(conditionMutex);
+                    condition.wait_for(lock, std::chrono::milliseconds(10));
+                }
+            }
+
+            drain();
+        }
+
+        bool drain()
+        {
+            bool result = false;
+
+            for (;;)
+            {
+                Entry& entry = entries[dequeuePosition & (QUEUE_SIZE - 1)];
+                size_t sequence = entry.sequence.load(std::memory_order_acquire);
+
+                if (sequence != dequeuePosition + 1) break;
+
+                if (entry.time != lastTime)
+                {
+                    lastTime = entry.time;
+                    formatTime(lastTime, timeBuffer, sizeof(timeBuffer));
+                }
+
+                std::string& batch = (entry.level == Log::Level::ERR ||
+                                      entry.level == Log::Level::WARN) ? errBatch : outBatch;
+
+                batch += timeBuffer;
+                batch += ": ";
+                batch += entry.message;
+                batch += '\n';
+
+                writeSystemLog(entry.level, entry.message);
+
+                entry.message.clear();
+                entry.sequence.store(dequeuePosition + QUEUE_SIZE, std::memory_order_release);
+                ++dequeuePosition;
+                result = true;
+            }
+
+            drainedPosition.store(dequeuePosition, std::memory_order_relaxed);
+
+            uint64_t currentDropped = dropped.load(std::memory_order_relaxed);
+
+            if (currentDropped != reportedDropped)
+            {
+                errBatch += timeBuffer;
+                errBatch += ": ";
+                errBatch += std::to_string(currentDropped - reportedDropped) + " log messages dropped\n";
+                reportedDropped = currentDropped;
+            }
+
+            if (!outBatch.empty())
+            {
+                fwrite(outBatch.data(), 1, outBatch.size(), stdout);
+                fflush(stdout);
+                outBatch.clear();
+            }
+
+            if (!errBatch.empty())
+            {
+                fwrite(errBatch.data(), 1, errBatch.size(), stderr);
+                fflush(stderr);
+                errBatch.clear();
+            }
+
+            return result;
+        }
+
+        Entry entries[QUEUE_SIZE];
+        std::atomic<size_t> enqueuePosition{0};
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<size_t> drainedPosition{0}; // dequeuePosition as of the last drain, read by producers
+
+        // accessed only by the writer thread
+        size_t dequeuePosition = 0;
+        uint64_t reportedDropped = 0;
+        time_t lastTime = 0;
+        char timeBuffer[32] = "";
+        std::string outBatch;
+        std::string errBatch;
+
+        std::mutex threadMutex;
+        std::thread thread;
+        std::atomic<bool> running{false};
+        std::atomic<bool> stopping{false};
+
+        std::mutex conditionMutex;
+        std::condition_variable condition;
+    };
+
+    // never destroyed, because the destructors of global objects still log after the function-local statics are gone
+    static LogWriter& getWriter()
+    {
+        static LogWriter* writer = new LogWriter();
+        return *writer;
+    }
+
+    void Log::startWriter()
+    {
+        getWriter().start();
+    }
+
+    void Log::stopWriter()
+    {
+        getWriter().stop();
+    }
+
+    uint64_t Log::getDroppedCount()
+    {
+        return getWriter().getDroppedCount();
+    }
+
+    void Log::flush()
+    {
+        if (!s.empty())
+        {
+            LogWriter& writer = getWriter();
+
+            if (writer.isRunning())
+            {
+                writer.push(level, s);
+            }
+            else
+            {
+                char buffer[32];
+                formatTime(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()), buffer, sizeof(buffer));
+
+                if (level == Level::ERR ||
+                    level == Level::WARN)
+                    std::cerr << buffer << ": " << s << std::endl;
+                else
+                    std::cout << buffer << ": " << s << std::endl;
+
+                writeSystemLog(level, s);
+            }
+
             s.clear();
         }
     }
@@ -4,8 +4,23 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 
+// the most verbose level compiled into the binary, messages above it are stripped by the compiler
+#ifndef LOG_LEVEL_MAX
+#  ifdef DEBUG
+#    define LOG_LEVEL_MAX 4 // Log::Level::ALL
+#  else
+#    define LOG_LEVEL_MAX 3 // Log::Level::INFO
+#  endif
+#endif
+
+// evaluates the streamed arguments only if the level is enabled
+#define RELAY_LOG(level) \
+    if (!relay::Log::isEnabled(level)) {} \
+    else relay::Log(level)
+
 namespace relay
 {
     class Log
@@ -23,6 +38,16 @@ namespace relay
         static Level threshold;
         static bool syslogEnabled;
 
+        static bool isEnabled(Level aLevel)
+        {
+            return static_cast<int>(aLevel) <= LOG_LEVEL_MAX && aLevel <= threshold;
+        }
+
+        // moves writing to stdout, stderr and syslog to a background thread
+        static void startWriter();
+        static void stopWriter();
+        static uint64_t getDroppedCount();
+
         Log()
         {
         }
@@ -68,7 +93,7 @@ namespace relay
 
         template<typename T> Log& operator<<(T val)
         {
-            if (level <= threshold)
+            if (isEnabled(level))
             {
                 s += std::to_string(val);
             }
@@ -78,7 +103,7 @@ namespace relay
 
         Log& operator<<(const std::string& val)
         {
-            if (level <= threshold)
+            if (isEnabled(level))
             {
                 s += val;
             }
@@ -88,7 +113,7 @@ namespace relay
 
         Log& operator<<(const char* val)
         {
-            if (level <= threshold)
+            if (isEnabled(level))
             {
                 s += val;
             }
@@ -98,7 +123,7 @@ namespace relay
 
         Log& operator<<(char* val)
         {
-            if (level <= threshold)
+            if (isEnabled(level))
             {
                 s += val;
             }
@@ -0,0 +1,138 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace relay
+{
+    // monotonic counters, kept per connection and per stream and summed up for the whole relay
+    struct Counters
+    {
+        uint64_t bytesReceived = 0;
+        uint64_t bytesSent = 0;
+        uint64_t chunksReceived = 0;
+        uint64_t chunksSent = 0;
+        uint64_t framesReceived = 0;
+        uint64_t framesForwarded = 0;
+        uint64_t framesDropped = 0;
+        uint64_t reconnects = 0;
+        uint64_t handshakeFailures = 0;
+        uint64_t memoryThrottles = 0;
+        uint64_t memoryEvictions = 0;
+    };
+
+    // bytes held by the relay, by what holds them
+    struct MemoryUsage
+    {
+        uint64_t connections = 0; // connection and stream objects
+        uint64_t outputQueues = 0; // data waiting to be written to sockets
+        uint64_t inputBuffers = 0; // data read but not decoded into messages yet
+        uint64_t streamHeaders = 0; // audio and video sequence headers kept for new outputs
+        uint64_t bufferPool = 0; // released buffers cached for reuse
+
+        uint64_t getTotal() const
+        {
+            return getBudgeted() + bufferPool;
+        }
+
+        // the buffer pool is left out, it is bounded by its own limits and freed by trimming, not by disconnecting
+        uint64_t getBudgeted() const
+        {
+            return connections + outputQueues + inputBuffers + streamHeaders;
+        }
+    };
+
+    // appends metrics in the Prometheus text exposition format
+    class MetricsWriter
+    {
+    public:
+        explicit MetricsWriter(std::string& aBuffer):
+            buffer(aBuffer)
+        {
+        }
+
+        MetricsWriter(const MetricsWriter&) = delete;
+        MetricsWriter& operator=(const MetricsWriter&) = delete;
+
+        // all samples of a metric must follow its family line
+        MetricsWriter& family(const char* name, const char* type, const char* help)
+        {
+            buffer += "# HELP ";
+            buffer += name;
+            buffer.push_back(' ');
+            buffer += help;
+            buffer += "\n# TYPE ";
+            buffer += name;
+            buffer.push_back(' ');
+            buffer += type;
+            buffer.push_back('\n');
+            return *this;
+        }
+
+        MetricsWriter& sample(const char* name, uint64_t value)
+        {
+            buffer += name;
+            buffer.push_back(' ');
+            buffer += std::to_string(value);
+            buffer.push_back('\n');
+            return *this;
+        }
+
+        // labels must be formatted with appendLabel
+        MetricsWriter& sample(const char* name, const std::string& labels, uint64_t value)
+        {
+            buffer += name;
+            buffer.push_back('{');
+            buffer += labels;
+            buffer += "} ";
+            buffer += std::to_string(value);
+            buffer.push_back('\n');
+            return *this;
+        }
+
+        // writes a duration given in microseconds in seconds, the Prometheus base unit
+        MetricsWriter& sampleSeconds(const char* name, const std::string& labels, uint64_t microseconds)
+        {
+            char value[32];
+            snprintf(value, sizeof(value), "%llu.%06llu",
+                     static_cast<unsigned long long>(microseconds / 1000000),
+                     static_cast<unsigned long long>(microseconds % 1000000));
+
+            buffer += name;
+            buffer.push_back('{');
+            buffer += labels;
+            buffer += "} ";
+            buffer += value;
+            buffer.push_back('\n');
+            return *this;
+        }
+
+        static void appendLabel(std::string& labels, const char* name, const std::string& value)
+        {
+            if (!labels.empty()) labels.push_back(',');
+            labels += name;
+            labels += "=\"";
+
+            for (char c : value)
+            {
+                switch (c)
+                {
+                    case '\\': labels += "\\\\"; break;
+                    case '"': labels += "\\\""; break;
+                    case '\n': labels += "\\n"; break;
+                    default: labels.push_back(c); break;
+                }
+            }
+
+            labels.push_back('"');
+        }
+
+    private:
+        std::string& buffer;
+    };
+}
@@ -18,16 +18,32 @@
 #include "Network.hpp"
 #include "Socket.hpp"
 #include "Log.hpp"
+#include "Profiler.hpp"
 
 namespace relay
 {
-    Network::Network()
+    Network::Network():
+        readBuffer(65536)
     {
         previousTime = std::chrono::steady_clock::now();
     }
 
     bool Network::update()
     {
+        RELAY_PROFILE_SCOPE(NETWORK_UPDATE);
+
+        {
+            std::lock_guard<std::mutex> lock(completionMutex);
+            currentCompletions.swap(completions);
+        }
+
+        for (const std::function<void()>& completion : currentCompletions)
+        {
+            completion();
+        }
+
+        currentCompletions.clear();
+
         for (Socket* socket : socketDeleteSet)
         {
             auto i = std::find(sockets.begin(), sockets.end(), socket);
@@ -75,17 +91,26 @@ namespace relay
 
         if (!pollFds.empty())
         {
+            int result;
+
+            {
+                RELAY_PROFILE_SCOPE(NETWORK_POLL);
 #ifdef _WIN32
-            if (WSAPoll(pollFds.data(), static_cast<ULONG>(pollFds.size()), 0) < 0)
+                result = WSAPoll(pollFds.data(), static_cast<ULONG>(pollFds.size()), 0);
 #else
-            if (poll(pollFds.data(), static_cast<nfds_t>(pollFds.size()), 0) < 0)
+                result = poll(pollFds.data(), static_cast<nfds_t>(pollFds.size()), 0);
 #endif
+            }
+
+            if (result < 0)
             {
                 int error = getLastError();
                 Log(Log::Level::ERR) << "Poll failed, error: " << error;
                 return false;
             }
 
+            RELAY_PROFILE_SCOPE(NETWORK_DISPATCH);
+
             for (pollfd& pollFd : pollFds)
             {
                 for (Socket* deleteSocket : socketDeleteSet)
@@ -126,6 +151,12 @@ namespace relay
         return true;
     }
 
+    void Network::post(const std::function<void()>& completion)
+    {
+        std::lock_guard<std::mutex> lock(completionMutex);
+        completions.push_back(completion);
+    }
+
     void Network::addSocket(Socket& socket)
     {
         socketAddSet.insert(&socket);
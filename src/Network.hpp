@@ -8,9 +8,11 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <set>
 #include <chrono>
+#include <functional>
 #include "Socket.hpp"
 
 namespace relay
@@ -29,6 +31,12 @@ namespace relay
 
         bool update();
 
+        // bytes waiting in the output buffers of all sockets
+        uint64_t getQueuedBytes() const { return queuedBytes; }
+
+        // can be called from any thread, the completion is called from the next update on the network's thread
+        void post(const std::function<void()>& completion);
+
     protected:
         void addSocket(Socket& socket);
         void removeSocket(Socket& socket);
@@ -37,6 +45,15 @@ namespace relay
         std::set<Socket*> socketAddSet;
         std::set<Socket*> socketDeleteSet;
 
+        uint64_t queuedBytes = 0;
+
+        // shared by the sockets of this network, a network is only updated from one thread
+        std::vector<uint8_t> readBuffer;
+
         std::chrono::steady_clock::time_point previousTime;
+
+        std::mutex completionMutex;
+        std::vector<std::function<void()>> completions;
+        std::vector<std::function<void()>> currentCompletions;
     };
 }
@@ -0,0 +1,193 @@
+//
+//  rtmp_relay
+//
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include "ObjectPool.hpp"
+#include "Json.hpp"
+#include "Metrics.hpp"
+#include "Status.hpp"
+
+namespace relay
+{
+    static std::vector<ObjectPool*>& getPools()
+    {
+        static std::vector<ObjectPool*>* pools = new std::vector<ObjectPool*>();
+        return *pools;
+    }
+
+    ObjectPool::ObjectPool(const std::string& aName, size_t aObjectSize):
+        name(aName),
+        objectSize(aObjectSize)
+    {
+        // every block is aligned like memory from malloc and can hold the free list link
+        const size_t alignment = alignof(std::max_align_t);
+        blockSize = (std::max(objectSize, sizeof(FreeBlock)) + alignment - 1) / alignment * alignment;
+    }
+
+    void* ObjectPool::allocate()
+    {
+        ++used;
+        ++allocations;
+
+#ifdef RELAY_POOL_PASSTHROUGH
+        if (used > capacity) capacity = used;
+        return ::operator new(objectSize);
+#else
+        if (!freeList) addSlab();
+
+        FreeBlock* block = freeList;
+        freeList = block->next;
+
+        return block;
+#endif
+    }
+
+    void ObjectPool::deallocate(void* object)
+    {
+        if (!object) return;
+
+        --used;
+
+#ifdef RELAY_POOL_PASSTHROUGH
+        ::operator delete(object);
+#else
+        FreeBlock* block = static_cast<FreeBlock*>(object);
+        block->next = freeList;
+        freeList = block;
+#endif
+    }
+
+    void ObjectPool::addSlab()
+    {
+        uint8_t* slab = static_cast<uint8_t*>(::operator new(blockSize * SLAB_SIZE));
+        slabs.push_back(slab);
+        capacity += SLAB_SIZE;
+
+        // linked in address order, so a new slab is handed out from its start
+        for (size_t i = SLAB_SIZE; i > 0; --i)
+        {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + (i - 1) * blockSize);
+            block->next = freeList;
+            freeList = block;
+        }
+    }
+
+    ObjectPool& ObjectPool::create(const std::string& name, size_t objectSize)
+    {
+        ObjectPool* pool = new ObjectPool(name, objectSize);
+        getPools().push_back(pool);
+
+        return *pool;
+    }
+
+    ObjectPool& ObjectPool::getNodePool(size_t objectSize)
+    {
+        std::string name = "node" + std::to_string(objectSize);
+
+        for (ObjectPool* pool : getPools())
+        {
+            if (pool->getName() == name) return *pool;
+        }
+
+        return create(name, objectSize);
+    }
+
+    void ObjectPool::getStats(std::string& str, ReportType reportType)
+    {
+        switch (reportType)
+        {
+            case ReportType::TEXT:
+            {
+                std::stringstream ss;
+                ss << "\nObject pools:\n"
+                << std::setw(20) << "Pool" << " "
+                << std::setw(12) << "Object size" << " "
+                << std::setw(12) << "Used" << " "
+                << std::setw(12) << "Capacity" << " "
+                << std::setw(14) << "Allocations" << "\n";
+
+                for (const ObjectPool* pool : getPools())
+                {
+                    ss << std::setw(20) << pool->name << " "
+                    << std::setw(12) << pool->objectSize << " "
+                    << std::setw(12) << pool->used << " "
+                    << std::setw(12) << pool->capacity << " "
+                    << std::setw(14) << pool->allocations << "\n";
+                }
+
+                str += ss.str();
+                break;
+            }
+            case ReportType::HTML:
+            {
+                std::stringstream ss;
+                ss << "<b>Object pools</b>"
+                << "<table border=\"1\" cellspacing=\"0\" cellpadding=\"5\"><tr><th>Pool</th><th>Object size</th><th>Used</th><th>Capacity</th><th>Allocations</th></tr>";
+
+                for (const ObjectPool* pool : getPools())
+                {
+                    ss << "<tr><td>" << pool->name << "</td><td>" << pool->objectSize
+                    << "</td><td>" << pool->used << "</td><td>" << pool->capacity
+                    << "</td><td>" << pool->allocations << "</td></tr>";
+                }
+
+                ss << "</table>";
+
+                str += ss.str();
+                break;
+            }
+            case ReportType::JSON:
+            {
+                JsonWriter writer(str);
+                getStats(writer);
+                break;
+            }
+        }
+    }
+
+    void ObjectPool::getStats(JsonWriter& writer)
+    {
+        writer.beginArray();
+        for (const ObjectPool* pool : getPools())
+        {
+            writer.beginObject();
+            writer.key("name").value(pool->name);
+            writer.key("object_size").value(static_cast<uint64_t>(pool->objectSize));
+            writer.key("used").value(static_cast<uint64_t>(pool->used));
+            writer.key("capacity").value(static_cast<uint64_t>(pool->capacity));
+            writer.key("allocations").value(pool->allocations);
+            writer.endObject();
+        }
+        writer.endArray();
+    }
+
+    void ObjectPool::getMetrics(MetricsWriter& writer)
+    {
+        writer.family("rtmp_relay_pool_objects", "gauge", "Objects allocated from a pool.");
+        for (const ObjectPool* pool : getPools())
+        {
+            std::string labels;
+            MetricsWriter::appendLabel(labels, "pool", pool->name);
+            writer.sample("rtmp_relay_pool_objects", labels, pool->used);
+        }
+
+        writer.family("rtmp_relay_pool_capacity_objects", "gauge", "Objects a pool can hold without growing.");
+        for (const ObjectPool* pool : getPools())
+        {
+            std::string labels;
+            MetricsWriter::appendLabel(labels, "pool", pool->name);
+            writer.sample("rtmp_relay_pool_capacity_objects", labels, pool->capacity);
+        }
+
+        writer.family("rtmp_relay_pool_allocations_total", "counter", "Objects allocated from a pool since startup.");
+        for (const ObjectPool* pool : getPools())
+        {
+            std::string labels;
+            MetricsWriter::appendLabel(labels, "pool", pool->name);
+            writer.sample("rtmp_relay_pool_allocations_total", labels, pool->allocations);
+        }
+    }
+}
@@ -0,0 +1,111 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(__SANITIZE_ADDRESS__)
+#  define RELAY_POOL_PASSTHROUGH
+#elif defined(__has_feature)
+#  if __has_feature(address_sanitizer)
+#    define RELAY_POOL_PASSTHROUGH
+#  endif
+#endif
+
+namespace relay
+{
+    class JsonWriter;
+    class MetricsWriter;
+    enum class ReportType;
+
+    // free list of fixed size blocks carved from slabs, so connection churn reuses the same memory instead of going
+    // through malloc. Slabs are kept for the lifetime of the process, the pool grows to the peak number of objects.
+    // Not thread safe, pools are used from the relay thread only. With the address sanitizer every block comes
+    // from the global allocator, so use after free is still detected
+    class ObjectPool
+    {
+    public:
+        static const size_t SLAB_SIZE = 64; // objects per slab
+
+        ObjectPool(const std::string& aName, size_t aObjectSize);
+
+        ObjectPool(const ObjectPool&) = delete;
+        ObjectPool& operator=(const ObjectPool&) = delete;
+
+        void* allocate();
+        void deallocate(void* object);
+
+        const std::string& getName() const { return name; }
+        size_t getObjectSize() const { return objectSize; }
+        size_t getUsed() const { return used; }
+        size_t getCapacity() const { return capacity; }
+        uint64_t getAllocations() const { return allocations; }
+
+        // pools are never deleted, objects in them may outlive static destruction (e.g. the relay in main.cpp)
+        static ObjectPool& create(const std::string& name, size_t objectSize);
+        // shared by all node based containers whose nodes are of this size
+        static ObjectPool& getNodePool(size_t objectSize);
+
+        static void getStats(std::string& str, ReportType reportType);
+        static void getStats(JsonWriter& writer);
+        static void getMetrics(MetricsWriter& writer);
+
+    private:
+        struct FreeBlock
+        {
+            FreeBlock* next;
+        };
+
+        void addSlab();
+
+        std::string name;
+        size_t objectSize;
+        size_t blockSize;
+        FreeBlock* freeList = nullptr;
+        std::vector<void*> slabs;
+
+        size_t used = 0;
+        size_t capacity = 0;
+        uint64_t allocations = 0;
+    };
+
+    // allocator for std::map and other node based containers, single nodes come from the node pool of their size
+    template<class T>
+    class PoolAllocator
+    {
+    public:
+        typedef T value_type;
+
+        PoolAllocator() {}
+        template<class U> PoolAllocator(const PoolAllocator<U>&) {}
+
+        T* allocate(size_t n)
+        {
+            if (n == 1) return static_cast<T*>(getPool().allocate());
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+
+        void deallocate(T* p, size_t n)
+        {
+            if (n == 1) getPool().deallocate(p);
+            else ::operator delete(p);
+        }
+
+    private:
+        static ObjectPool& getPool()
+        {
+            static ObjectPool& pool = ObjectPool::getNodePool(sizeof(T));
+            return pool;
+        }
+    };
+
+    template<class T, class U>
+    bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) { return true; }
+    template<class T, class U>
+    bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) { return false; }
+}
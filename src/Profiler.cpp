@@ -0,0 +1,152 @@
+//
+//  rtmp_relay
+//
+
+#include <iomanip>
+#include <sstream>
+#include "Profiler.hpp"
+#include "Json.hpp"
+#include "Metrics.hpp"
+#include "Status.hpp"
+
+namespace relay
+{
+    static const char* sectionNames[] = {
+        "network_update",
+        "network_poll",
+        "network_dispatch",
+        "socket_read",
+        "socket_write",
+        "chunk_decode",
+        "handle_packet",
+        "amf_decode",
+        "stream_fan_out"
+    };
+
+    static_assert(sizeof(sectionNames) / sizeof(sectionNames[0]) == static_cast<size_t>(Profiler::Section::COUNT),
+                  "Every profiler section needs a name");
+
+    // ticks are converted to time using the clock readings at startup
+    static const uint64_t startTicks = Profiler::getTicks();
+    static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    thread_local bool Profiler::threadEnabled = false;
+    Profiler::Timer Profiler::timers[static_cast<size_t>(Section::COUNT)];
+
+    double Profiler::getNanosecondsPerTick()
+    {
+        uint64_t ticks = getTicks() - startTicks;
+        auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+
+        return ticks ? static_cast<double>(nanoseconds) / static_cast<double>(ticks) : 1.0;
+    }
+
+    void Profiler::getStats(std::string& str, ReportType reportType)
+    {
+        double nanosecondsPerTick = getNanosecondsPerTick();
+        double updateTicks = static_cast<double>(timers[static_cast<size_t>(Section::NETWORK_UPDATE)].ticks);
+
+        switch (reportType)
+        {
+            case ReportType::TEXT:
+            {
+                std::stringstream ss;
+                ss << "\nProfile (inclusive time on the relay thread):\n"
+                << std::setw(20) << "Section" << " "
+                << std::setw(12) << "Calls" << " "
+                << std::setw(12) << "Total ms" << " "
+                << std::setw(10) << "Avg ns" << " "
+                << std::setw(12) << "Max ns" << " "
+                << std::setw(10) << "% update" << "\n";
+
+                ss << std::fixed;
+
+                for (size_t i = 0; i < static_cast<size_t>(Section::COUNT); ++i)
+                {
+                    const Timer& timer = timers[i];
+
+                    ss << std::setw(20) << sectionNames[i] << " "
+                    << std::setw(12) << timer.calls << " "
+                    << std::setw(12) << std::setprecision(1) << timer.ticks * nanosecondsPerTick / 1000000.0 << " "
+                    << std::setw(10) << std::setprecision(0) << (timer.calls ? timer.ticks * nanosecondsPerTick / timer.calls : 0.0) << " "
+                    << std::setw(12) << timer.maxTicks * nanosecondsPerTick << " "
+                    << std::setw(10) << std::setprecision(1) << (updateTicks > 0.0 ? timer.ticks * 100.0 / updateTicks : 0.0) << "\n";
+                }
+
+                str += ss.str();
+                break;
+            }
+            case ReportType::HTML:
+            {
+                std::stringstream ss;
+                ss << "<b>Profile</b> (inclusive time on the relay thread)"
+                << "<table border=\"1\" cellspacing=\"0\" cellpadding=\"5\"><tr><th>Section</th><th>Calls</th><th>Total ms</th><th>Avg ns</th><th>Max ns</th><th>% update</th></tr>";
+
+                ss << std::fixed;
+
+                for (size_t i = 0; i < static_cast<size_t>(Section::COUNT); ++i)
+                {
+                    const Timer& timer = timers[i];
+
+                    ss << "<tr><td>" << sectionNames[i] << "</td><td>" << timer.calls
+                    << "</td><td>" << std::setprecision(1) << timer.ticks * nanosecondsPerTick / 1000000.0
+                    << "</td><td>" << std::setprecision(0) << (timer.calls ? timer.ticks * nanosecondsPerTick / timer.calls : 0.0)
+                    << "</td><td>" << timer.maxTicks * nanosecondsPerTick
+                    << "</td><td>" << std::setprecision(1) << (updateTicks > 0.0 ? timer.ticks * 100.0 / updateTicks : 0.0)
+                    << "</td></tr>";
+                }
+
+                ss << "</table>";
+
+                str += ss.str();
+                break;
+            }
+            case ReportType::JSON:
+            {
+                JsonWriter writer(str);
+                getStats(writer);
+                break;
+            }
+        }
+    }
+
+    void Profiler::getStats(JsonWriter& writer)
+    {
+        double nanosecondsPerTick = getNanosecondsPerTick();
+
+        writer.beginObject();
+        for (size_t i = 0; i < static_cast<size_t>(Section::COUNT); ++i)
+        {
+            const Timer& timer = timers[i];
+
+            writer.key(sectionNames[i]).beginObject();
+            writer.key("calls").value(timer.calls);
+            writer.key("totalNs").value(static_cast<uint64_t>(timer.ticks * nanosecondsPerTick));
+            writer.key("maxNs").value(static_cast<uint64_t>(timer.maxTicks * nanosecondsPerTick));
+            writer.endObject();
+        }
+        writer.endObject();
+    }
+
+    void Profiler::getMetrics(MetricsWriter& writer)
+    {
+        double nanosecondsPerTick = getNanosecondsPerTick();
+
+        writer.family("rtmp_relay_profile_calls_total", "counter", "Calls of profiled sections on the relay thread.");
+        for (size_t i = 0; i < static_cast<size_t>(Section::COUNT); ++i)
+        {
+            std::string labels;
+            MetricsWriter::appendLabel(labels, "section", sectionNames[i]);
+            writer.sample("rtmp_relay_profile_calls_total", labels, timers[i].calls);
+        }
+
+        writer.family("rtmp_relay_profile_seconds_total", "counter", "Inclusive time spent in profiled sections on the relay thread.");
+        for (size_t i = 0; i < static_cast<size_t>(Section::COUNT); ++i)
+        {
+            std::string labels;
+            MetricsWriter::appendLabel(labels, "section", sectionNames[i]);
+            writer.sampleSeconds("rtmp_relay_profile_seconds_total", labels,
+                                 static_cast<uint64_t>(timers[i].ticks * nanosecondsPerTick / 1000.0));
+        }
+    }
+}
@@ -0,0 +1,122 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#  include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>
+#endif
+
+// scoped timers around the hot paths, compiled in only with -DRELAY_PROFILE ("make profile")
+#ifdef RELAY_PROFILE
+#  define RELAY_PROFILE_CONCAT_(a, b) a##b
+#  define RELAY_PROFILE_CONCAT(a, b) RELAY_PROFILE_CONCAT_(a, b)
+#  define RELAY_PROFILE_SCOPE(section) \
+    relay::ProfileScope RELAY_PROFILE_CONCAT(profileScope, __LINE__)(relay::Profiler::Section::section)
+#else
+#  define RELAY_PROFILE_SCOPE(section)
+#endif
+
+namespace relay
+{
+    class JsonWriter;
+    class MetricsWriter;
+    enum class ReportType;
+
+    class Profiler
+    {
+    public:
+        enum class Section
+        {
+            NETWORK_UPDATE,
+            NETWORK_POLL,
+            NETWORK_DISPATCH,
+            SOCKET_READ,
+            SOCKET_WRITE,
+            CHUNK_DECODE,
+            HANDLE_PACKET,
+            AMF_DECODE,
+            STREAM_FAN_OUT,
+            COUNT
+        };
+
+        // only the thread that calls this is measured, so the status page thread does not mix in its own network
+        static void enableThread() { threadEnabled = true; }
+
+        // cycle counter where available, otherwise the monotonic clock in nanoseconds
+        static uint64_t getTicks()
+        {
+#if (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))) || defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+#else
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+        }
+
+        static bool isThreadEnabled() { return threadEnabled; }
+
+        // only the outermost of nested scopes of a section is measured, so recursive calls are counted once
+        static void enter(Section section, uint64_t& start)
+        {
+            if (timers[static_cast<size_t>(section)].depth++ == 0) start = getTicks();
+        }
+
+        static void leave(Section section, uint64_t start)
+        {
+            Timer& timer = timers[static_cast<size_t>(section)];
+            if (--timer.depth) return;
+
+            uint64_t ticks = getTicks() - start;
+            ++timer.calls;
+            timer.ticks += ticks;
+            if (ticks > timer.maxTicks) timer.maxTicks = ticks;
+        }
+
+        static void getStats(std::string& str, ReportType reportType);
+        static void getStats(JsonWriter& writer);
+        static void getMetrics(MetricsWriter& writer);
+
+    private:
+        struct Timer
+        {
+            uint64_t calls = 0;
+            uint64_t ticks = 0;
+            uint64_t maxTicks = 0;
+            uint32_t depth = 0;
+        };
+
+        static double getNanosecondsPerTick();
+
+        static thread_local bool threadEnabled;
+        static Timer timers[static_cast<size_t>(Section::COUNT)];
+    };
+
+    class ProfileScope
+    {
+    public:
+        explicit ProfileScope(Profiler::Section aSection):
+            section(aSection), active(Profiler::isThreadEnabled())
+        {
+            if (active) Profiler::enter(section, start);
+        }
+
+        ~ProfileScope()
+        {
+            if (active) Profiler::leave(section, start);
+        }
+
+        ProfileScope(const ProfileScope&) = delete;
+        ProfileScope& operator=(const ProfileScope&) = delete;
+
+    private:
+        Profiler::Section section;
+        bool active;
+        uint64_t start = 0;
+    };
+}
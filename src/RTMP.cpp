@@ -13,7 +13,7 @@ namespace relay
 {
     namespace rtmp
     {
-        static std::string messageTypeToString(MessageType messageType)
+        static const char* messageTypeToString(MessageType messageType)
         {
             switch (messageType)
             {
@@ -35,11 +35,51 @@ namespace relay
             };
         }
 
-        static uint32_t decodeHeader(const std::vector<uint8_t>& data, uint32_t offset, Header& header, std::map<uint32_t, rtmp::Header>& previousPackets)
+        static void logHeader(const Header& header)
+        {
+            Log log(Log::Level::ALL);
+            log << "Header type: ";
+
+            switch (header.type)
+            {
+                case Header::Type::TWELVE_BYTE: log << "TWELVE_BYTE"; break;
+                case Header::Type::EIGHT_BYTE: log << "EIGHT_BYTE"; break;
+                case Header::Type::FOUR_BYTE: log << "FOUR_BYTE"; break;
+                case Header::Type::ONE_BYTE: log << "ONE_BYTE"; break;
+                default: log << "invalid header type"; break;
+            };
+
+            log << "(" << static_cast<uint32_t>(header.type) << "), channel: " << static_cast<uint32_t>(header.channel);
+
+            if (header.type != Header::Type::ONE_BYTE)
+            {
+                log << ", ts: " << header.ts;
+
+                if (header.ts == 0xffffff)
+                {
+                    log << " (extended)";
+                }
+
+                if (header.type != Header::Type::FOUR_BYTE)
+                {
+                    log << ", data length: " << header.length;
+                    log << ", message type: " << messageTypeToString(header.messageType) << "(" << static_cast<uint32_t>(header.messageType) << ")";
+
+                    if (header.type != Header::Type::EIGHT_BYTE)
+                    {
+                        log << ", message stream ID: " << header.messageStreamId;
+                    }
+                }
+            }
+
+            log << ", final timestamp: " << header.timestamp;
+        }
+
+        uint32_t decodeHeader(const std::vector<uint8_t>& data, uint32_t offset, Header& header, const HeaderMap& previousPackets)
         {
             uint32_t originalOffset = offset;
 
-            if (data.size() - offset < 1)
+            if (offset >= data.size())
             {
                 return 0;
             }
@@ -65,24 +105,14 @@ namespace relay
                 header.channel = 64 + newChannel;
             }
 
-            Log log(Log::Level::ALL);
-            log << "Header type: ";
+            static const Header EMPTY_HEADER;
+            auto previousPacketIterator = previousPackets.find(header.channel);
+            const Header& previousPacket = (previousPacketIterator == previousPackets.end()) ? EMPTY_HEADER : previousPacketIterator->second;
 
-            switch (header.type)
-            {
-                case Header::Type::TWELVE_BYTE: log << "TWELVE_BYTE"; break;
-                case Header::Type::EIGHT_BYTE: log << "EIGHT_BYTE"; break;
-                case Header::Type::FOUR_BYTE: log << "FOUR_BYTE"; break;
-                case Header::Type::ONE_BYTE: log << "ONE_BYTE"; break;
-                default: log << "invalid header type"; break;
-            };
-
-            log << "(" << static_cast<uint32_t>(header.type) << "), channel: " << static_cast<uint32_t>(header.channel);
-
-            header.length  = previousPackets[header.channel].length;
-            header.messageType  = previousPackets[header.channel].messageType;
-            header.messageStreamId = previousPackets[header.channel].messageStreamId;
-            header.ts = previousPackets[header.channel].ts;
+            header.length  = previousPacket.length;
+            header.messageType  = previousPacket.messageType;
+            header.messageStreamId = previousPacket.messageStreamId;
+            header.ts = previousPacket.ts;
 
             if (header.type != Header::Type::ONE_BYTE)
             {
@@ -95,13 +125,6 @@ namespace relay
 
                 offset += ret;
 
-                log << ", ts: " << header.ts;
-
-                if (header.ts == 0xffffff)
-                {
-                    log << " (extended)";
-                }
-
                 if (header.type != Header::Type::FOUR_BYTE)
                 {
                     ret = decodeIntBE(data, offset, 3, header.length);
@@ -113,8 +136,6 @@ namespace relay
 
                     offset += ret;
 
-                    log << ", data length: " << header.length;
-
                     if (data.size() - offset < 1)
                     {
                         return 0;
@@ -123,8 +144,6 @@ namespace relay
                     header.messageType = static_cast<MessageType>(*(data.data() + offset));
                     offset += 1;
 
-                    log << ", message type: " << messageTypeToString(header.messageType) << "(" << static_cast<uint32_t>(header.messageType) << ")";
-
                     if (header.type != Header::Type::EIGHT_BYTE)
                     {
                         if (data.size() - offset < 4)
@@ -140,8 +159,6 @@ namespace relay
                         }
 
                         offset += ret;
-
-                        log << ", message stream ID: " << header.messageStreamId;
                     }
                 }
             }
@@ -157,8 +174,6 @@ namespace relay
                 }
 
                 offset += ret;
-
-                log << ", extended timestamp: " << header.timestamp;
             }
             else
             {
@@ -168,15 +183,18 @@ namespace relay
             // relative timestamp
             if (header.type != rtmp::Header::Type::TWELVE_BYTE)
             {
-                header.timestamp += previousPackets[header.channel].timestamp;
+                header.timestamp += previousPacket.timestamp;
             }
 
-            log << ", final timestamp: " << header.timestamp;
+            if (Log::isEnabled(Log::Level::ALL))
+            {
+                logHeader(header);
+            }
 
             return offset - originalOffset;
         }
 
-        uint32_t Packet::decode(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets)
+        uint32_t Packet::decode(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t chunkSize, HeaderMap& previousPackets)
         {
             uint32_t originalOffset = offset;
 
@@ -184,30 +202,89 @@ namespace relay
 
             data.clear();
 
-            auto currentPreviousPackets = previousPackets;
+            if (chunkSize == 0)
+            {
+                return 0;
+            }
+
+            // previous headers are updated in place and restored if the packet is incomplete,
+            // copying the map on every call would cost as much as the number of chunk streams
+            std::vector<std::pair<uint32_t, Header>> originalHeaders;
+            std::vector<uint32_t> newChannels;
+
+            auto updatePreviousPacket = [&previousPackets, &originalHeaders, &newChannels](uint32_t channel) -> Header& {
+                auto i = previousPackets.find(channel);
+
+                if (i == previousPackets.end())
+                {
+                    newChannels.push_back(channel);
+                    return previousPackets[channel];
+                }
+
+                if (std::find(newChannels.begin(), newChannels.end(), channel) == newChannels.end() &&
+                    std::find_if(originalHeaders.begin(), originalHeaders.end(), [channel](const std::pair<uint32_t, Header>& originalHeader) {
+                        return originalHeader.first == channel;
+                    }) == originalHeaders.end())
+                {
+                    originalHeaders.push_back(*i);
+                }
+
+                return i->second;
+            };
+
+            auto restorePreviousPackets = [&previousPackets, &originalHeaders, &newChannels]() {
+                for (uint32_t channel : newChannels)
+                {
+                    previousPackets.erase(channel);
+                }
+
+                for (const auto& originalHeader : originalHeaders)
+                {
+                    previousPackets[originalHeader.first] = originalHeader.second;
+                }
+            };
 
             bool firstPacket = true;
 
             do
             {
                 Header header;
-                uint32_t ret = decodeHeader(buffer, offset, header, currentPreviousPackets);
+                uint32_t ret = decodeHeader(buffer, offset, header, previousPackets);
 
                 if (!ret)
                 {
+                    restorePreviousPackets();
                     return 0;
                 }
 
                 offset += ret;
 
+                // first header of packer
+                if (firstPacket)
+                {
+                    // the payload and at least one byte of header per following chunk must have been received,
+                    // otherwise incomplete packets would be decoded again on every read
+                    uint64_t chunkCount = (static_cast<uint64_t>(header.length) + chunkSize - 1) / chunkSize;
+                    uint64_t minimumSize = header.length + (chunkCount ? chunkCount - 1 : 0);
+
+                    if (buffer.size() - offset < minimumSize)
+                    {
+                        RELAY_LOG(Log::Level::ALL) << "Not enough data to read";
+
+                        return 0;
+                    }
+
+                    // the memory is only reserved once the whole payload has been received
+                    data.reserve(header.length);
+                }
+
                 if (header.type == Header::Type::FOUR_BYTE ||
                     header.type == Header::Type::EIGHT_BYTE ||
                     header.type == Header::Type::TWELVE_BYTE)
                 {
-                    currentPreviousPackets[header.channel] = header;
+                    updatePreviousPacket(header.channel) = header;
                 }
 
-                // first header of packer
                 if (firstPacket)
                 {
                     channel = header.channel;
@@ -217,18 +294,20 @@ namespace relay
 
                     remainingBytes = header.length;
 
-                    currentPreviousPackets[header.channel].ts = header.ts;
-                    currentPreviousPackets[header.channel].timestamp = header.timestamp;
+                    Header& previousPacket = updatePreviousPacket(header.channel);
+                    previousPacket.ts = header.ts;
+                    previousPacket.timestamp = header.timestamp;
 
                     firstPacket = false;
                 }
 
                 uint32_t packetSize = std::min(remainingBytes, chunkSize);
 
-                if (packetSize + offset > buffer.size())
+                if (packetSize > buffer.size() - offset)
                 {
-                    Log(Log::Level::ALL) << "Not enough data to read";
+                    RELAY_LOG(Log::Level::ALL) << "Not enough data to read";
 
+                    restorePreviousPackets();
                     return 0;
                 }
 
@@ -239,13 +318,10 @@ namespace relay
             }
             while (remainingBytes);
 
-            // store previous packet if successfully read packet
-            previousPackets = currentPreviousPackets;
-
             return offset - originalOffset;
         }
 
-        static uint32_t encodeHeader(std::vector<uint8_t>& data, Header& header, std::map<uint32_t, rtmp::Header>& previousPackets)
+        static uint32_t encodeHeader(std::vector<uint8_t>& data, Header& header, HeaderMap& previousPackets)
         {
             uint32_t originalSize = static_cast<uint32_t>(data.size());
 
@@ -314,20 +390,6 @@ namespace relay
                 encodeIntBE(data, 2, header.channel - 64);
             }
 
-            Log log(Log::Level::ALL);
-            log << "Header type: ";
-
-            switch (header.type)
-            {
-                case Header::Type::TWELVE_BYTE: log << "TWELVE_BYTE"; break;
-                case Header::Type::EIGHT_BYTE: log << "EIGHT_BYTE"; break;
-                case Header::Type::FOUR_BYTE: log << "FOUR_BYTE"; break;
-                case Header::Type::ONE_BYTE: log << "ONE_BYTE"; break;
-                default: log << "invalid header type"; break;
-            };
-
-            log << "(" << static_cast<uint32_t>(header.type) << "), channel: " << static_cast<uint32_t>(header.channel);
-
             if (header.type != Header::Type::ONE_BYTE)
             {
                 uint32_t ret = encodeIntBE(data, 3, header.ts);
@@ -337,13 +399,6 @@ namespace relay
                     return 0;
                 }
 
-                log << ", ts: " << header.ts;
-
-                if (header.ts == 0xffffff)
-                {
-                    log << " (extended)";
-                }
-
                 if (header.type != Header::Type::FOUR_BYTE)
                 {
                     ret = encodeIntBE(data, 3, header.length);
@@ -355,9 +410,6 @@ namespace relay
 
                     data.insert(data.end(), static_cast<uint8_t>(header.messageType));
 
-                    log << ", data length: " << header.length;
-                    log << ", message type: " << messageTypeToString(header.messageType) << "(" << static_cast<uint32_t>(header.messageType) << ")";
-
                     if (header.type != Header::Type::EIGHT_BYTE)
                     {
                         ret = encodeIntLE(data, 4, header.messageStreamId);
@@ -366,8 +418,6 @@ namespace relay
                         {
                             return 0;
                         }
-
-                        log << ", message stream ID: " << header.messageStreamId;
                     }
                 }
             }
@@ -380,16 +430,17 @@ namespace relay
                 {
                     return 0;
                 }
-
-                log << ", extended timestamp: " << header.timestamp;
             }
 
-            log << ", final timestamp: " << header.timestamp;
+            if (Log::isEnabled(Log::Level::ALL))
+            {
+                logHeader(header);
+            }
 
             return static_cast<uint32_t>(data.size()) - originalSize;
         }
 
-        uint32_t Packet::encode(std::vector<uint8_t>& buffer, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets) const
+        uint32_t Packet::encode(std::vector<uint8_t>& buffer, uint32_t chunkSize, HeaderMap& previousPackets) const
         {
             uint32_t originalSize = static_cast<uint32_t>(buffer.size());
 
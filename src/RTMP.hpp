@@ -7,6 +7,7 @@
 #include <cstdint>
 #include <vector>
 #include <map>
+#include "ObjectPool.hpp"
 
 namespace relay
 {
@@ -76,6 +77,12 @@ namespace relay
             uint64_t timestamp = 0; // final timestamp (either from 3-byte timestamp or extended timestamp fields)
         };
 
+        // last header of each chunk stream, the nodes come from a pool because every connection keeps two of these
+        typedef std::map<uint32_t, Header, std::less<uint32_t>, PoolAllocator<std::pair<const uint32_t, Header>>> HeaderMap;
+
+        // decodes a chunk header, fields that are not present are taken from the previous header of the chunk stream
+        uint32_t decodeHeader(const std::vector<uint8_t>& data, uint32_t offset, Header& header, const HeaderMap& previousPackets);
+
         struct Packet
         {
             uint32_t channel = Channel::NONE;
@@ -85,8 +92,8 @@ namespace relay
 
             std::vector<uint8_t> data;
 
-            uint32_t decode(const std::vector<uint8_t>& data, uint32_t offset, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets);
-            uint32_t encode(std::vector<uint8_t>& data, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets) const;
+            uint32_t decode(const std::vector<uint8_t>& data, uint32_t offset, uint32_t chunkSize, HeaderMap& previousPackets);
+            uint32_t encode(std::vector<uint8_t>& data, uint32_t chunkSize, HeaderMap& previousPackets) const;
         };
 
         struct Challenge
@@ -2,10 +2,13 @@
 //  rtmp_relay
 //
 
+#include <cstring>
 #include <ctime>
 #include <memory>
 #include <algorithm>
 #include <functional>
+#include <list>
+#include <set>
 #include <iostream>
 #include <chrono>
 #include <regex>
@@ -14,18 +17,23 @@
 #include <iostream>
 #include <iomanip>
 #include "yaml-cpp/yaml.h"
+#include "BufferPool.hpp"
 #include "Log.hpp"
 #include "Relay.hpp"
 #include "Status.hpp"
 #include "Connection.hpp"
+#include "Json.hpp"
+#include "ObjectPool.hpp"
+#include "Profiler.hpp"
 
 namespace relay
 {
     uint64_t Relay::currentId = 0;
 
     Relay::Relay(Network& aNetwork):
-        generator(static_cast<unsigned int>(std::chrono::high_resolution_clock::now().time_since_epoch().count())),
-        network(aNetwork)
+        generator(static_cast<uint64_t>(std::chrono::high_resolution_clock::now().time_since_epoch().count())),
+        network(aNetwork),
+        resolver(aNetwork)
     {
         previousTime = std::chrono::steady_clock::now();
     }
@@ -43,11 +51,31 @@ namespace relay
         }
     }
 
+    // number of endpoints of a running server that are also in its new configuration
+    static size_t countEqualEndpoints(const std::list<Endpoint>& endpoints, const std::vector<Endpoint>& newEndpoints)
+    {
+        std::vector<bool> matched(newEndpoints.size(), false);
+        size_t count = 0;
+
+        for (const Endpoint& endpoint : endpoints)
+        {
+            for (size_t i = 0; i < newEndpoints.size(); ++i)
+            {
+                if (!matched[i] && newEndpoints[i] == endpoint)
+                {
+                    matched[i] = true;
+                    ++count;
+                    break;
+                }
+            }
+        }
+
+        return count;
+    }
+
     bool Relay::init(const std::string& config)
     {
-        servers.clear();
-        connections.clear();
-        status.reset();
+        configFile = config;
 
         YAML::Node document;
 
@@ -66,6 +94,11 @@ namespace relay
             return false;
         }
 
+#ifndef _WIN32
+        std::string newSyslogIdent = syslogIdent;
+        int newSyslogFacility = syslogFacility;
+#endif
+
         if (document["log"])
         {
             const YAML::Node& logObject = document["log"];
@@ -83,53 +116,55 @@ namespace relay
 
             if (logObject["syslogIdent"])
             {
-                syslogIdent = logObject["syslogIdent"].as<std::string>();
+                newSyslogIdent = logObject["syslogIdent"].as<std::string>();
             }
 
             if (logObject["syslogFacility"])
             {
                 std::string facility = logObject["syslogFacility"].as<std::string>();
 
-                if (facility == "LOG_USER") syslogFacility = LOG_USER;
-                else if (facility == "LOG_LOCAL0") syslogFacility = LOG_LOCAL0;
-                else if (facility == "LOG_LOCAL1") syslogFacility = LOG_LOCAL1;
-                else if (facility == "LOG_LOCAL2") syslogFacility = LOG_LOCAL2;
-                else if (facility == "LOG_LOCAL3") syslogFacility = LOG_LOCAL3;
-                else if (facility == "LOG_LOCAL4") syslogFacility = LOG_LOCAL4;
-                else if (facility == "LOG_LOCAL5") syslogFacility = LOG_LOCAL5;
-                else if (facility == "LOG_LOCAL6") syslogFacility = LOG_LOCAL6;
-                else if (facility == "LOG_LOCAL7") syslogFacility = LOG_LOCAL7;
+                if (facility == "LOG_USER") newSyslogFacility = LOG_USER;
+                else if (facility == "LOG_LOCAL0") newSyslogFacility = LOG_LOCAL0;
+                else if (facility == "LOG_LOCAL1") newSyslogFacility = LOG_LOCAL1;
+                else if (facility == "LOG_LOCAL2") newSyslogFacility = LOG_LOCAL2;
+                else if (facility == "LOG_LOCAL3") newSyslogFacility = LOG_LOCAL3;
+                else if (facility == "LOG_LOCAL4") newSyslogFacility = LOG_LOCAL4;
+                else if (facility == "LOG_LOCAL5") newSyslogFacility = LOG_LOCAL5;
+                else if (facility == "LOG_LOCAL6") newSyslogFacility = LOG_LOCAL6;
+                else if (facility == "LOG_LOCAL7") newSyslogFacility = LOG_LOCAL7;
             }
 #endif
         }
 
-        openLog();
+#ifndef _WIN32
+        bool syslogChanged = (newSyslogIdent != syslogIdent || newSyslogFacility != syslogFacility);
 
-        if (document["timeout"])
+        if (syslogChanged)
         {
-            float ts = document["timeout"].as<float>();
-            timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<int>(ts * 1000));
-            hasTimeout = true;
+            syslogIdent = newSyslogIdent;
+            syslogFacility = newSyslogFacility;
         }
+#else
+        bool syslogChanged = false;
+#endif
 
-        if (document["statusPage"])
+        // a reload reopens the log only if the syslog settings changed
+        if (!logOpened || syslogChanged)
         {
-            const YAML::Node& statusPageObject = document["statusPage"];
-
-            if (statusPageObject["address"])
-            {
-                status.reset(new Status(network, *this, statusPageObject["address"].as<std::string>()));
-            }
+            openLog();
+            logOpened = true;
         }
 
+        // the whole configuration is read before anything is changed, so a reload with an invalid file keeps running the current one
         std::set<std::string> listenAddresses;
+        std::vector<std::vector<Endpoint>> serverEndpoints;
 
         const YAML::Node& serversArray = document["servers"];
 
         for (size_t serverIndex = 0; serverIndex < serversArray.size(); ++serverIndex)
         {
             std::vector<Endpoint> endpoints;
-            
+
             const YAML::Node& serverObject = serversArray[serverIndex];
 
             if (serverObject["endpoints"])
@@ -161,15 +196,17 @@ namespace relay
                         for (size_t addressIndex = 0; addressIndex < addressArray.size(); ++addressIndex)
                         {
                             std::string address = addressArray[addressIndex].as<std::string>();
-                            std::pair<uint32_t, uint16_t> addr;
-                            if (!Socket::getAddress(address, addr))
+
+                            Endpoint::Address endpointAddress;
+                            endpointAddress.url = address;
+
+                            // client addresses are resolved asynchronously every time they are connected to
+                            if (endpoint.connectionType == Connection::Type::HOST &&
+                                !Socket::getAddress(address, endpointAddress.ipAddresses))
                             {
                                 return false;
                             }
 
-                            Endpoint::Address endpointAddress;
-                            endpointAddress.url = address;
-                            endpointAddress.ipAddresses = std::make_pair(addr.first, addr.second);
                             endpoint.addresses.push_back(endpointAddress);
 
                             if (endpoint.connectionType == Connection::Type::HOST)
@@ -181,21 +218,27 @@ namespace relay
                     else
                     {
                         std::string address = endpointObject["address"].as<std::string>();
-                        std::pair<uint32_t, uint16_t> addr;
-                        if (!Socket::getAddress(address, addr))
+
+                        Endpoint::Address endpointAddress;
+                        endpointAddress.url = address;
+
+                        if (endpoint.connectionType == Connection::Type::HOST &&
+                            !Socket::getAddress(address, endpointAddress.ipAddresses))
                         {
                             return false;
                         }
 
-                        Endpoint::Address endpointAddress;
-                        endpointAddress.url = address;
-                        endpointAddress.ipAddresses = std::make_pair(addr.first, addr.second);
                         endpoint.addresses.push_back(endpointAddress);
                     }
 
                     if (endpointObject["connectionTimeout"]) endpoint.connectionTimeout = endpointObject["connectionTimeout"].as<float>();
                     if (endpointObject["reconnectInterval"]) endpoint.reconnectInterval = endpointObject["reconnectInterval"].as<float>();
+                    if (endpointObject["reconnectMultiplier"]) endpoint.reconnectMultiplier = endpointObject["reconnectMultiplier"].as<float>();
+                    if (endpointObject["reconnectMaxInterval"]) endpoint.reconnectMaxInterval = endpointObject["reconnectMaxInterval"].as<float>();
+                    if (endpointObject["reconnectJitter"]) endpoint.reconnectJitter = endpointObject["reconnectJitter"].as<bool>();
                     if (endpointObject["reconnectCount"]) endpoint.reconnectCount = endpointObject["reconnectCount"].as<uint32_t>();
+                    if (endpointObject["connectRaceDelay"]) endpoint.connectRaceDelay = endpointObject["connectRaceDelay"].as<float>();
+                    if (endpointObject["warmStandby"]) endpoint.warmStandby = endpointObject["warmStandby"].as<bool>();
                     if (endpointObject["pingInterval"]) endpoint.pingInterval = endpointObject["pingInterval"].as<float>();
                     if (endpointObject["bufferSize"]) endpoint.bufferSize = endpointObject["bufferSize"].as<uint32_t>();
 
@@ -249,18 +292,192 @@ namespace relay
                 }
             }
 
-            // start the server
-            std::unique_ptr<Server> server(new Server(*this, network));
-            server->start(endpoints);
-            servers.push_back(std::move(server));
+            serverEndpoints.push_back(endpoints);
+        }
+
+        // a reload keeps the deadline unless the timeout changed
+        float newTimeoutSeconds = document["timeout"] ? document["timeout"].as<float>() : 0.0f;
+
+        if (newTimeoutSeconds != timeoutSeconds)
+        {
+            timeoutSeconds = newTimeoutSeconds;
+            timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<int>(timeoutSeconds * 1000));
+            hasTimeout = (timeoutSeconds > 0.0f);
+        }
+
+        resolver.setTtl(document["resolverTtl"] ? document["resolverTtl"].as<float>() : Resolver::DEFAULT_TTL);
+
+        memoryBudget = document["memoryBudget"] ? document["memoryBudget"].as<uint64_t>() : 0;
+        streamMemoryBudget = document["streamMemoryBudget"] ? document["streamMemoryBudget"].as<uint64_t>() : 0;
+
+        std::string newStatusAddress;
+        float newStatusUpdateInterval = 0.0f;
+        uint32_t newStatusMaxConnections = 0;
+
+        if (document["statusPage"])
+        {
+            const YAML::Node& statusPageObject = document["statusPage"];
+
+            if (statusPageObject["address"])
+            {
+                float updateInterval = 1.0f;
+
+                if (statusPageObject["updateInterval"])
+                {
+                    updateInterval = statusPageObject["updateInterval"].as<float>();
+                }
+
+                uint32_t maxConnections = 16;
+
+                if (statusPageObject["maxConnections"])
+                {
+                    maxConnections = statusPageObject["maxConnections"].as<uint32_t>();
+                }
+
+                newStatusAddress = statusPageObject["address"].as<std::string>();
+                newStatusUpdateInterval = updateInterval;
+                newStatusMaxConnections = maxConnections;
+            }
+        }
+
+        // the status page keeps its connections unless its settings changed
+        if (newStatusAddress != statusAddress ||
+            newStatusUpdateInterval != statusUpdateInterval ||
+            newStatusMaxConnections != statusMaxConnections)
+        {
+            status.reset();
+
+            statusAddress = newStatusAddress;
+            statusUpdateInterval = newStatusUpdateInterval;
+            statusMaxConnections = newStatusMaxConnections;
+
+            if (!statusAddress.empty())
+            {
+                status.reset(new Status(*this, statusAddress, statusUpdateInterval, statusMaxConnections));
+            }
+        }
+
+        captureDirectory.clear();
+
+        if (document["capture"])
+        {
+            const YAML::Node& captureObject = document["capture"];
+
+            if (captureObject["directory"])
+            {
+                captureDirectory = captureObject["directory"].as<std::string>();
+            }
+        }
+
+        // running servers are matched to the new configuration, identical ones first and then the one that has most endpoints
+        // in common, so a reload only touches the connections of the endpoints that changed
+        std::vector<std::unique_ptr<Server>> previousServers;
+        previousServers.swap(servers);
+
+        std::vector<std::unique_ptr<Server>> matchedServers(serverEndpoints.size());
+
+        for (bool exact : {true, false})
+        {
+            for (size_t i = 0; i < serverEndpoints.size(); ++i)
+            {
+                if (matchedServers[i]) continue;
+
+                std::unique_ptr<Server>* bestServer = nullptr;
+                size_t bestCount = 0;
+
+                for (std::unique_ptr<Server>& previousServer : previousServers)
+                {
+                    if (!previousServer) continue;
+
+                    size_t count = countEqualEndpoints(previousServer->getEndpoints(), serverEndpoints[i]);
+
+                    if (exact ? (count == serverEndpoints[i].size() && count == previousServer->getEndpoints().size()) : (count > bestCount))
+                    {
+                        bestServer = &previousServer;
+                        bestCount = count;
+                        if (exact) break;
+                    }
+                }
+
+                if (bestServer) matchedServers[i] = std::move(*bestServer);
+            }
+        }
+
+        std::list<Endpoint> removedEndpoints;
+        std::set<const Endpoint*> removedEndpointPointers;
+
+        for (size_t i = 0; i < serverEndpoints.size(); ++i)
+        {
+            if (matchedServers[i])
+            {
+                matchedServers[i]->reload(serverEndpoints[i], removedEndpoints);
+            }
+            else
+            {
+                matchedServers[i].reset(new Server(*this, network));
+                matchedServers[i]->start(serverEndpoints[i]);
+            }
+        }
+
+        for (const Endpoint& endpoint : removedEndpoints)
+        {
+            removedEndpointPointers.insert(&endpoint);
+        }
+
+        for (const std::unique_ptr<Server>& previousServer : previousServers)
+        {
+            if (!previousServer) continue;
+
+            for (const Endpoint& endpoint : previousServer->getEndpoints())
+            {
+                removedEndpointPointers.insert(&endpoint);
+            }
+        }
+
+        // host connections that publish or play through a removed endpoint, the others keep streaming
+        for (size_t i = 0; i < connections.size();)
+        {
+            if (removedEndpointPointers.find(connections[i]->getEndpoint()) != removedEndpointPointers.end())
+            {
+                connections[i]->close(true);
+                connections.removeAt(i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+
+        for (const std::unique_ptr<Server>& previousServer : previousServers)
+        {
+            if (!previousServer) continue;
+
+            Log(Log::Level::INFO) << "Removing server " << previousServer->getId();
+            previousServer->stop();
+        }
+
+        servers.swap(matchedServers);
+
+        for (auto i = acceptors.begin(); i != acceptors.end();)
+        {
+            if (listenAddresses.find(i->first) == listenAddresses.end())
+            {
+                Log(Log::Level::INFO) << "Stopped listening on " << i->first;
+                i = acceptors.erase(i);
+            }
+            else
+            {
+                ++i;
+            }
         }
 
         for (const std::string& address : listenAddresses)
         {
+            if (acceptors.find(address) != acceptors.end()) continue;
+
             Socket acceptor(network);
             acceptor.setAcceptCallback(std::bind(&Relay::handleAccept, this, std::placeholders::_1, std::placeholders::_2));
-            acceptor.startAccept(address);
-            acceptors.push_back(std::move(acceptor));
+            if (acceptor.startAccept(address)) acceptors.insert(std::make_pair(address, std::move(acceptor)));
         }
 
         return true;
@@ -283,7 +500,7 @@ namespace relay
                         (endpoint.applicationName.empty() || std::regex_match(applicationName, std::regex(endpoint.applicationName))) &&
                         (endpoint.streamName.empty() || std::regex_match(streamName, std::regex(endpoint.streamName))))
                     {
-                        Log(Log::Level::ALL) << "Application \"" << applicationName << "\", stream \"" << streamName << "\" matched endpoint application \"" << endpoint.applicationName << "\", stream \"" << endpoint.streamName << "\"";
+                        RELAY_LOG(Log::Level::ALL) << "Application \"" << applicationName << "\", stream \"" << streamName << "\" matched endpoint application \"" << endpoint.applicationName << "\", stream \"" << endpoint.streamName << "\"";
 
                         if (endpoint.direction == direction)
                         {
@@ -296,14 +513,14 @@ namespace relay
                                      endpointAddress.ipAddresses.first == address.first) &&
                                     endpointAddress.ipAddresses.second == address.second)
                                 {
-                                    Log(Log::Level::ALL) << "Address " << ipToString(address.first) << ":" << address.second << " matched address " << ipToString(endpointAddress.ipAddresses.first) << ":" << endpointAddress.ipAddresses.second;
+                                    RELAY_LOG(Log::Level::ALL) << "Address " << ipToString(address.first) << ":" << address.second << " matched address " << ipToString(endpointAddress.ipAddresses.first) << ":" << endpointAddress.ipAddresses.second;
 
                                     found = true;
                                     break;
                                 }
                                 else
                                 {
-                                    Log(Log::Level::ALL) << "Address " << ipToString(address.first) << ":" << address.second << " did not match address " << ipToString(endpointAddress.ipAddresses.first) << ":" << endpointAddress.ipAddresses.second;
+                                    RELAY_LOG(Log::Level::ALL) << "Address " << ipToString(address.first) << ":" << address.second << " did not match address " << ipToString(endpointAddress.ipAddresses.first) << ":" << endpointAddress.ipAddresses.second;
                                 }
                             }
 
@@ -315,7 +532,7 @@ namespace relay
                     }
                     else
                     {
-                        Log(Log::Level::ALL) << "Application: \"" << applicationName << "\", stream: \"" << streamName << "\" did not match endpoint application: \"" << endpoint.applicationName << "\", stream: \"" << endpoint.streamName << "\"";
+                        RELAY_LOG(Log::Level::ALL) << "Application: \"" << applicationName << "\", stream: \"" << streamName << "\" did not match endpoint application: \"" << endpoint.applicationName << "\", stream: \"" << endpoint.streamName << "\"";
                     }
                 }
                 catch (std::regex_error e)
@@ -336,10 +553,29 @@ namespace relay
         active = false;
     }
 
+    void Relay::fillRandom(uint8_t* buffer, size_t size)
+    {
+        size_t i = 0;
+
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+        {
+            uint64_t value = generator();
+            memcpy(buffer + i, &value, sizeof(value));
+        }
+
+        if (i < size)
+        {
+            uint64_t value = generator();
+            memcpy(buffer + i, &value, size - i);
+        }
+    }
+
     void Relay::run()
     {
         const std::chrono::microseconds sleepTime(5000);
 
+        Profiler::enableThread();
+
         while (active)
         {
             auto currentTime = std::chrono::steady_clock::now();
@@ -348,6 +584,30 @@ namespace relay
                 break;
             }
 
+            if (stopRequested)
+            {
+                Log(Log::Level::INFO) << "Shutting down";
+                close();
+                break;
+            }
+
+            if (reloadRequested.exchange(false))
+            {
+                Log(Log::Level::INFO) << "Reloading " << configFile;
+
+                if (!init(configFile))
+                {
+                    Log(Log::Level::ERR) << "Failed to reload config, keeping the current configuration";
+                }
+            }
+
+            if (statsRequested.exchange(false))
+            {
+                std::string str;
+                getStats(str, ReportType::TEXT);
+                Log(Log::Level::INFO) << str;
+            }
+
             float delta = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - previousTime).count() / 1000.0f;
             previousTime = currentTime;
 
@@ -355,21 +615,19 @@ namespace relay
 
             if (status) status->update(delta);
 
-            for (auto i = connections.begin(); i != connections.end();)
+            for (size_t i = 0; i < connections.size();)
             {
-                const std::unique_ptr<Connection>& connection = *i;
+                Connection* connection = connections[i].get();
 
                 if (connection->isClosed())
                 {
-                    i = connections.erase(i);
-                    continue;
+                    connections.removeAt(i);
                 }
                 else
                 {
+                    connection->update(delta);
                     ++i;
                 }
-
-                connection->update(delta);
             }
 
             for (const auto& server : servers)
@@ -377,25 +635,69 @@ namespace relay
                 server->update(delta);
             }
 
+            timeSinceMemoryCheck += delta;
+            if (timeSinceMemoryCheck >= MEMORY_CHECK_INTERVAL)
+            {
+                timeSinceMemoryCheck = 0.0f;
+                checkMemory();
+            }
+
+            timeSinceTrim += delta;
+            if (timeSinceTrim >= BufferPool::TRIM_INTERVAL)
+            {
+                timeSinceTrim = 0.0f;
+                BufferPool::trim();
+            }
+
             std::this_thread::sleep_for(sleepTime);
         }
     }
 
     void Relay::getStats(std::string& str, ReportType reportType) const
     {
-        std::map<Connection*, Stream*> cons;
-        std::map<Stream*, Connection*> streams;
+        // host connections join a stream when they start publishing or playing
+        std::vector<Connection*> pendingConnections;
+        for (const auto& c : connections)
+        {
+            if (!c->isStreaming()) pendingConnections.push_back(c.get());
+        }
 
-        for (auto& c : connections)
+        std::vector<const Stream*> streams;
+        for (const auto& server : servers)
         {
-            cons[c.get()] = c->getStream();
+            for (const auto& stream : server->getStreams())
+            {
+                if (!stream->isClosed()) streams.push_back(stream.get());
+            }
         }
 
-        for (auto& s : servers)
+        // client connections waiting for their backoff, shows a reconnect storm draining
+        size_t pendingReconnects = 0;
+        for (const auto& server : servers)
+        {
+            pendingReconnects += server->getPendingReconnectCount();
+        }
+
+        MemoryUsage memory;
+        getMemoryUsage(memory);
+
+        const std::pair<const char*, uint64_t> memoryCategories[] = {
+            {"connections", memory.connections},
+            {"output queues", memory.outputQueues},
+            {"input buffers", memory.inputBuffers},
+            {"stream headers", memory.streamHeaders},
+            {"buffer pool", memory.bufferPool}
+        };
+
+        std::string memoryString = std::to_string(memory.getTotal()) + " bytes";
+        if (memoryBudget) memoryString += " (" + std::to_string(memory.getBudgeted()) + " of the budget of " + std::to_string(memoryBudget) + ")";
+        for (const auto& category : memoryCategories)
         {
-            s->getConnections(cons);
+            memoryString += std::string(", ") + category.first + " " + std::to_string(category.second);
         }
 
+        std::vector<Connection*> streamConnections;
+
         switch (reportType)
         {
             case ReportType::TEXT:
@@ -418,41 +720,36 @@ namespace relay
 
                 auto header = ss.str();
 
+                str = "Pending reconnects: " + std::to_string(pendingReconnects) + "\n";
+                str += "Memory: " + memoryString + "\n\n";
 
-                str = "Pending connections:\n";
-                for (const auto& c : cons)
+                str += "Pending connections:\n";
+                for (Connection* c : pendingConnections)
                 {
-                    if (c.second == nullptr)
-                    {
-                        c.first->getStats(str, reportType);
-                    }
+                    c->getStats(str, reportType);
                 }
 
                 str += "\nStreams:\n";
-                for (auto it = cons.begin(); it != cons.end(); ++it)
+                for (const Stream* stream : streams)
                 {
-                    if (it->second != nullptr)
-                    {
-                        Stream* stream = it->second;
-                        stream->getStats(str, reportType);
-                        str += header;
+                    stream->getStats(str, reportType);
+                    str += header;
 
-                        if (stream->getInputConnection())
-                        {
-                            stream->getInputConnection()->getStats(str, reportType);
-                            cons[stream->getInputConnection()] = nullptr;
-                        }
-                        for (auto cit = it; cit != cons.end(); ++cit)
-                        {
-                            if (cons[cit->first] == stream && cit->first != stream->getInputConnection())
-                            {
-                                cons[cit->first] = nullptr;
-                                cit->first->getStats(str, reportType);
-                            }
-                        }
+                    streamConnections.clear();
+                    stream->getConnections(streamConnections);
+                    for (Connection* c : streamConnections)
+                    {
+                        c->getStats(str, reportType);
                     }
                 }
 
+                ObjectPool::getStats(str, reportType);
+                BufferPool::getStats(str, reportType);
+
+#ifdef RELAY_PROFILE
+                Profiler::getStats(str, reportType);
+#endif
+
                 break;
             }
             case ReportType::HTML:
@@ -461,98 +758,310 @@ namespace relay
 
                 str = "<html><title>Status</title><body>";
 
-                str = "<b>Pending connections</b>";
+                str += "<b>Pending reconnects:</b> " + std::to_string(pendingReconnects) + "<br>";
+                str += "<b>Memory:</b> " + memoryString + "<br>";
+
+                str += "<b>Pending connections</b>";
                 str += header;
-                for (const auto& c : cons)
+                for (Connection* c : pendingConnections)
                 {
-                    if (c.second == nullptr)
-                    {
-                        c.first->getStats(str, reportType);
-                    }
+                    c->getStats(str, reportType);
                 }
                 str += "</table>";
 
-                str = "<b>Streams</b><br>";
-                for (auto it = cons.begin(); it != cons.end(); ++it)
+                str += "<b>Streams</b><br>";
+                for (const Stream* stream : streams)
                 {
-                    if (it->second)
-                    {
-                        Stream* stream = it->second;
-                        stream->getStats(str, reportType);
+                    stream->getStats(str, reportType);
+                    str += header;
 
-                        str += header;
-                        if (stream->getInputConnection())
-                        {
-                            stream->getInputConnection()->getStats(str, reportType);
-                            cons[stream->getInputConnection()] = nullptr;
-                        }
-                        for (auto cit = it; cit != cons.end(); ++cit)
-                        {
-                            if (cons[cit->first] == stream && cit->first != stream->getInputConnection())
-                            {
-                                cons[cit->first] = nullptr;
-                                cit->first->getStats(str, reportType);
-                            }
-                        }
-                        str += "</table>";
+                    streamConnections.clear();
+                    stream->getConnections(streamConnections);
+                    for (Connection* c : streamConnections)
+                    {
+                        c->getStats(str, reportType);
                     }
+
+                    str += "</table>";
                 }
 
+                ObjectPool::getStats(str, reportType);
+                BufferPool::getStats(str, reportType);
+
+#ifdef RELAY_PROFILE
+                Profiler::getStats(str, reportType);
+#endif
+
                 str += "</body></html>";
 
                 break;
             }
             case ReportType::JSON:
             {
-                bool first = true;
-                str = "{\"pending_connections\":[";
-                for (const auto& c : cons)
+                str.clear();
+                JsonWriter writer(str);
+
+                writer.beginObject();
+                writer.key("pending_reconnects").value(pendingReconnects);
+
+                writer.key("memory").beginObject();
+                writer.key("total").value(memory.getTotal());
+                writer.key("budgeted").value(memory.getBudgeted());
+                writer.key("budget").value(memoryBudget);
+                writer.key("stream_budget").value(streamMemoryBudget);
+                writer.key("connections").value(memory.connections);
+                writer.key("output_queues").value(memory.outputQueues);
+                writer.key("input_buffers").value(memory.inputBuffers);
+                writer.key("stream_headers").value(memory.streamHeaders);
+                writer.key("buffer_pool").value(memory.bufferPool);
+                writer.endObject();
+
+                writer.key("pending_connections").beginArray();
+                for (Connection* c : pendingConnections)
                 {
-                    if (c.second == nullptr)
+                    c->getStats(writer);
+                }
+                writer.endArray();
+
+                writer.key("streams").beginArray();
+                for (const Stream* stream : streams)
+                {
+                    writer.beginObject();
+                    stream->getStats(writer);
+
+                    writer.key("connections").beginArray();
+                    streamConnections.clear();
+                    stream->getConnections(streamConnections);
+                    for (Connection* c : streamConnections)
                     {
-                        if (!first) str += ",";
-                        first = false;
-                        c.first->getStats(str, reportType);
+                        c->getStats(writer);
                     }
+                    writer.endArray();
+
+                    writer.endObject();
                 }
-                str += "], \"streams\":[";
-                bool firstStream = true;
-                for (auto it = cons.begin(); it != cons.end(); ++it)
+                writer.endArray();
+
+                writer.key("pools");
+                ObjectPool::getStats(writer);
+                writer.key("buffer_pool");
+                BufferPool::getStats(writer);
+
+#ifdef RELAY_PROFILE
+                writer.key("profile");
+                Profiler::getStats(writer);
+#endif
+
+                writer.endObject();
+
+                break;
+            }
+        }
+    }
+
+    void Relay::getMetrics(std::string& str) const
+    {
+        struct CounterFamily
+        {
+            const char* name;
+            const char* help;
+            uint64_t Counters::* counter;
+        };
+
+        static const CounterFamily relayCounters[] = {
+            {"rtmp_relay_bytes_received_total", "Bytes received from RTMP peers.", &Counters::bytesReceived},
+            {"rtmp_relay_bytes_sent_total", "Bytes queued for sending to RTMP peers.", &Counters::bytesSent},
+            {"rtmp_relay_chunks_received_total", "RTMP chunks received.", &Counters::chunksReceived},
+            {"rtmp_relay_chunks_sent_total", "RTMP chunks sent.", &Counters::chunksSent},
+            {"rtmp_relay_frames_forwarded_total", "Audio and video frames forwarded to outputs.", &Counters::framesForwarded},
+            {"rtmp_relay_frames_dropped_total", "Audio and video frames not forwarded to outputs.", &Counters::framesDropped},
+            {"rtmp_relay_reconnects_total", "Reconnect attempts of client connections.", &Counters::reconnects},
+            {"rtmp_relay_handshake_failures_total", "RTMP handshakes that did not complete.", &Counters::handshakeFailures},
+            {"rtmp_relay_memory_throttles_total", "Outputs throttled because a memory budget was nearly used up.", &Counters::memoryThrottles},
+            {"rtmp_relay_memory_evictions_total", "Connections closed because a memory budget was exceeded.", &Counters::memoryEvictions}
+        };
+
+        static const CounterFamily streamCounters[] = {
+            {"rtmp_relay_stream_frames_received_total", "Audio and video frames received from the stream input.", &Counters::framesReceived},
+            {"rtmp_relay_stream_frames_forwarded_total", "Audio and video frames forwarded to the stream outputs.", &Counters::framesForwarded},
+            {"rtmp_relay_stream_frames_dropped_total", "Audio and video frames not forwarded to the stream outputs.", &Counters::framesDropped}
+        };
+
+        static const CounterFamily connectionCounters[] = {
+            {"rtmp_relay_connection_frames_forwarded_total", "Audio and video frames queued to an output connection.", &Counters::framesForwarded},
+            {"rtmp_relay_connection_frames_dropped_total", "Audio and video frames not queued to an output connection.", &Counters::framesDropped}
+        };
+
+        str.clear();
+        MetricsWriter writer(str);
+
+        for (const CounterFamily& family : relayCounters)
+        {
+            writer.family(family.name, "counter", family.help);
+            writer.sample(family.name, counters.*family.counter);
+        }
+
+        size_t connectionCount = connections.size();
+        for (const auto& server : servers)
+        {
+            connectionCount += server->getClientConnectionCount();
+        }
+
+        writer.family("rtmp_relay_connections", "gauge", "Open RTMP connections.");
+        writer.sample("rtmp_relay_connections", connectionCount);
+
+        size_t pendingReconnects = 0;
+        for (const auto& server : servers)
+        {
+            pendingReconnects += server->getPendingReconnectCount();
+        }
+
+        writer.family("rtmp_relay_pending_reconnects", "gauge", "Client connections waiting for their reconnect backoff.");
+        writer.sample("rtmp_relay_pending_reconnects", pendingReconnects);
+
+        writer.family("rtmp_relay_queued_bytes", "gauge", "Bytes waiting in socket output buffers.");
+        writer.sample("rtmp_relay_queued_bytes", network.getQueuedBytes());
+
+        MemoryUsage memory;
+        getMemoryUsage(memory);
+
+        const std::pair<const char*, uint64_t> memoryCategories[] = {
+            {"connections", memory.connections},
+            {"output_queues", memory.outputQueues},
+            {"input_buffers", memory.inputBuffers},
+            {"stream_headers", memory.streamHeaders},
+            {"buffer_pool", memory.bufferPool}
+        };
+
+        writer.family("rtmp_relay_memory_bytes", "gauge", "Memory held by the relay, by category.");
+        for (const auto& category : memoryCategories)
+        {
+            std::string labels;
+            MetricsWriter::appendLabel(labels, "category", category.first);
+            writer.sample("rtmp_relay_memory_bytes", labels, category.second);
+        }
+
+        writer.family("rtmp_relay_memory_budget_bytes", "gauge", "Memory budget of the relay, 0 if there is none.");
+        writer.sample("rtmp_relay_memory_budget_bytes", memoryBudget);
+
+        writer.family("rtmp_relay_stream_memory_bytes", "gauge", "Memory held by the headers and connections of a stream.");
+        for (const auto& server : servers)
+        {
+            for (const auto& stream : server->getStreams())
+            {
+                writer.sample("rtmp_relay_stream_memory_bytes", stream->getMetricLabels(), stream->getMemoryUsage());
+            }
+        }
+
+        writer.family("rtmp_relay_server_streams", "gauge", "Streams per server.");
+        for (const auto& server : servers)
+        {
+            writer.sample("rtmp_relay_server_streams", server->getMetricLabels(), server->getStreams().size());
+        }
+
+        writer.family("rtmp_relay_server_connections", "gauge", "Connections attached to the streams of a server.");
+        for (const auto& server : servers)
+        {
+            size_t serverConnectionCount = 0;
+            for (const auto& stream : server->getStreams())
+            {
+                serverConnectionCount += stream->getConnectionCount();
+            }
+
+            writer.sample("rtmp_relay_server_connections", server->getMetricLabels(), serverConnectionCount);
+        }
+
+        for (const CounterFamily& family : streamCounters)
+        {
+            writer.family(family.name, "counter", family.help);
+
+            for (const auto& server : servers)
+            {
+                for (const auto& stream : server->getStreams())
                 {
-                    if (it->second != nullptr)
-                    {
-                        Stream* stream = it->second;
-                        if (!firstStream) str += ",";
-                        firstStream = false;
-                        stream->getStats(str, reportType);
+                    writer.sample(family.name, stream->getMetricLabels(), stream->getCounters().*family.counter);
+                }
+            }
+        }
+        // labels of the stream outputs, formatted once for all of their families
+        std::vector<std::pair<const Connection*, std::string>> outputs;
+        std::vector<Connection*> streamConnections;
 
-                        first = true;
-                        if (stream->getInputConnection())
-                        {
-                            first = false;
-                            stream->getInputConnection()->getStats(str, reportType);
-                            cons[stream->getInputConnection()] = nullptr;
-                        }
-                        for (auto cit = it; cit != cons.end(); ++cit)
-                        {
-                            if (cons[cit->first] == stream && cit->first != stream->getInputConnection())
-                            {
-                                if (!first) str += ",";
-                                first = false;
-                                
-                                cons[cit->first] = nullptr;
-                                cit->first->getStats(str, reportType);
-                            }
-                        }
+        for (const auto& server : servers)
+        {
+            for (const auto& stream : server->getStreams())
+            {
+                streamConnections.clear();
+                stream->getConnections(streamConnections);
+
+                for (const Connection* connection : streamConnections)
+                {
+                    if (connection->getDirection() != Connection::Direction::OUTPUT) continue;
+
+                    std::string labels = stream->getMetricLabels();
+                    connection->appendMetricLabels(labels);
+                    outputs.push_back(std::make_pair(connection, std::move(labels)));
+                }
+            }
+        }
 
-                        str += "]}";
+        for (const CounterFamily& family : connectionCounters)
+        {
+            writer.family(family.name, "counter", family.help);
+
+            for (const auto& output : outputs)
+            {
+                writer.sample(family.name, output.second, output.first->getCounters().*family.counter);
+            }
+        }
+
+        writer.family("rtmp_relay_connection_queued_bytes", "gauge", "Bytes waiting in the socket output buffer of an output connection.");
+        for (const auto& output : outputs)
+        {
+            writer.sample("rtmp_relay_connection_queued_bytes", output.second, output.first->getQueuedBytes());
+        }
+
+        writer.family("rtmp_relay_stream_video_latency_seconds", "summary", "Time from receiving a video frame until it is handed to the outputs (fanout) or written to them (egress).");
+        for (const auto& server : servers)
+        {
+            for (const auto& stream : server->getStreams())
+            {
+                LatencyHistogram egressLatency;
+                stream->getEgressLatency(egressLatency);
+
+                const std::pair<const char*, const LatencyHistogram*> stages[] = {
+                    {"fanout", &stream->getFanOutLatency()},
+                    {"egress", &egressLatency}
+                };
+
+                for (const auto& stage : stages)
+                {
+                    std::string labels = stream->getMetricLabels();
+                    MetricsWriter::appendLabel(labels, "stage", stage.first);
+
+                    static const std::pair<const char*, double> quantiles[] = {
+                        {"0.5", 0.5}, {"0.99", 0.99}, {"0.999", 0.999}
+                    };
+
+                    for (const auto& quantile : quantiles)
+                    {
+                        std::string quantileLabels = labels;
+                        MetricsWriter::appendLabel(quantileLabels, "quantile", quantile.first);
+                        writer.sampleSeconds("rtmp_relay_stream_video_latency_seconds", quantileLabels, stage.second->getPercentile(quantile.second));
                     }
+
+                    writer.sampleSeconds("rtmp_relay_stream_video_latency_seconds_sum", labels, stage.second->getSum());
+                    writer.sample("rtmp_relay_stream_video_latency_seconds_count", labels, stage.second->getCount());
                 }
-                str += "]}";
-                
-                break;
             }
         }
+
+        ObjectPool::getMetrics(writer);
+        BufferPool::getMetrics(writer);
+
+#ifdef RELAY_PROFILE
+        Profiler::getMetrics(writer);
+#endif
     }
 
     void Relay::openLog()
@@ -560,17 +1069,152 @@ namespace relay
 #ifndef _WIN32
         openlog(syslogIdent.empty() ? nullptr : syslogIdent.c_str(), 0, syslogFacility);
 #endif
+        Log::startWriter();
     }
 
     void Relay::closeLog()
     {
+        Log::stopWriter();
 #ifndef _WIN32
         closelog();
 #endif
     }
 
+    void Relay::getMemoryUsage(MemoryUsage& usage) const
+    {
+        usage.connections += connections.size() * sizeof(Connection);
+
+        for (const auto& connection : connections)
+        {
+            usage.outputQueues += connection->getOutputQueueMemory();
+            usage.inputBuffers += connection->getInputMemory();
+        }
+
+        std::vector<Connection*> clientConnections;
+
+        for (const auto& server : servers)
+        {
+            clientConnections.clear();
+            server->getConnections(clientConnections);
+
+            usage.connections += clientConnections.size() * sizeof(Connection) + server->getStreams().size() * sizeof(Stream);
+
+            for (const Connection* connection : clientConnections)
+            {
+                usage.outputQueues += connection->getOutputQueueMemory();
+                usage.inputBuffers += connection->getInputMemory();
+            }
+
+            for (const auto& stream : server->getStreams())
+            {
+                usage.streamHeaders += stream->getHeaderMemory();
+            }
+        }
+
+        usage.bufferPool = BufferPool::getCachedBytes();
+    }
+
+    void Relay::checkMemory()
+    {
+        MemoryUsage usage;
+        getMemoryUsage(usage);
+        memoryUsage = usage.getBudgeted();
+
+        std::vector<Connection*> candidates;
+
+        if (streamMemoryBudget)
+        {
+            for (const auto& server : servers)
+            {
+                for (const auto& stream : server->getStreams())
+                {
+                    if (stream->isClosed()) continue;
+
+                    candidates.clear();
+                    stream->getConnections(candidates);
+                    enforceMemoryBudget(candidates, stream->getMemoryUsage(), streamMemoryBudget, stream->getIdString());
+                }
+            }
+        }
+
+        if (memoryBudget)
+        {
+            candidates.clear();
+
+            for (const auto& connection : connections)
+            {
+                candidates.push_back(connection.get());
+            }
+
+            for (const auto& server : servers)
+            {
+                server->getConnections(candidates);
+            }
+
+            enforceMemoryBudget(candidates, memoryUsage, memoryBudget, std::string());
+        }
+    }
+
+    void Relay::enforceMemoryBudget(std::vector<Connection*>& candidates, uint64_t usage, uint64_t budget, const std::string& scope)
+    {
+        uint64_t throttleLimit = static_cast<uint64_t>(budget * MEMORY_THROTTLE_RATIO);
+        if (usage <= throttleLimit) return;
+
+        std::sort(candidates.begin(), candidates.end(), [](const Connection* a, const Connection* b) {
+            return a->getMemoryUsage() > b->getMemoryUsage();
+        });
+
+        if (usage <= budget)
+        {
+            // throttled outputs stop growing, which is enough if they are the ones filling the budget, the ones
+            // throttled by an earlier check count too, so outputs that keep up are left alone
+            uint64_t excess = usage - throttleLimit;
+
+            for (Connection* connection : candidates)
+            {
+                if (connection->getDirection() != Connection::Direction::OUTPUT) continue;
+
+                if (!connection->isThrottled())
+                {
+                    if (connection->getQueuedBytes() == 0) continue;
+                    connection->throttle();
+                }
+
+                uint64_t memory = connection->getMemoryUsage();
+                if (memory >= excess) break;
+                excess -= memory;
+            }
+
+            return;
+        }
+
+        for (Connection* connection : candidates)
+        {
+            if (usage <= budget) break;
+            if (connection->isClosed()) continue;
+
+            uint64_t memory = connection->getMemoryUsage();
+            if (memory == 0) break;
+
+            Log(Log::Level::WARN) << scope << "Memory usage of " << usage << " bytes is over the budget of " << budget << " bytes, disconnecting " << connection->getIdString() << "holding " << memory << " bytes";
+
+            // the queued data is dropped, client connections reconnect after their backoff
+            connection->close();
+            ++counters.memoryEvictions;
+
+            usage -= memory;
+        }
+    }
+
     void Relay::handleAccept(Socket&, Socket& clientSocket)
     {
+        // a flood of connections must not push out the streams that are already running
+        if (memoryBudget && memoryUsage > memoryBudget)
+        {
+            Log(Log::Level::WARN) << "Memory usage of " << memoryUsage << " bytes is over the budget, rejecting " << ipToString(clientSocket.getRemoteIPAddress()) << ":" << clientSocket.getRemotePort();
+            return;
+        }
+
         std::unique_ptr<Connection> connection(new Connection(*this, clientSocket));
 
         connections.push_back(std::move(connection));
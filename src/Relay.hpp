@@ -4,16 +4,21 @@
 
 #pragma once
 
+#include <atomic>
+#include <map>
 #include <memory>
 #include <random>
 #include <vector>
 #include <utility>
 #include <chrono>
+#include "AddressHealth.hpp"
 #include "Network.hpp"
+#include "Resolver.hpp"
 #include "Socket.hpp"
 #include "Status.hpp"
 #include "Server.hpp"
 #include "Endpoint.hpp"
+#include "Metrics.hpp"
 
 #ifndef _WIN32
 #  include <sys/syslog.h>
@@ -26,6 +31,10 @@ namespace relay
     class Relay
     {
     public:
+        static constexpr float MEMORY_CHECK_INTERVAL = 0.1f;
+        // outputs are throttled above this part of a memory budget, connections are disconnected above the budget
+        static constexpr float MEMORY_THROTTLE_RATIO = 0.75f;
+
         static uint64_t nextId() { return ++currentId; }
 
         Relay(Network& aNetwork);
@@ -36,15 +45,30 @@ namespace relay
         Relay& operator=(const Relay&) = delete;
         Relay& operator=(Relay&&) = delete;
 
-        std::mt19937& getGenerator() { return generator; }
+        std::mt19937_64& getGenerator() { return generator; }
+        // fills the buffer 8 bytes per generator call, for handshake data that only has to look random
+        void fillRandom(uint8_t* buffer, size_t size);
         Network& getNetwork() { return network; }
+        Resolver& getResolver() { return resolver; }
+        AddressHealth& getAddressHealth() { return addressHealth; }
+        Counters& getCounters() { return counters; }
+        const std::string& getCaptureDirectory() const { return captureDirectory; }
 
+        // applies the configuration, on a reload only the servers, endpoints and listeners that changed are touched
         bool init(const std::string& config);
+        // called from the SIGHUP handler, the relay thread reloads the configuration file before its next update
+        void reload() { reloadRequested = true; }
+        // called from the SIGTERM handler, the relay thread closes everything and leaves run
+        void stop() { stopRequested = true; }
+        // called from the SIGUSR1 handler, the relay thread logs the statistics before its next update
+        void logStats() { statsRequested = true; }
         void close();
 
         void run();
 
         void getStats(std::string& str, ReportType reportType) const;
+        void getMetrics(std::string& str) const;
+        void getMemoryUsage(MemoryUsage& usage) const;
 
         void openLog();
         void closeLog();
@@ -57,20 +81,47 @@ namespace relay
     private:
         void handleAccept(Socket& acceptor, Socket& clientSocket);
 
+        // applies the budget of the whole relay and of every stream
+        void checkMemory();
+        // throttles or disconnects the connections that hold the most memory until usage is within the budget
+        void enforceMemoryBudget(std::vector<Connection*>& candidates, uint64_t usage, uint64_t budget, const std::string& scope);
+
         static uint64_t currentId;
-        std::mt19937 generator;
+        std::mt19937_64 generator;
         bool active = true;
 
         Network& network;
+        Resolver resolver; // before the servers and connections, which cancel their requests when deleted
+        AddressHealth addressHealth;
+        std::string configFile;
+        std::atomic<bool> reloadRequested{false};
+        std::atomic<bool> stopRequested{false};
+        std::atomic<bool> statsRequested{false};
+
         std::unique_ptr<Status> status;
+        std::string statusAddress;
+        float statusUpdateInterval = 0.0f;
+        uint32_t statusMaxConnections = 0;
+
         std::chrono::steady_clock::time_point previousTime;
+        float timeSinceTrim = 0.0f; // of the buffer pool
+        float timeSinceMemoryCheck = 0.0f;
         std::chrono::steady_clock::time_point timeout;
+        float timeoutSeconds = 0.0f; // as configured, 0 for no timeout
         bool hasTimeout = false;
+        bool logOpened = false; // by init, which reopens it only when the syslog settings change
 
         std::vector<std::unique_ptr<Server>> servers;
-        std::vector<std::unique_ptr<Connection>> connections;
+        SlotVector<Connection, &Connection::ownerSlot, std::unique_ptr<Connection>> connections;
+
+        std::map<std::string, Socket> acceptors; // by listen address
+
+        Counters counters;
+        std::string captureDirectory;
 
-        std::vector<Socket> acceptors;
+        uint64_t memoryBudget = 0; // bytes, 0 for no limit
+        uint64_t streamMemoryBudget = 0;
+        uint64_t memoryUsage = 0; // budgeted bytes at the last check
 
 #ifndef _WIN32
         std::string syslogIdent;
@@ -0,0 +1,157 @@
+//
+//  rtmp_relay
+//
+
+#include "Resolver.hpp"
+#include "Log.hpp"
+#include "Network.hpp"
+#include "Socket.hpp"
+#include "Utils.hpp"
+
+namespace relay
+{
+    Resolver::Resolver(Network& aNetwork):
+        network(aNetwork),
+        self(std::make_shared<Resolver*>(this))
+    {
+    }
+
+    Resolver::~Resolver()
+    {
+        *self = nullptr;
+
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+
+        queueCondition.notify_all();
+
+        // a getaddrinfo call in progress is waited for, there is no way to interrupt it
+        if (thread.joinable()) thread.join();
+    }
+
+    uint64_t Resolver::resolve(const std::string& address, const Callback& callback)
+    {
+        uint64_t requestId = ++lastRequestId;
+
+        Request& request = requests[requestId];
+        request.address = address;
+        request.callback = callback;
+
+        Entry& entry = cache[address];
+
+        if (!entry.addresses.empty() && std::chrono::steady_clock::now() < entry.expiryTime)
+        {
+            std::shared_ptr<Resolver*> resolver = self;
+            std::vector<std::pair<uint32_t, uint16_t>> addresses = entry.addresses;
+
+            network.post([resolver, requestId, addresses]() {
+                if (*resolver) (*resolver)->complete(requestId, addresses);
+            });
+
+            return requestId;
+        }
+
+        entry.requestIds.push_back(requestId);
+
+        if (!entry.resolving)
+        {
+            entry.resolving = true;
+
+            // started on the first request, because the relay is created before the process daemonizes and fork keeps only the calling thread
+            if (!thread.joinable())
+            {
+                SignalBlocker signalBlocker;
+                thread = std::thread(&Resolver::run, this);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                queue.push_back(address);
+            }
+
+            queueCondition.notify_one();
+        }
+
+        return requestId;
+    }
+
+    void Resolver::cancel(uint64_t requestId)
+    {
+        requests.erase(requestId);
+    }
+
+    void Resolver::run()
+    {
+        for (;;)
+        {
+            std::string address;
+
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueCondition.wait(lock, [this]() { return stopping || !queue.empty(); });
+
+                if (stopping) break;
+
+                address = queue.front();
+                queue.pop_front();
+            }
+
+            std::vector<std::pair<uint32_t, uint16_t>> addresses;
+            Socket::getAddresses(address, addresses);
+
+            std::shared_ptr<Resolver*> resolver = self;
+
+            network.post([resolver, address, addresses]() {
+                if (*resolver) (*resolver)->handleResult(address, addresses);
+            });
+        }
+    }
+
+    void Resolver::handleResult(const std::string& address, const std::vector<std::pair<uint32_t, uint16_t>>& addresses)
+    {
+        Entry& entry = cache[address];
+        entry.resolving = false;
+
+        if (!addresses.empty())
+        {
+            std::string addressesString;
+            for (const std::pair<uint32_t, uint16_t>& a : addresses)
+            {
+                if (!addressesString.empty()) addressesString += ", ";
+                addressesString += ipToString(a.first) + ":" + std::to_string(a.second);
+            }
+
+            Log(Log::Level::INFO) << "Resolved " << address << " to " << addressesString;
+
+            entry.addresses = addresses;
+            entry.expiryTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<int64_t>(ttl * 1000.0f));
+        }
+        else if (!entry.addresses.empty())
+        {
+            // the expired records are better than nothing while the resolver fails, they are retried on the next request
+            Log(Log::Level::WARN) << "Failed to resolve " << address << ", using the previous addresses";
+        }
+
+        std::vector<uint64_t> requestIds;
+        requestIds.swap(entry.requestIds);
+        std::vector<std::pair<uint32_t, uint16_t>> result = entry.addresses;
+
+        for (uint64_t requestId : requestIds)
+        {
+            complete(requestId, result);
+        }
+    }
+
+    void Resolver::complete(uint64_t requestId, const std::vector<std::pair<uint32_t, uint16_t>>& addresses)
+    {
+        auto i = requests.find(requestId);
+        if (i == requests.end()) return;
+
+        Callback callback = i->second.callback;
+        requests.erase(i);
+
+        callback(addresses);
+    }
+}
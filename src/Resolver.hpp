@@ -0,0 +1,90 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace relay
+{
+    class Network;
+
+    // resolves host names on a worker thread and caches the results, the results are delivered through
+    // Network::post, so resolve, cancel and the callbacks all run on the network's thread
+    class Resolver
+    {
+    public:
+        static constexpr float DEFAULT_TTL = 60.0f;
+
+        // empty if the name could not be resolved
+        typedef std::function<void(const std::vector<std::pair<uint32_t, uint16_t>>& addresses)> Callback;
+
+        Resolver(Network& aNetwork);
+        ~Resolver();
+
+        Resolver(const Resolver&) = delete;
+        Resolver& operator=(const Resolver&) = delete;
+        Resolver(Resolver&&) = delete;
+        Resolver& operator=(Resolver&&) = delete;
+
+        // getaddrinfo does not report the TTL of the records, so results are cached for this many seconds
+        void setTtl(float newTtl) { ttl = newTtl; }
+        float getTtl() const { return ttl; }
+
+        // address is "host:port", the callback is never called from inside resolve, returns the ID of the request
+        uint64_t resolve(const std::string& address, const Callback& callback);
+        // the callback of the request will not be called
+        void cancel(uint64_t requestId);
+
+        size_t getPendingCount() const { return requests.size(); }
+
+    private:
+        struct Request
+        {
+            std::string address;
+            Callback callback;
+        };
+
+        struct Entry
+        {
+            std::vector<std::pair<uint32_t, uint16_t>> addresses;
+            std::chrono::steady_clock::time_point expiryTime;
+            bool resolving = false;
+            std::vector<uint64_t> requestIds;
+        };
+
+        void run();
+        void handleResult(const std::string& address, const std::vector<std::pair<uint32_t, uint16_t>>& addresses);
+        void complete(uint64_t requestId, const std::vector<std::pair<uint32_t, uint16_t>>& addresses);
+
+        Network& network;
+        float ttl = DEFAULT_TTL;
+
+        // completions posted to the network check it, so they do nothing after the resolver is deleted
+        std::shared_ptr<Resolver*> self;
+
+        // accessed only from the network's thread
+        uint64_t lastRequestId = 0;
+        std::map<uint64_t, Request> requests;
+        std::map<std::string, Entry> cache;
+
+        // shared with the worker thread
+        std::mutex queueMutex;
+        std::condition_variable queueCondition;
+        std::deque<std::string> queue;
+        bool stopping = false;
+        std::thread thread;
+    };
+}
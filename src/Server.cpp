@@ -2,8 +2,11 @@
 //  rtmp_relay
 //
 
+#include <algorithm>
 #include "Server.hpp"
 #include "Relay.hpp"
+#include "Json.hpp"
+#include "Log.hpp"
 
 namespace relay
 {
@@ -13,6 +16,8 @@ namespace relay
         id(Relay::nextId()),
         network(aNetwork)
     {
+        idString = "[SRV:" + std::to_string(id) + "] ";
+        MetricsWriter::appendLabel(metricLabels, "server", std::to_string(id));
     }
 
     void Server::stop()
@@ -56,17 +61,7 @@ namespace relay
 
     void Server::deleteConnection(Connection* connection)
     {
-        for (auto i = connections.begin(); i != connections.end();)
-        {
-            if (i->get() == connection)
-            {
-                i = connections.erase(i);
-            }
-            else
-            {
-                ++i;
-            }
-        }
+        connections.remove(*connection);
     }
 
     Stream* Server::createStream(const std::string& applicationName,
@@ -81,89 +76,150 @@ namespace relay
 
     void Server::deleteStream(Stream* stream)
     {
-        for (auto i = streams.begin(); i != streams.end();)
+        auto i = std::find(closedStreams.begin(), closedStreams.end(), stream);
+        if (i != closedStreams.end()) closedStreams.erase(i);
+
+        streams.remove(*stream);
+    }
+
+    void Server::start(const std::vector<Endpoint>& aEndpoints)
+    {
+        endpoints.assign(aEndpoints.begin(), aEndpoints.end());
+
+        for (const Endpoint& endpoint : endpoints)
+        {
+            startEndpoint(endpoint);
+        }
+    }
+
+    void Server::startEndpoint(const Endpoint& endpoint)
+    {
+        if (endpoint.connectionType == Connection::Type::CLIENT &&
+            endpoint.direction == Connection::Direction::INPUT &&
+            endpoint.isNameKnown())
         {
-            if (i->get() == stream)
+            Stream* stream = createStream(endpoint.applicationName,
+                                          endpoint.streamName);
+
+            std::unique_ptr<Connection> connection(new Connection(relay,
+                                                                  *stream,
+                                                                  endpoint));
+
+            connection->setStream(stream);
+            stream->addConnection(*connection);
+
+            connection->connect();
+
+            connections.push_back(std::move(connection));
+        }
+    }
+
+    void Server::reload(const std::vector<Endpoint>& newEndpoints, std::list<Endpoint>& removedEndpoints)
+    {
+        std::list<Endpoint> currentEndpoints;
+        std::vector<const Endpoint*> addedEndpoints;
+
+        // unchanged endpoints are spliced over, so the connections keep pointing to them
+        for (const Endpoint& newEndpoint : newEndpoints)
+        {
+            auto i = std::find(endpoints.begin(), endpoints.end(), newEndpoint);
+
+            if (i != endpoints.end())
             {
-                i = streams.erase(i);
+                currentEndpoints.splice(currentEndpoints.end(), endpoints, i);
             }
             else
             {
-                ++i;
+                currentEndpoints.push_back(newEndpoint);
+                addedEndpoints.push_back(&currentEndpoints.back());
             }
         }
-    }
 
-    void Server::start(const std::vector<Endpoint>& aEndpoints)
-    {
-        endpoints = aEndpoints;
+        size_t removedCount = endpoints.size();
+        removedEndpoints.splice(removedEndpoints.end(), endpoints);
+        endpoints.swap(currentEndpoints);
 
-        for (const Endpoint& endpoint : endpoints)
-        {
-            if (endpoint.connectionType == Connection::Type::CLIENT &&
-                endpoint.direction == Connection::Direction::INPUT &&
-                endpoint.isNameKnown())
-            {
-                Socket socket(network);
+        if (removedCount == 0 && addedEndpoints.empty()) return;
 
-                Stream* stream = createStream(endpoint.applicationName,
-                                              endpoint.streamName);
+        Log(Log::Level::INFO) << idString << "Reload, " << addedEndpoints.size() << " endpoints added, " << removedCount << " removed";
 
-                std::unique_ptr<Connection> connection(new Connection(relay,
-                                                                      *stream,
-                                                                      endpoint));
+        for (size_t i = 0; i < connections.size();)
+        {
+            Connection* connection = connections[i].get();
+            const Endpoint* endpoint = connection->getEndpoint();
 
-                connection->setStream(stream);
+            if (std::find_if(removedEndpoints.begin(), removedEndpoints.end(),
+                             [endpoint](const Endpoint& e) { return &e == endpoint; }) != removedEndpoints.end())
+            {
+                Stream* stream = connection->getStream();
+                connection->close(true);
+                if (stream) stream->removeConnection(*connection);
 
-                connection->connect();
+                connections.removeAt(i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
 
-                connections.push_back(std::move(connection));
+        for (const Endpoint* endpoint : addedEndpoints)
+        {
+            for (const auto& stream : streams)
+            {
+                stream->startEndpoint(*endpoint);
             }
+
+            startEndpoint(*endpoint);
         }
     }
 
     void Server::update(float delta)
     {
-        for (auto i = connections.begin(); i != connections.end();)
-        {
-            i = ((*i)->isClosed() ? connections.erase(i) : i + 1);
-        }
+        // only the streams that were closed since the last update are visited
+        std::vector<Stream*> closed;
+        closed.swap(closedStreams);
 
-        for (auto si = streams.begin(); si != streams.end();)
+        for (Stream* stream : closed)
         {
-            si = ((*si)->isClosed() ? streams.erase(si) : si + 1);
+            streams.remove(*stream);
         }
 
-        // update connections
-        for (auto i = connections.begin(); i != connections.end();)
+        // closed connections are removed in the same pass that updates the others
+        for (size_t i = 0; i < connections.size();)
         {
-            const std::unique_ptr<Connection>& connection = *i;
+            Connection* connection = connections[i].get();
 
             if (connection->isClosed())
             {
-                i = connections.erase(i);
-                continue;
+                connections.removeAt(i);
             }
             else
             {
+                connection->update(delta);
                 ++i;
             }
-
-            connection->update(delta);
         }
     }
 
-    void Server::getConnections(std::map<Connection*, Stream*>& cons)
+    void Server::getConnections(std::vector<Connection*>& result) const
     {
-        for (auto& c : connections)
+        for (const auto& connection : connections)
         {
-            cons[c.get()] = c->getStream();
+            result.push_back(connection.get());
         }
+    }
 
-        for (auto& s : streams)
+    size_t Server::getPendingReconnectCount() const
+    {
+        size_t count = 0;
+
+        for (const auto& connection : connections)
         {
-            s->getConnections(cons);
+            if (connection->isReconnectPending()) ++count;
         }
+
+        return count;
     }
 
     void Server::getStats(std::string& str, ReportType reportType) const
@@ -193,15 +249,20 @@ namespace relay
             }
             case ReportType::JSON:
             {
-                bool first = true;
-                for (const auto& c : connections)
-                {
-                    if (!first) str += ",";
-                    first = false;
-                    c->getStats(str, reportType);
-                }
+                JsonWriter writer(str);
+                writer.beginArray();
+                getStats(writer);
+                writer.endArray();
                 break;
             }
         }
     }
+
+    void Server::getStats(JsonWriter& writer) const
+    {
+        for (const auto& c : connections)
+        {
+            c->getStats(writer);
+        }
+    }
 }
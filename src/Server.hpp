@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <list>
+#include <memory>
 #include <vector>
 #include "Connection.hpp"
 #include "Endpoint.hpp"
@@ -11,6 +13,8 @@
 
 namespace relay
 {
+    class JsonWriter;
+
     class Server
     {
     public:
@@ -33,13 +37,25 @@ namespace relay
         void deleteStream(Stream* stream);
 
         void start(const std::vector<Endpoint>& aEndpoints);
+        // keeps the endpoints that did not change and their connections, closes the client connections of removed endpoints
+        // and starts the ones of added endpoints, removed endpoints are moved to removedEndpoints so that the caller
+        // can close the host connections that point to them before they are deleted
+        void reload(const std::vector<Endpoint>& newEndpoints, std::list<Endpoint>& removedEndpoints);
 
         void update(float delta);
         void getStats(std::string& str, ReportType reportType) const;
-
-        const std::vector<Endpoint>& getEndpoints() const { return endpoints; }
-        void cleanup() { needsCleanup = true; }
-        void getConnections(std::map<Connection*, Stream*>& cons);
+        // writes the connections into an array opened by the caller
+        void getStats(JsonWriter& writer) const;
+
+        const std::list<Endpoint>& getEndpoints() const { return endpoints; }
+        // the stream is deleted in the next update
+        void streamClosed(Stream& stream) { closedStreams.push_back(&stream); }
+        const SlotVector<Stream, &Stream::serverSlot, std::unique_ptr<Stream>>& getStreams() const { return streams; }
+        size_t getClientConnectionCount() const { return connections.size(); }
+        // appends the client connections
+        void getConnections(std::vector<Connection*>& result) const;
+        size_t getPendingReconnectCount() const;
+        const std::string& getMetricLabels() const { return metricLabels; }
 
         void stop();
 
@@ -48,13 +64,16 @@ namespace relay
         const uint64_t id;
 
         Network& network;
-        std::vector<Endpoint> endpoints;
+        std::string idString;
+        std::list<Endpoint> endpoints; // connections point to the endpoints, so they must not move
 
-        std::vector<std::unique_ptr<Stream>> streams;
-        std::vector<std::unique_ptr<Connection>> connections;
+        SlotVector<Stream, &Stream::serverSlot, std::unique_ptr<Stream>> streams;
+        SlotVector<Connection, &Connection::ownerSlot, std::unique_ptr<Connection>> connections;
+        std::vector<Stream*> closedStreams;
 
-        bool needsCleanup = false;
+        std::string metricLabels;
 
         void deleteConnection(Connection* connection);
+        void startEndpoint(const Endpoint& endpoint);
     };
 }
@@ -0,0 +1,49 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace relay
+{
+    class Sha256
+    {
+    public:
+        static const size_t BLOCK_SIZE = 64;
+        static const size_t DIGEST_SIZE = 32;
+
+        Sha256();
+
+        void update(const uint8_t* data, size_t size);
+        void finish(uint8_t* digest);
+
+    private:
+        void transform(const uint8_t* block);
+
+        uint32_t state[8];
+        uint64_t length = 0;
+        uint8_t buffer[BLOCK_SIZE];
+        size_t bufferSize = 0;
+    };
+
+    // the hash states after the inner and outer padded key blocks are computed once in the constructor,
+    // so every digest with the same key costs two compressions less and no key processing
+    class HmacSha256
+    {
+    public:
+        HmacSha256(const uint8_t* key, size_t size);
+
+        // for messages that are not contiguous, update the hash returned by begin and pass it to finish
+        Sha256 begin() const { return inner; }
+        void finish(Sha256& hash, uint8_t* digest) const;
+
+        void compute(const uint8_t* data, size_t size, uint8_t* digest) const;
+
+    private:
+        Sha256 inner;
+        Sha256 outer;
+    };
+}
@@ -0,0 +1,91 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace relay
+{
+    static const size_t NO_SLOT = static_cast<size_t>(-1);
+
+    // vector of pointers whose elements store their own position in Slot, so they are found and removed in O(1):
+    // removing moves the last element into the freed slot, so the order of the elements is not kept.
+    // Pointer can be a raw or a unique pointer, an element can be in one vector per slot member at a time.
+    // The destructor does not touch the elements, raw pointers may already be dangling by then
+    template<class T, size_t T::* Slot, class Pointer = T*>
+    class SlotVector
+    {
+    public:
+        typedef typename std::vector<Pointer>::iterator iterator;
+        typedef typename std::vector<Pointer>::const_iterator const_iterator;
+
+        SlotVector() {}
+
+        SlotVector(const SlotVector&) = delete;
+        SlotVector& operator=(const SlotVector&) = delete;
+
+        iterator begin() { return elements.begin(); }
+        iterator end() { return elements.end(); }
+        const_iterator begin() const { return elements.begin(); }
+        const_iterator end() const { return elements.end(); }
+
+        size_t size() const { return elements.size(); }
+        bool empty() const { return elements.empty(); }
+
+        const Pointer& operator[](size_t slot) const { return elements[slot]; }
+
+        bool contains(const T& element) const
+        {
+            size_t slot = element.*Slot;
+            return slot < elements.size() && &*elements[slot] == &element;
+        }
+
+        void push_back(Pointer element)
+        {
+            (*element).*Slot = elements.size();
+            elements.push_back(std::move(element));
+        }
+
+        // returns false if the element is not in the vector, a unique pointer deletes it
+        bool remove(const T& element)
+        {
+            if (!contains(element)) return false;
+
+            removeAt(element.*Slot);
+            return true;
+        }
+
+        void removeAt(size_t slot)
+        {
+            // the element is deleted after the vector is consistent again, in case its destructor uses the vector
+            Pointer removed = std::move(elements[slot]);
+            (*removed).*Slot = NO_SLOT;
+
+            if (slot + 1 < elements.size())
+            {
+                elements[slot] = std::move(elements.back());
+                (*elements[slot]).*Slot = slot;
+            }
+
+            elements.pop_back();
+        }
+
+        void clear()
+        {
+            for (Pointer& element : elements)
+            {
+                (*element).*Slot = NO_SLOT;
+            }
+
+            std::vector<Pointer> removed;
+            removed.swap(elements);
+        }
+
+    private:
+        std::vector<Pointer> elements;
+    };
+}
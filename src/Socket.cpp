@@ -14,16 +14,19 @@
 #  include <netdb.h>
 #  include <unistd.h>
 #endif
+#include <algorithm>
 #include <cstring>
 #include <fcntl.h>
 #include "Socket.hpp"
+#include "BufferPool.hpp"
 #include "Network.hpp"
+#include "Histogram.hpp"
+#include "Profiler.hpp"
 #include "Log.hpp"
 
 namespace relay
 {
     static const int WAITING_QUEUE_SIZE = 5;
-    static uint8_t TEMP_BUFFER[65536];
 
 #ifdef _WIN32
     static inline bool initWSA()
@@ -53,6 +56,18 @@ namespace relay
         result.first = ANY_ADDRESS;
         result.second = ANY_PORT;
 
+        std::vector<std::pair<uint32_t, uint16_t>> addresses;
+        if (!getAddresses(address, addresses)) return false;
+
+        result = addresses.front();
+
+        return true;
+    }
+
+    bool Socket::getAddresses(const std::string& address, std::vector<std::pair<uint32_t, uint16_t>>& result)
+    {
+        result.clear();
+
         size_t i = address.find(':');
         std::string addressStr;
         std::string portStr;
@@ -67,15 +82,20 @@ namespace relay
             addressStr = address;
         }
 
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+
         addrinfo* info;
-        int ret = getaddrinfo(addressStr.c_str(), portStr.empty() ? nullptr : portStr.c_str(), nullptr, &info);
+        int ret = getaddrinfo(addressStr.c_str(), portStr.empty() ? nullptr : portStr.c_str(), &hints, &info);
 
 #ifdef _WIN32
         if (ret != 0 && WSAGetLastError() == WSANOTINITIALISED)
         {
             if (!initWSA()) return false;
 
-            ret = getaddrinfo(addressStr.c_str(), portStr.empty() ? nullptr : portStr.c_str(), nullptr, &info);
+            ret = getaddrinfo(addressStr.c_str(), portStr.empty() ? nullptr : portStr.c_str(), &hints, &info);
         }
 #endif
 
@@ -86,13 +106,20 @@ namespace relay
             return false;
         }
 
-        sockaddr_in* addr = reinterpret_cast<sockaddr_in*>(info->ai_addr);
-        result.first = addr->sin_addr.s_addr;
-        result.second = ntohs(addr->sin_port);
+        for (addrinfo* current = info; current; current = current->ai_next)
+        {
+            sockaddr_in* addr = reinterpret_cast<sockaddr_in*>(current->ai_addr);
+            std::pair<uint32_t, uint16_t> entry(addr->sin_addr.s_addr, ntohs(addr->sin_port));
+
+            if (std::find(result.begin(), result.end(), entry) == result.end())
+            {
+                result.push_back(entry);
+            }
+        }
 
         freeaddrinfo(info);
 
-        return true;
+        return !result.empty();
     }
 
     Socket::Socket(Network& aNetwork):
@@ -118,6 +145,7 @@ namespace relay
 
         writeData();
         closeSocketFd();
+        clearOutData();
     }
 
     Socket::Socket(Socket&& other):
@@ -137,7 +165,10 @@ namespace relay
         acceptCallback(std::move(other.acceptCallback)),
         connectCallback(std::move(other.connectCallback)),
         connectErrorCallback(std::move(other.connectErrorCallback)),
-        outData(std::move(other.outData))
+        outData(std::move(other.outData)),
+        writtenBytes(other.writtenBytes),
+        ingestMarkers(std::move(other.ingestMarkers)),
+        ingestMarkerIndex(other.ingestMarkerIndex)
     {
         network.addSocket(*this);
 
@@ -152,6 +183,8 @@ namespace relay
         other.connecting = false;
         other.connectTimeout = 10.0f;
         other.timeSinceConnect = 0.0f;
+        other.ingestMarkers.clear();
+        other.ingestMarkerIndex = 0;
     }
 
     Socket& Socket::operator=(Socket&& other)
@@ -173,7 +206,13 @@ namespace relay
         acceptCallback = std::move(other.acceptCallback);
         connectCallback = std::move(other.connectCallback);
         connectErrorCallback = std::move(other.connectErrorCallback);
+        clearOutData();
         outData = std::move(other.outData);
+        writtenBytes = other.writtenBytes;
+        ingestMarkers = std::move(other.ingestMarkers);
+        ingestMarkerIndex = other.ingestMarkerIndex;
+        other.ingestMarkers.clear();
+        other.ingestMarkerIndex = 0;
 
         remoteAddressString = ipToString(remoteIPAddress) + ":" + std::to_string(remotePort);
 
@@ -215,8 +254,7 @@ namespace relay
         ready = false;
         accepting = false;
         connecting = false;
-        outData.clear();
-        inData.clear();
+        clearOutData();
 
         return result;
     }
@@ -523,18 +561,45 @@ namespace relay
         return true;
     }
 
-    bool Socket::send(std::vector<uint8_t> buffer)
+    bool Socket::send(const std::vector<uint8_t>& buffer)
     {
         if (socketFd == INVALID_SOCKET)
         {
             return false;
         }
 
+        BufferPool::reserve(outData, outData.size() + buffer.size());
         outData.insert(outData.end(), buffer.begin(), buffer.end());
+        network.queuedBytes += buffer.size();
 
         return true;
     }
 
+    uint8_t* Socket::prepareSend(size_t size)
+    {
+        if (socketFd == INVALID_SOCKET)
+        {
+            return nullptr;
+        }
+
+        size_t offset = outData.size();
+        BufferPool::reserve(outData, offset + size);
+        outData.resize(offset + size);
+        network.queuedBytes += size;
+
+        return outData.data() + offset;
+    }
+
+    void Socket::markIngestTime(std::chrono::steady_clock::time_point ingestTime)
+    {
+        if (!latencyHistogram || outData.empty()) return;
+
+        IngestMarker marker;
+        marker.end = writtenBytes + outData.size();
+        marker.ingestTime = ingestTime;
+        ingestMarkers.push_back(marker);
+    }
+
     bool Socket::read()
     {
         if (accepting)
@@ -607,6 +672,8 @@ namespace relay
 
     bool Socket::readData()
     {
+        RELAY_PROFILE_SCOPE(SOCKET_READ);
+
 #if defined(__APPLE__)
         int flags = 0;
 #elif defined(_WIN32)
@@ -616,9 +683,9 @@ namespace relay
 #endif
 
 #ifdef _WIN32
-        int size = recv(socketFd, reinterpret_cast<char*>(TEMP_BUFFER), sizeof(TEMP_BUFFER), flags);
+        int size = recv(socketFd, reinterpret_cast<char*>(network.readBuffer.data()), static_cast<int>(network.readBuffer.size()), flags);
 #else
-        ssize_t size = recv(socketFd, reinterpret_cast<char*>(TEMP_BUFFER), sizeof(TEMP_BUFFER), flags);
+        ssize_t size = recv(socketFd, reinterpret_cast<char*>(network.readBuffer.data()), network.readBuffer.size(), flags);
 #endif
 
         if (size < 0)
@@ -660,13 +727,17 @@ namespace relay
             return true;
         }
 
-        Log(Log::Level::ALL) << "Socket received " << size << " bytes from " << remoteAddressString;
-
-        inData.assign(TEMP_BUFFER, TEMP_BUFFER + size);
+        RELAY_LOG(Log::Level::ALL) << "Socket received " << size << " bytes from " << remoteAddressString;
 
         if (readCallback)
         {
+            // a local buffer, the callback may move or close this socket
+            std::vector<uint8_t> inData = BufferPool::acquire(static_cast<size_t>(size));
+            inData.assign(network.readBuffer.data(), network.readBuffer.data() + size);
+
             readCallback(*this, inData);
+
+            BufferPool::release(std::move(inData));
         }
         
         return true;
@@ -674,6 +745,8 @@ namespace relay
 
     bool Socket::writeData()
     {
+        RELAY_PROFILE_SCOPE(SOCKET_WRITE);
+
         if (ready && !outData.empty())
         {
 #if defined(__APPLE__)
@@ -725,22 +798,63 @@ namespace relay
             }
             else if (size != dataSize)
             {
-                Log(Log::Level::ALL) << "Socket did not send all data to " << remoteAddressString << ", sent " << size << " out of " << outData.size() << " bytes";
+                RELAY_LOG(Log::Level::ALL) << "Socket did not send all data to " << remoteAddressString << ", sent " << size << " out of " << outData.size() << " bytes";
             }
             else
             {
-                Log(Log::Level::ALL) << "Socket sent " << size << " bytes to " << remoteAddressString;
+                RELAY_LOG(Log::Level::ALL) << "Socket sent " << size << " bytes to " << remoteAddressString;
             }
 
             if (size > 0)
             {
                 outData.erase(outData.begin(), outData.begin() + size);
+                BufferPool::shrink(outData, keepCapacity);
+                network.queuedBytes -= static_cast<uint64_t>(size);
+                writtenBytes += static_cast<uint64_t>(size);
+
+                if (ingestMarkerIndex < ingestMarkers.size())
+                {
+                    auto currentTime = std::chrono::steady_clock::now();
+
+                    while (ingestMarkerIndex < ingestMarkers.size() &&
+                           ingestMarkers[ingestMarkerIndex].end <= writtenBytes)
+                    {
+                        if (latencyHistogram)
+                        {
+                            latencyHistogram->record(LatencyHistogram::getMicroseconds(ingestMarkers[ingestMarkerIndex].ingestTime, currentTime));
+                        }
+                        ++ingestMarkerIndex;
+                    }
+
+                    if (ingestMarkerIndex == ingestMarkers.size())
+                    {
+                        ingestMarkers.clear();
+                        ingestMarkerIndex = 0;
+                    }
+                    else if (ingestMarkerIndex >= 64 && ingestMarkerIndex * 2 >= ingestMarkers.size())
+                    {
+                        // an output that never catches up would otherwise grow the markers forever
+                        ingestMarkers.erase(ingestMarkers.begin(), ingestMarkers.begin() + static_cast<std::vector<IngestMarker>::difference_type>(ingestMarkerIndex));
+                        ingestMarkerIndex = 0;
+                    }
+                }
             }
         }
         
         return true;
     }
 
+    void Socket::clearOutData()
+    {
+        network.queuedBytes -= outData.size();
+        writtenBytes += outData.size();
+        outData.clear();
+        BufferPool::shrink(outData, keepCapacity);
+        // data that is never written has no egress latency
+        ingestMarkers.clear();
+        ingestMarkerIndex = 0;
+    }
+
     bool Socket::disconnected()
     {
         bool result = true;
@@ -791,7 +905,7 @@ namespace relay
                 remoteIPAddress = 0;
                 remotePort = 0;
                 ready = false;
-                outData.clear();
+                clearOutData();
             }
         }
 
@@ -4,10 +4,12 @@
 
 #pragma once
 
+#include <chrono>
 #include <vector>
 #include <functional>
 #include <cstdint>
 #include <string>
+#include "BufferPool.hpp"
 
 #ifdef _WIN32
 #  define WIN32_LEAN_AND_MEAN
@@ -47,12 +49,15 @@ namespace relay
     }
 
     class Network;
+    class LatencyHistogram;
 
     class Socket
     {
         friend Network;
     public:
         static bool getAddress(const std::string& address, std::pair<uint32_t, uint16_t>& result);
+        // all IPv4 addresses of the host, blocks until the name is resolved
+        static bool getAddresses(const std::string& address, std::vector<std::pair<uint32_t, uint16_t>>& result);
 
         Socket(Network& aNetwork);
         virtual ~Socket();
@@ -83,7 +88,18 @@ namespace relay
         void setConnectCallback(const std::function<void(Socket&)>& newConnectCallback);
         void setConnectErrorCallback(const std::function<void(Socket&)>& newConnectErrorCallback);
 
-        bool send(std::vector<uint8_t> buffer);
+        bool send(const std::vector<uint8_t>& buffer);
+        // appends size bytes to the send buffer to be filled in by the caller, the pointer is valid until the next send,
+        // returns nullptr if the socket is closed
+        uint8_t* prepareSend(size_t size);
+
+        // once everything queued so far is written, the time since ingestTime is recorded in the latency histogram
+        void markIngestTime(std::chrono::steady_clock::time_point ingestTime);
+        // the histogram is owned by the caller and is not transferred when the socket is moved
+        void setLatencyHistogram(LatencyHistogram* histogram) { latencyHistogram = histogram; }
+        // an empty output buffer with a larger capacity is returned to the buffer pool, BufferPool::KEEP_CAPACITY by
+        // default, not transferred when the socket is moved
+        void setKeepCapacity(size_t newKeepCapacity) { keepCapacity = newKeepCapacity; }
 
         uint32_t getLocalIPAddress() const { return localIPAddress; }
         uint16_t getLocalPort() const { return localPort; }
@@ -94,6 +110,8 @@ namespace relay
         bool isReady() const { return ready; }
 
         bool hasOutData() const { return !outData.empty(); }
+        size_t getQueuedBytes() const { return outData.size(); }
+        size_t getQueueCapacity() const { return outData.capacity(); }
 
     protected:
         Socket(Network& aNetwork, socket_t aSocketFd, bool aReady,
@@ -105,6 +123,7 @@ namespace relay
 
         bool readData();
         bool writeData();
+        void clearOutData();
 
         bool disconnected();
 
@@ -134,8 +153,19 @@ namespace relay
         std::function<void(Socket&)> connectCallback;
         std::function<void(Socket&)> connectErrorCallback;
 
-        std::vector<uint8_t> inData;
         std::vector<uint8_t> outData;
+        size_t keepCapacity = BufferPool::KEEP_CAPACITY;
+
+        struct IngestMarker
+        {
+            uint64_t end; // position in the output stream, counted from writtenBytes
+            std::chrono::steady_clock::time_point ingestTime;
+        };
+
+        LatencyHistogram* latencyHistogram = nullptr;
+        uint64_t writtenBytes = 0;
+        std::vector<IngestMarker> ingestMarkers;
+        size_t ingestMarkerIndex = 0;
 
         std::string remoteAddressString;
     };
@@ -2,39 +2,161 @@
 //  rtmp_relay
 //
 
+#include <chrono>
 #include "Status.hpp"
+#include "BufferPool.hpp"
 #include "Relay.hpp"
 #include "StatusSender.hpp"
+#include "Utils.hpp"
+#include "Log.hpp"
 
 namespace relay
 {
-    Status::Status(Network& aNetwork, Relay& aRelay, const std::string& address):
-        network(aNetwork), socket(aNetwork), relay(aRelay)
+    Status::Status(Relay& aRelay, const std::string& address, float aUpdateInterval, uint32_t aMaxConnections):
+        relay(aRelay),
+        updateInterval(aUpdateInterval),
+        maxConnections(aMaxConnections),
+        timeSinceUpdate(aUpdateInterval), // publish on the first update
+        snapshot(std::make_shared<StatusSnapshot>()),
+        socket(network),
+        running(true)
     {
         //socket.setConnectTimeout(connectionTimeout);
         socket.setAcceptCallback(std::bind(&Status::handleAccept, this, std::placeholders::_1, std::placeholders::_2));
 
         socket.startAccept(address);
+
+        SignalBlocker signalBlocker;
+        thread = std::thread(&Status::run, this);
+    }
+
+    Status::~Status()
+    {
+        running = false;
+        if (thread.joinable()) thread.join();
+    }
+
+    void Status::update(float delta)
+    {
+        timeSinceUpdate += delta;
+
+        if (timeSinceUpdate >= updateInterval)
+        {
+            timeSinceUpdate = 0.0f;
+            // formats nobody asked for during the interval are dropped instead of being refreshed
+            publishSnapshot(requestedFormats.exchange(0), false);
+        }
+        else if (uint32_t missingFormats = requestedFormats.load() & ~publishedFormats)
+        {
+            // the other requested formats stay pending until the end of the interval
+            requestedFormats &= ~missingFormats;
+            publishSnapshot(missingFormats, true);
+        }
+    }
+
+    std::shared_ptr<const StatusSnapshot> Status::getSnapshot() const
+    {
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        return snapshot;
+    }
+
+    void Status::publishSnapshot(uint32_t formats, bool keepReports)
+    {
+        // nothing was requested and nothing is published, so there is nothing to drop either
+        if (!formats && !publishedFormats) return;
+
+        std::shared_ptr<const StatusSnapshot> previousSnapshot = getSnapshot();
+        std::shared_ptr<StatusSnapshot> newSnapshot = std::make_shared<StatusSnapshot>();
+
+        publishedFormats = 0;
+
+        for (uint32_t format = 0; format < StatusSnapshot::FORMAT_COUNT; ++format)
+        {
+            if (formats & (1u << format))
+            {
+                std::shared_ptr<std::string> report = std::make_shared<std::string>();
+
+                // reports are usually about the same size as last time
+                report->reserve(reportSizes[format]);
+
+                switch (format)
+                {
+                    case StatusSnapshot::TEXT: relay.getStats(*report, ReportType::TEXT); break;
+                    case StatusSnapshot::HTML: relay.getStats(*report, ReportType::HTML); break;
+                    case StatusSnapshot::JSON: relay.getStats(*report, ReportType::JSON); break;
+                    case StatusSnapshot::METRICS: relay.getMetrics(*report); break;
+                }
+
+                reportSizes[format] = report->size();
+                newSnapshot->reports[format] = std::move(report);
+            }
+            else if (keepReports)
+            {
+                newSnapshot->reports[format] = previousSnapshot->reports[format];
+            }
+
+            if (newSnapshot->reports[format]) publishedFormats |= 1u << format;
+        }
+
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        snapshot = std::move(newSnapshot);
     }
 
-    void Status::update(float)
+    void Status::run()
     {
-        for (auto i = statusSenders.begin(); i != statusSenders.end();)
+        const std::chrono::microseconds sleepTime(5000);
+        auto previousTime = std::chrono::steady_clock::now();
+        float timeSinceTrim = 0.0f;
+
+        while (running)
         {
-            if ((*i)->isConnected())
+            auto currentTime = std::chrono::steady_clock::now();
+            float delta = std::chrono::duration_cast<std::chrono::microseconds>(currentTime - previousTime).count() / 1000000.0f;
+            previousTime = currentTime;
+
+            network.update();
+
+            for (auto i = statusSenders.begin(); i != statusSenders.end();)
             {
-                ++i;
+                (*i)->update(delta);
+
+                if ((*i)->isConnected())
+                {
+                    ++i;
+                }
+                else
+                {
+                    i = statusSenders.erase(i);
+                }
             }
-            else
+
+            // the status page writes through sockets too, so this thread has its own buffer cache
+            timeSinceTrim += delta;
+            if (timeSinceTrim >= BufferPool::TRIM_INTERVAL)
             {
-                i = statusSenders.erase(i);
+                timeSinceTrim = 0.0f;
+                BufferPool::trim();
             }
+
+            std::this_thread::sleep_for(sleepTime);
         }
     }
 
     void Status::handleAccept(Socket&, Socket& clientSocket)
     {
-        std::unique_ptr<StatusSender> statusSender(new StatusSender(network, clientSocket, relay));
+        if (statusSenders.size() >= maxConnections)
+        {
+            Log(Log::Level::WARN) << "Too many status connections, rejecting " << ipToString(clientSocket.getRemoteIPAddress()) << ":" << clientSocket.getRemotePort();
+
+            static const std::string BUSY = "HTTP/1.1 503 Service Unavailable\r\n"
+                "Content-Length: 0\r\n"
+                "Connection: close\r\n\r\n";
+            clientSocket.send(std::vector<uint8_t>(BUSY.begin(), BUSY.end()));
+            // the accepted socket is closed when it goes out of scope
+            return;
+        }
+
+        std::unique_ptr<StatusSender> statusSender(new StatusSender(network, clientSocket, *this));
         
         statusSenders.push_back(std::move(statusSender));
     }
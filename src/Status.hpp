@@ -4,7 +4,11 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include "Network.hpp"
 #include "StatusSender.hpp"
 
 namespace relay
@@ -18,25 +22,64 @@ namespace relay
         JSON
     };
 
+    // reports generated on the relay thread, never modified after they are published
+    struct StatusSnapshot
+    {
+        enum Format
+        {
+            TEXT,
+            HTML,
+            JSON,
+            METRICS,
+            FORMAT_COUNT
+        };
+
+        // null for the formats that were not requested since the previous update interval
+        std::shared_ptr<const std::string> reports[FORMAT_COUNT];
+    };
+
+    // serves the status page from its own thread and network
     class Status
     {
     public:
-        Status(Network& aNetwork, Relay& aRelay, const std::string& address);
+        Status(Relay& aRelay, const std::string& address, float aUpdateInterval, uint32_t aMaxConnections);
+        ~Status();
 
         Status(const Status&) = delete;
         Status& operator=(const Status&) = delete;
         Status(Status&& other) = delete;
         Status& operator=(Status&& other) = delete;
 
+        // called on the relay thread, publishes a new snapshot every update interval
+        // and as soon as a format that the current one does not have is requested
         void update(float delta);
 
+        std::shared_ptr<const StatusSnapshot> getSnapshot() const;
+        // called on the status thread for every request, only the requested formats are rendered
+        void requestReport(StatusSnapshot::Format format) { requestedFormats |= 1u << format; }
+
     private:
+        void run();
+        void publishSnapshot(uint32_t formats, bool keepReports);
         void handleAccept(Socket& acceptor, Socket& clientSocket);
 
-        Network& network;
-        Socket socket;
         Relay& relay;
+        float updateInterval;
+        uint32_t maxConnections;
+        float timeSinceUpdate;
+
+        mutable std::mutex snapshotMutex;
+        std::shared_ptr<const StatusSnapshot> snapshot;
+        std::atomic<uint32_t> requestedFormats{0}; // bits of StatusSnapshot::Format
+        uint32_t publishedFormats = 0; // used only by the relay thread
+        size_t reportSizes[StatusSnapshot::FORMAT_COUNT] = {}; // of the previous reports, used only by the relay thread
 
+        // used only by the status thread once it is started
+        Network network;
+        Socket socket;
         std::vector<std::unique_ptr<StatusSender>> statusSenders;
+
+        std::atomic<bool> running;
+        std::thread thread;
     };
 }
@@ -3,148 +3,342 @@
 //
 
 #include <algorithm>
+#include <cstring>
+#include <cstdlib>
 #include "StatusSender.hpp"
-#include "Relay.hpp"
+#include "Status.hpp"
 #include "Utils.hpp"
 #include "Log.hpp"
 
 namespace relay
 {
+    static const size_t MAX_HEADER_SIZE = 8192;
+    static const uint64_t MAX_CONTENT_LENGTH = 65536;
+    static const float IDLE_TIMEOUT = 30.0f;
+    // no more requests are parsed while this much of the responses is waiting to be sent
+    static const size_t MAX_QUEUED_BYTES = 1024 * 1024;
+    // input that is not parsed yet, one request with its body always fits
+    static const size_t MAX_BUFFERED_SIZE = MAX_HEADER_SIZE + MAX_CONTENT_LENGTH;
+
+    // case insensitive comparison against a lower case literal
+    static bool equalsLowerCase(const char* str, size_t length, const char* lowerCase)
+    {
+        for (size_t i = 0; i < length; ++i, ++lowerCase)
+        {
+            if (*lowerCase == '\0') return false;
+
+            char c = str[i];
+            if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+            if (c != *lowerCase) return false;
+        }
+
+        return *lowerCase == '\0';
+    }
+
+    static bool containsToken(const char* str, size_t length, const char* lowerCase)
+    {
+        size_t tokenLength = strlen(lowerCase);
+
+        for (size_t i = 0; i + tokenLength <= length; ++i)
+        {
+            if (equalsLowerCase(str + i, tokenLength, lowerCase)) return true;
+        }
+
+        return false;
+    }
+
     StatusSender::StatusSender(Network& aNetwork,
                                Socket& aSocket,
-                               Relay& aRelay):
+                               Status& aStatus):
         network(aNetwork),
         socket(std::move(aSocket)),
-        relay(aRelay)
+        status(aStatus)
     {
         socket.setReadCallback(std::bind(&StatusSender::handleRead, this, std::placeholders::_1, std::placeholders::_2));
         socket.setCloseCallback(std::bind(&StatusSender::handleClose, this, std::placeholders::_1));
     }
 
+    void StatusSender::update(float delta)
+    {
+        timeSinceRequest += delta;
+
+        if (waitingForReport && !closed && sendReport())
+        {
+            waitingForReport = false;
+
+            if (!keepAlive) close();
+        }
+
+        // continue with the requests that arrived while the report was pending or the responses were not read
+        if (!closed && !waitingForReport && !data.empty() && socket.getQueuedBytes() <= MAX_QUEUED_BYTES)
+        {
+            static const std::vector<uint8_t> noData;
+            handleRead(socket, noData);
+        }
+
+        if (closed)
+        {
+            // close once the last response is flushed or the client stops reading it
+            if (socket.isReady() &&
+                (socket.getQueuedBytes() == 0 || timeSinceRequest >= IDLE_TIMEOUT))
+            {
+                socket.close();
+            }
+        }
+        else if (timeSinceRequest >= IDLE_TIMEOUT)
+        {
+            Log(Log::Level::INFO) << "Closing idle status connection";
+            close();
+            socket.close();
+        }
+    }
+
     void StatusSender::handleRead(Socket&, const std::vector<uint8_t>& newData)
     {
-        const std::vector<uint8_t> clrf = {'\r', '\n'};
+        if (closed) return;
 
         data.insert(data.end(), newData.begin(), newData.end());
 
-        for (;;)
+        // pipelined requests are answered in order, so parsing waits for the pending report,
+        // and it waits for the client to read the responses that are queued
+        while (!closed && !waitingForReport && socket.getQueuedBytes() <= MAX_QUEUED_BYTES)
         {
-            auto i = std::search(data.begin(), data.end(), clrf.begin(), clrf.end());
-
-            if (i == data.end())
+            if (state == State::BODY)
             {
-                break;
+                // request bodies are not used, just skip them
+                if (data.size() - offset < contentLength) break;
+
+                offset += static_cast<size_t>(contentLength);
+                searchOffset = offset;
+                handleRequest();
+                continue;
             }
 
-            std::string line(data.begin(), i);
+            const uint8_t* begin = data.data() + offset;
+            const void* end = memchr(data.data() + searchOffset, '\n', data.size() - searchOffset);
 
-            if (line.empty()) // end of header
+            if (!end)
             {
-                if (!startLine.empty()) // received header
+                searchOffset = data.size();
+
+                if (headerSize + (data.size() - offset) > MAX_HEADER_SIZE)
                 {
-                    sendReport();
-                    socket.close();
-                    break;
+                    sendError("431 Request Header Fields Too Large");
+                    close();
                 }
+                break;
             }
-            else
+
+            size_t length = static_cast<size_t>(static_cast<const uint8_t*>(end) - begin);
+            offset += length + 1;
+            searchOffset = offset;
+            headerSize += length + 1;
+
+            if (headerSize > MAX_HEADER_SIZE)
             {
-                if (startLine.empty())
-                {
-                    startLine = line;
-                }
-                else
-                {
-                    headers.push_back(line);
-                }
+                sendError("431 Request Header Fields Too Large");
+                close();
+                break;
             }
 
-            data.erase(data.begin(), i + 2);
+            if (length > 0 && begin[length - 1] == '\r') --length;
+
+            if (!handleLine(reinterpret_cast<const char*>(begin), length))
+            {
+                sendError("400 Bad Request");
+                close();
+                break;
+            }
         }
-    }
 
-    void StatusSender::handleClose(Socket&)
-    {
+        // drop the parsed data once per read instead of once per line
+        if (offset > 0)
+        {
+            data.erase(data.begin(), data.begin() + static_cast<std::vector<uint8_t>::difference_type>(offset));
+            searchOffset -= offset;
+            offset = 0;
+        }
+
+        if (!closed && data.size() > MAX_BUFFERED_SIZE)
+        {
+            Log(Log::Level::WARN) << "Too many unanswered requests on status connection, closing";
+            close();
+            socket.close();
+        }
     }
 
-    void StatusSender::sendReport()
+    bool StatusSender::handleLine(const char* line, size_t length)
     {
-        std::vector<std::string> fields;
-        tokenize(startLine, fields);
+        if (state == State::START_LINE)
+        {
+            if (length == 0) return true; // ignore empty lines between requests
 
-        if (fields.size() >= 2 && fields[0] == "GET")
+            std::vector<std::string> fields;
+            tokenize(std::string(line, length), fields, " ", true);
+
+            if (fields.size() != 3) return false;
+
+            method = fields[0];
+            path = fields[1];
+            // HTTP/1.1 connections are persistent unless the client asks otherwise
+            keepAlive = (fields[2] == "HTTP/1.1");
+            contentLength = 0;
+            state = State::HEADERS;
+        }
+        else if (state == State::HEADERS)
         {
-            if (fields[1] == "/stats" || fields[1] == "/stats.html")
+            if (length == 0) // end of header
             {
-                std::string info;
-                relay.getStats(info, ReportType::HTML);
+                if (contentLength > 0)
+                {
+                    state = State::BODY;
+                }
+                else
+                {
+                    handleRequest();
+                }
+
+                return true;
+            }
 
-                std::string response = "HTTP/1.1 200 OK\r\n"
-                    "Cache-Control: no-cache, no-store, must-revalidate\r\n"
-                    "Pragma: no-cache\r\n"
-                    "Expires: 0\r\n"
-                    "Content-Type: text/html\r\n"
-                    "Content-Length: " + std::to_string(info.length()) + "\r\n"
-                    "\r\n" + info;
+            const char* colon = static_cast<const char*>(memchr(line, ':', length));
+            if (!colon) return false;
 
+            size_t nameLength = static_cast<size_t>(colon - line);
+            const char* value = colon + 1;
+            size_t valueLength = length - nameLength - 1;
 
-                std::vector<uint8_t> buffer(response.begin(), response.end());
+            while (valueLength > 0 && (*value == ' ' || *value == '\t'))
+            {
+                ++value;
+                --valueLength;
+            }
 
-                socket.send(buffer);
+            if (equalsLowerCase(line, nameLength, "connection"))
+            {
+                if (containsToken(value, valueLength, "close")) keepAlive = false;
+                else if (containsToken(value, valueLength, "keep-alive")) keepAlive = true;
             }
-            else if (fields[1] == "/stats.txt")
+            else if (equalsLowerCase(line, nameLength, "content-length"))
             {
-                std::string info;
-                relay.getStats(info, ReportType::TEXT);
+                if (valueLength == 0) return false;
 
-                std::string response = "HTTP/1.1 200 OK\r\n"
-                    "Cache-Control: no-cache, no-store, must-revalidate\r\n"
-                    "Pragma: no-cache\r\n"
-                    "Expires: 0\r\n"
-                    "Content-Type: text/plain\r\n"
-                    "Content-Length: " + std::to_string(info.length()) + "\r\n"
-                    "\r\n" + info;
+                contentLength = 0;
+                for (size_t i = 0; i < valueLength; ++i)
+                {
+                    if (value[i] < '0' || value[i] > '9') return false;
+                    contentLength = contentLength * 10 + static_cast<uint64_t>(value[i] - '0');
+                    if (contentLength > MAX_CONTENT_LENGTH) return false;
+                }
+            }
+        }
 
-                std::vector<uint8_t> buffer(response.begin(), response.end());
+        return true;
+    }
 
-                socket.send(buffer);
-            }
-            else if (fields[1] == "/stats.json")
-            {
-                std::string info;
-                relay.getStats(info, ReportType::JSON);
+    void StatusSender::handleRequest()
+    {
+        timeSinceRequest = 0.0f;
 
-                std::string response = "HTTP/1.1 200 OK\r\n"
-                    "Cache-Control: no-cache, no-store, must-revalidate\r\n"
-                    "Pragma: no-cache\r\n"
-                    "Expires: 0\r\n"
-                    "Content-Type: application/json\r\n"
-                    "Content-Length: " + std::to_string(info.length()) + "\r\n"
-                    "\r\n" + info;
+        state = State::START_LINE;
+        headerSize = 0;
 
-                std::vector<uint8_t> buffer(response.begin(), response.end());
+        // the relay thread renders the report in its next update, the response is sent from update
+        if (!sendReport())
+        {
+            waitingForReport = true;
+            return;
+        }
 
-                socket.send(buffer);
+        if (!keepAlive) close();
+    }
+
+    void StatusSender::handleClose(Socket&)
+    {
+    }
+
+    void StatusSender::close()
+    {
+        closed = true;
+        timeSinceRequest = 0.0f;
+
+        if (socket.getQueuedBytes() == 0) socket.close();
+    }
+
+    bool StatusSender::sendReport()
+    {
+        if (method == "GET" || method == "HEAD")
+        {
+            StatusSnapshot::Format format;
+            const char* contentType;
+
+            if (path == "/stats" || path == "/stats.html")
+            {
+                format = StatusSnapshot::HTML;
+                contentType = "text/html";
+            }
+            else if (path == "/stats.txt")
+            {
+                format = StatusSnapshot::TEXT;
+                contentType = "text/plain";
+            }
+            else if (path == "/stats.json")
+            {
+                format = StatusSnapshot::JSON;
+                contentType = "application/json";
+            }
+            else if (path == "/metrics")
+            {
+                format = StatusSnapshot::METRICS;
+                contentType = "text/plain; version=0.0.4";
             }
             else
             {
-                sendError();
+                sendError("404 Not Found");
+                return true;
             }
+
+            status.requestReport(format);
+
+            std::shared_ptr<const StatusSnapshot> snapshot = status.getSnapshot();
+            if (!snapshot->reports[format]) return false;
+
+            sendResponse("200 OK", *snapshot->reports[format], contentType);
         }
         else
         {
-            sendError();
+            sendError("405 Method Not Allowed");
         }
+
+        return true;
     }
 
-    void StatusSender::sendError()
+    void StatusSender::sendResponse(const char* statusLine, const std::string& body, const char* contentType)
     {
-        std::string response = "HTTP/1.1 404 Not Found\r\n"
-            "Last-modified: Fri, 09 Aug 1996 14:21:40 GMT\r\n"
-            "\r\n";
+        std::string header = "HTTP/1.1 ";
+        header += statusLine;
+        header += "\r\n"
+            "Cache-Control: no-cache, no-store, must-revalidate\r\n"
+            "Pragma: no-cache\r\n"
+            "Expires: 0\r\n"
+            "Content-Type: ";
+        header += contentType;
+        header += "\r\nContent-Length: " + std::to_string(body.length());
+        header += keepAlive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+
+        bool sendBody = (method != "HEAD");
 
-        std::vector<uint8_t> buffer(response.begin(), response.end());
+        response.clear();
+        response.reserve(header.length() + (sendBody ? body.length() : 0));
+        response.insert(response.end(), header.begin(), header.end());
+        if (sendBody) response.insert(response.end(), body.begin(), body.end());
 
-        socket.send(buffer);
+        socket.send(response);
+    }
+
+    void StatusSender::sendError(const char* statusLine)
+    {
+        static const std::string empty;
+        sendResponse(statusLine, empty, "text/plain");
     }
 }
@@ -8,14 +8,14 @@
 
 namespace relay
 {
-    class Relay;
+    class Status;
 
     class StatusSender
     {
     public:
         StatusSender(Network& aNetwork,
                      Socket& aSocket,
-                     Relay& aRelay);
+                     Status& aStatus);
 
         StatusSender(const StatusSender&) = delete;
         StatusSender(StatusSender&&) = delete;
@@ -23,21 +23,49 @@ namespace relay
         StatusSender& operator=(StatusSender&&) = delete;
 
         bool isConnected() const { return socket.isReady(); }
-        
+
+        void update(float delta);
+
     private:
+        enum class State
+        {
+            START_LINE,
+            HEADERS,
+            BODY
+        };
+
         void handleRead(Socket& clientSocket, const std::vector<uint8_t>& newData);
         void handleClose(Socket& clientSocket);
 
-        void sendReport();
-        void sendError();
+        bool handleLine(const char* line, size_t length);
+        void handleRequest();
+
+        // false if the snapshot does not have the report yet
+        bool sendReport();
+        void sendResponse(const char* status, const std::string& body, const char* contentType);
+        void sendError(const char* status);
+        void close();
 
         Network& network;
         Socket socket;
-        Relay& relay;
+        Status& status;
 
         std::vector<uint8_t> data;
+        size_t offset = 0; // start of the unparsed data
+        size_t searchOffset = 0; // where to continue looking for the end of line
+
+        State state = State::START_LINE;
+        size_t headerSize = 0;
+        std::string method;
+        std::string path;
+        bool keepAlive = false;
+        uint64_t contentLength = 0;
+
+        bool closed = false;
+        bool waitingForReport = false;
+        float timeSinceRequest = 0.0f;
 
-        std::string startLine;
-        std::vector<std::string> headers;
+        // reused between requests to avoid reallocating for every report
+        std::vector<uint8_t> response;
     };
 }
@@ -5,11 +5,32 @@
 #include <algorithm>
 #include "Stream.hpp"
 #include "Connection.hpp"
+#include "Json.hpp"
+#include "Profiler.hpp"
 #include "Relay.hpp"
 #include "Server.hpp"
 
 namespace relay
 {
+    static ObjectPool& getStreamPool()
+    {
+        static ObjectPool& pool = ObjectPool::create("stream", sizeof(Stream));
+        return pool;
+    }
+
+    void* Stream::operator new(size_t size)
+    {
+        // the pool holds only streams of this exact size, derived classes go to the global allocator
+        if (size != sizeof(Stream)) return ::operator new(size);
+        return getStreamPool().allocate();
+    }
+
+    void Stream::operator delete(void* ptr, size_t size)
+    {
+        if (size != sizeof(Stream)) ::operator delete(ptr);
+        else getStreamPool().deallocate(ptr);
+    }
+
     Stream::Stream(Server& aServer,
                    const std::string& aApplicationName,
                    const std::string& aStreamName):
@@ -20,6 +41,10 @@ namespace relay
     {
         idString = "[ST:" + std::to_string(id) + " " + applicationName + "/" + streamName + "] ";
 
+        MetricsWriter::appendLabel(metricLabels, "server", std::to_string(server.getId()));
+        MetricsWriter::appendLabel(metricLabels, "application", applicationName);
+        MetricsWriter::appendLabel(metricLabels, "stream", streamName);
+
         Log(Log::Level::INFO) << idString << "Create";
     }
 
@@ -34,17 +59,61 @@ namespace relay
         {
             case ReportType::TEXT:
             {
-                str += "    Stream[" + std::to_string(id) + "]: " + applicationName + "/" + streamName + "\n";
+                str += "    Stream[" + std::to_string(id) + "]: " + applicationName + "/" + streamName;
+                if (fanOutLatency.getCount())
+                {
+                    LatencyHistogram egressLatency;
+                    getEgressLatency(egressLatency);
+                    str += ", video latency fan-out " + fanOutLatency.getSummary() + ", egress " + egressLatency.getSummary();
+                }
+                str += "\n";
                 break;
             }
             case ReportType::HTML:
             {
                 str += "<b>Stream[" + std::to_string(id) + "]: " + applicationName + "/" + streamName + "</b>";
+                if (fanOutLatency.getCount())
+                {
+                    LatencyHistogram egressLatency;
+                    getEgressLatency(egressLatency);
+                    str += "<br>Video latency fan-out " + fanOutLatency.getSummary() + ", egress " + egressLatency.getSummary();
+                }
                 break;
             }
             case ReportType::JSON:
             {
-                str += "{\"id\": " + std::to_string(id) + ", \"applicationName\":\"" + applicationName + "\", \"streamName\":\"" + streamName + "\", \"connections\": [";
+                JsonWriter writer(str);
+                writer.beginObject();
+                getStats(writer);
+                writer.endObject();
+                break;
+            }
+        }
+    }
+
+    void Stream::getStats(JsonWriter& writer) const
+    {
+        writer.key("id").value(id);
+        writer.key("applicationName").value(applicationName);
+        writer.key("streamName").value(streamName);
+        writer.key("memory").value(getMemoryUsage());
+
+        writer.key("fanOutLatency");
+        fanOutLatency.getStats(writer);
+
+        LatencyHistogram egressLatency;
+        getEgressLatency(egressLatency);
+        writer.key("egressLatency");
+        egressLatency.getStats(writer);
+    }
+
+    void Stream::getEgressLatency(LatencyHistogram& result) const
+    {
+        for (const Connection* outputConnection : outputConnections)
+        {
+            if (outputConnection->getDirection() == Connection::Direction::OUTPUT)
+            {
+                result.merge(outputConnection->getEgressLatency());
             }
         }
     }
@@ -62,6 +131,8 @@ namespace relay
 
     void Stream::close()
     {
+        if (!closed) server.streamClosed(*this);
+
         closed = true;
         if (inputConnection) inputConnection->close(true);
         for (auto o : outputConnections)
@@ -72,7 +143,6 @@ namespace relay
         {
             o->close(true);
         }
-        server.cleanup();
     }
 
     void Stream::start(relay::Connection &connection)
@@ -93,15 +163,19 @@ namespace relay
                 if (endpoint.connectionType == Connection::Type::CLIENT &&
                     endpoint.direction == Connection::Direction::OUTPUT)
                 {
-                    Connection* newConnection = server.createConnection(*this, endpoint);
-                    newConnection->connect();
-
-                    connections.push_back(newConnection);
+                    connect(endpoint);
                 }
             }
         }
         else if (connection.getDirection() == Connection::Direction::OUTPUT)
         {
+            if (connection.isStandby())
+            {
+                if (!standbyConnections.contains(connection)) standbyConnections.push_back(&connection);
+
+                return;
+            }
+
             if (!inputConnection && !inputConnectionCreated)
             {
                 for (const Endpoint& endpoint : server.getEndpoints())
@@ -110,29 +184,18 @@ namespace relay
                         endpoint.direction == Connection::Direction::INPUT &&
                         !endpoint.isNameKnown())
                     {
-                        auto ic = server.createConnection(*this, endpoint);
-                        ic->connect();
+                        connect(endpoint);
                         inputConnectionCreated = true;
-
-                        connections.push_back(ic);
                     }
                 }
             }
     
-            auto i = std::find(outputConnections.begin(), outputConnections.end(), &connection);
-    
-            if (i == outputConnections.end())
-            {
-                outputConnections.push_back(&connection);
-            }
+            if (!outputConnections.contains(connection)) outputConnections.push_back(&connection);
 
             if (streaming)
             {
                 connection.setStream(this);
-
-                if (!videoHeader.empty()) connection.sendVideoHeader(videoHeader);
-                if (!audioHeader.empty()) connection.sendAudioHeader(audioHeader);
-                if (metaData.getType() != amf::Node::Type::Unknown) connection.sendMetaData(metaData);
+                sendHeaders(connection);
             }
         }
         else
@@ -155,21 +218,20 @@ namespace relay
             }
 
             // close all output client connections
-            for (auto it = connections.begin(); it != connections.end();)
+            for (size_t i = 0; i < connections.size();)
             {
-                auto con = *it;
+                Connection* con = connections[i];
                 if (con->getType() == Connection::Type::CLIENT && con->getDirection() == Connection::Direction::OUTPUT)
                 {
-                    it = connections.erase(it);
-
-                    auto ci = std::find(outputConnections.begin(), outputConnections.end(), con);
-                    if (ci != outputConnections.end()) outputConnections.erase(ci);
+                    connections.removeAt(i);
+                    outputConnections.remove(*con);
+                    standbyConnections.remove(*con);
 
                     con->close(true);
                 }
                 else
                 {
-                    it++;
+                    ++i;
                 }
             }
         }
@@ -177,11 +239,17 @@ namespace relay
         {
             if (connection.getType() == Connection::Type::HOST)
             {
-                auto outputIterator = std::find(outputConnections.begin(), outputConnections.end(), &connection);
-
-                if (outputIterator != outputConnections.end())
+                outputConnections.remove(connection);
+            }
+            else if (connection.getDirection() == Connection::Direction::OUTPUT)
+            {
+                if (connection.isStandby())
                 {
-                    outputConnections.erase(outputIterator);
+                    standbyConnections.remove(connection);
+                }
+                else
+                {
+                    switchToStandby(connection);
                 }
             }
         }
@@ -192,6 +260,99 @@ namespace relay
         }
     }
 
+    void Stream::connect(const Endpoint& endpoint)
+    {
+        Connection* newConnection = server.createConnection(*this, endpoint);
+
+        // the active connection stays on the first address and the standby on the second one, they swap roles on failure
+        bool warmStandby = endpoint.warmStandby &&
+            endpoint.direction == Connection::Direction::OUTPUT &&
+            endpoint.addresses.size() > 1;
+
+        if (warmStandby) newConnection->pinAddress(0);
+        newConnection->connect();
+
+        connections.push_back(newConnection);
+
+        if (warmStandby)
+        {
+            Connection* standbyConnection = server.createConnection(*this, endpoint);
+            standbyConnection->pinAddress(1);
+            standbyConnection->setStandby(true);
+            standbyConnection->connect();
+
+            connections.push_back(standbyConnection);
+        }
+    }
+
+    void Stream::sendHeaders(Connection& connection)
+    {
+        if (!videoHeader.empty()) connection.sendVideoHeader(videoHeader);
+        if (!audioHeader.empty()) connection.sendAudioHeader(audioHeader);
+        if (metaData.getType() != amf::Node::Type::Unknown) connection.sendMetaData(metaData);
+    }
+
+    void Stream::switchToStandby(Connection& connection)
+    {
+        auto standbyIterator = std::find_if(standbyConnections.begin(), standbyConnections.end(), [&connection](Connection* c) {
+            return c->getEndpoint() == connection.getEndpoint() && c->isStreaming();
+        });
+
+        if (standbyIterator == standbyConnections.end()) return;
+
+        Connection* standbyConnection = *standbyIterator;
+        standbyConnections.remove(*standbyConnection);
+
+        Log(Log::Level::INFO) << idString << "Switching from " << connection.getIdString() << "to standby " << standbyConnection->getIdString();
+
+        // the failed connection reconnects and publishes as the new standby
+        connection.setStandby(true);
+        standbyConnection->setStandby(false);
+
+        outputConnections.remove(connection);
+        outputConnections.push_back(standbyConnection);
+
+        // video frames are only sent from the next key frame on, the standby has not been sent any
+        if (streaming) sendHeaders(*standbyConnection);
+    }
+
+    void Stream::startEndpoint(const Endpoint& endpoint)
+    {
+        if (closed || endpoint.connectionType != Connection::Type::CLIENT) return;
+
+        if (endpoint.direction == Connection::Direction::OUTPUT)
+        {
+            if (streaming) connect(endpoint);
+        }
+        else if (endpoint.direction == Connection::Direction::INPUT && !endpoint.isNameKnown())
+        {
+            // input connections are only created on demand, for streams that are being played
+            if (!inputConnection && !inputConnectionCreated && !outputConnections.empty())
+            {
+                connect(endpoint);
+                inputConnectionCreated = true;
+            }
+        }
+    }
+
+    void Stream::removeConnection(Connection& connection)
+    {
+        connections.remove(connection);
+        outputConnections.remove(connection);
+        standbyConnections.remove(connection);
+
+        if (&connection == inputConnection)
+        {
+            inputConnection = nullptr;
+            inputConnectionCreated = false;
+        }
+
+        if (!closed && !hasDependableConnections())
+        {
+            close();
+        }
+    }
+
     void Stream::sendAudioHeader(const std::vector<uint8_t>& headerData)
     {
         audioHeader = headerData;
@@ -220,24 +381,45 @@ namespace relay
 
     void Stream::sendAudioFrame(uint64_t timestamp, const std::vector<uint8_t>& audioData)
     {
+        RELAY_PROFILE_SCOPE(STREAM_FAN_OUT);
+
+        ++counters.framesReceived;
+
         for (Connection* outputConnection : outputConnections)
         {
+            // outputs without audio neither forward nor drop it
+            const Endpoint* endpoint = outputConnection->getEndpoint();
+            if (endpoint && !endpoint->audioStream) continue;
+
             if (outputConnection->getDirection() == Connection::Direction::OUTPUT)
             {
-                outputConnection->sendAudioFrame(timestamp, audioData);
+                if (outputConnection->sendAudioFrame(timestamp, audioData)) ++counters.framesForwarded;
+                else ++counters.framesDropped;
             }
         }
     }
 
-    void Stream::sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& videoData, VideoFrameType frameType)
+    void Stream::sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& videoData, VideoFrameType frameType,
+                                std::chrono::steady_clock::time_point ingestTime)
     {
+        RELAY_PROFILE_SCOPE(STREAM_FAN_OUT);
+
+        ++counters.framesReceived;
+
         for (Connection* outputConnection : outputConnections)
         {
+            const Endpoint* endpoint = outputConnection->getEndpoint();
+            if (endpoint && !endpoint->videoStream) continue;
+
             if (outputConnection->getDirection() == Connection::Direction::OUTPUT)
             {
-                outputConnection->sendVideoFrame(timestamp, videoData, frameType);
+                if (outputConnection->sendVideoFrame(timestamp, videoData, frameType, ingestTime)) ++counters.framesForwarded;
+                else ++counters.framesDropped;
             }
         }
+
+        // measured once the frame is queued to every output, so it includes the fan-out
+        fanOutLatency.record(LatencyHistogram::getMicroseconds(ingestTime, std::chrono::steady_clock::now()));
     }
 
     void Stream::sendMetaData(const amf::Node& newMetaData)
@@ -264,17 +446,34 @@ namespace relay
         }
     }
 
-    void Stream::getConnections(std::map<Connection*, Stream*>& cons)
+    uint64_t Stream::getMemoryUsage() const
     {
-        if (inputConnection) cons[inputConnection] = this;
+        std::vector<Connection*> streamConnections;
+        getConnections(streamConnections);
 
-        for (const auto& c : outputConnections)
+        uint64_t result = getHeaderMemory();
+
+        for (const Connection* connection : streamConnections)
         {
-            cons[c] = this;
+            result += connection->getMemoryUsage();
         }
-        for (const auto& c : connections)
+
+        return result;
+    }
+
+    void Stream::getConnections(std::vector<Connection*>& result) const
+    {
+        if (inputConnection) result.push_back(inputConnection);
+
+        // client outputs are also in connections
+        for (Connection* c : outputConnections)
+        {
+            if (c != inputConnection && c->getType() == Connection::Type::HOST) result.push_back(c);
+        }
+
+        for (Connection* c : connections)
         {
-            cons[c] = this;
+            if (c != inputConnection) result.push_back(c);
         }
     }
 }
@@ -7,6 +7,9 @@
 #include <string>
 #include <vector>
 #include "Amf.hpp"
+#include "Connection.hpp"
+#include "Histogram.hpp"
+#include "Metrics.hpp"
 #include "Socket.hpp"
 #include "Status.hpp"
 #include "Utils.hpp"
@@ -16,6 +19,8 @@ namespace relay
     class Relay;
     class Server;
     class Connection;
+    class JsonWriter;
+    struct Endpoint;
 
     class Stream
     {
@@ -32,11 +37,17 @@ namespace relay
 
         virtual ~Stream();
 
+        // streams come from a pool, a stream is created on every publish
+        static void* operator new(size_t size);
+        static void operator delete(void* ptr, size_t size);
+
         Server& getServer() { return server; }
         const std::string& getApplicationName() const { return applicationName; }
         const std::string& getStreamName() const { return streamName; }
 
         void getStats(std::string& str, ReportType reportType) const;
+        // writes the stream fields into an object opened by the caller
+        void getStats(JsonWriter& writer) const;
 
         void start(Connection& connection);
         void stop(Connection& connection);
@@ -46,17 +57,46 @@ namespace relay
         void sendAudioHeader(const std::vector<uint8_t>& headerData);
         void sendVideoHeader(const std::vector<uint8_t>& headerData);
         void sendAudioFrame(uint64_t timestamp, const std::vector<uint8_t>& audioData);
-        void sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& videoData, VideoFrameType frameType);
+        void sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& videoData, VideoFrameType frameType,
+                            std::chrono::steady_clock::time_point ingestTime);
         void sendMetaData(const amf::Node& newMetaData);
         void sendTextData(uint64_t timestamp, const amf::Node& textData);
 
         bool hasDependableConnections();
         void close();
-        bool isClosed() { return closed; }
+        bool isClosed() const { return closed; }
         uint64_t getId() { return id; }
-        void getConnections(std::map<Connection*, Stream*>& cons);
+
+        // client connection owned by the server that belongs to this stream
+        void addConnection(Connection& connection) { connections.push_back(&connection); }
+        // forgets a client connection that is about to be deleted
+        void removeConnection(Connection& connection);
+        // starts the client connection of an endpoint added by a configuration reload, if the stream needs one
+        void startEndpoint(const Endpoint& endpoint);
+        // appends the connections of the stream, input first
+        void getConnections(std::vector<Connection*>& result) const;
+
+        const Counters& getCounters() const { return counters; }
+        const std::string& getMetricLabels() const { return metricLabels; }
+        // time from receiving a video frame until it is handed to the outputs
+        const LatencyHistogram& getFanOutLatency() const { return fanOutLatency; }
+        // time from receiving a video frame until it is written, for all current outputs
+        void getEgressLatency(LatencyHistogram& result) const;
+        size_t getConnectionCount() const { return (inputConnection ? 1 : 0) + outputConnections.size(); }
+        size_t getHeaderMemory() const { return audioHeader.capacity() + videoHeader.capacity(); }
+        // the headers and the buffers of the connections, what the stream memory budget applies to
+        uint64_t getMemoryUsage() const;
+        const std::string& getIdString() const { return idString; }
+
+        size_t serverSlot = NO_SLOT; // position in Server::streams
 
     private:
+        void connect(const Endpoint& endpoint);
+        // sends the headers and metadata to an output that joins a running stream
+        void sendHeaders(Connection& connection);
+        // replaces a failed client output with the published standby of its endpoint
+        void switchToStandby(Connection& connection);
+
         const uint64_t id;
         bool closed = false;
         std::string idString;
@@ -68,13 +108,18 @@ namespace relay
 
         Connection* inputConnection = nullptr;
         bool inputConnectionCreated = false;
-        std::vector<Connection*> outputConnections;
+        SlotVector<Connection, &Connection::outputSlot> outputConnections;
+        SlotVector<Connection, &Connection::standbySlot> standbyConnections; // published, but not sent any media
 
         bool streaming = false;
         std::vector<uint8_t> audioHeader;
         std::vector<uint8_t> videoHeader;
         amf::Node metaData;
 
-        std::vector<Connection*> connections;
+        SlotVector<Connection, &Connection::streamSlot> connections; // client connections
+
+        Counters counters;
+        std::string metricLabels;
+        LatencyHistogram fanOutLatency;
     };
 }
@@ -2,6 +2,9 @@
 //  rtmp_relay
 //
 
+#ifndef _WIN32
+#  include <pthread.h>
+#endif
 #include "Utils.hpp"
 
 static size_t replaceAll(std::string& str, const std::string& from, const std::string& to)
@@ -35,6 +38,116 @@ size_t replaceTokens(std::string& str, const std::map<std::string, std::string>&
     return count;
 }
 
+// 0 - copy as is, 'u' - \u00XX, 'x' - UTF-8 lead byte, '?' - invalid byte, other - two character escape
+static const char escapeTable[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u', // 0x00
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', // 0x10
+    0,   0,   '"', 0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   // 0x20
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   // 0x30
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   // 0x40
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '\\',0,   0,   0,   // 0x50
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   // 0x60
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   'u', // 0x70
+    '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', // 0x80
+    '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', // 0x90
+    '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', // 0xA0
+    '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', // 0xB0
+    '?', '?', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', // 0xC0
+    'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', // 0xD0
+    'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', // 0xE0
+    'x', 'x', 'x', 'x', 'x', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?', '?'  // 0xF0
+};
+
+// returns the length of a valid UTF-8 sequence starting at str or 0
+static size_t getUtf8SequenceLength(const uint8_t* str, size_t length)
+{
+    size_t sequenceLength;
+    uint8_t minSecond = 0x80;
+    uint8_t maxSecond = 0xBF;
+
+    if (str[0] < 0xE0)
+    {
+        sequenceLength = 2;
+    }
+    else if (str[0] < 0xF0)
+    {
+        sequenceLength = 3;
+        if (str[0] == 0xE0) minSecond = 0xA0; // overlong
+        else if (str[0] == 0xED) maxSecond = 0x9F; // surrogates
+    }
+    else
+    {
+        sequenceLength = 4;
+        if (str[0] == 0xF0) minSecond = 0x90; // overlong
+        else if (str[0] == 0xF4) maxSecond = 0x8F; // above U+10FFFF
+    }
+
+    if (length < sequenceLength) return 0;
+    if (str[1] < minSecond || str[1] > maxSecond) return 0;
+
+    for (size_t i = 2; i < sequenceLength; ++i)
+    {
+        if ((str[i] & 0xC0) != 0x80) return 0;
+    }
+
+    return sequenceLength;
+}
+
+void appendEscapedString(std::string& result, const char* str, size_t length)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(str);
+    size_t runStart = 0;
+    size_t i = 0;
+
+    while (i < length)
+    {
+        char escape = escapeTable[data[i]];
+
+        if (escape == 0)
+        {
+            ++i;
+            continue;
+        }
+
+        if (escape == 'x')
+        {
+            size_t sequenceLength = getUtf8SequenceLength(data + i, length - i);
+
+            if (sequenceLength)
+            {
+                i += sequenceLength;
+                continue;
+            }
+
+            escape = '?';
+        }
+
+        result.append(str + runStart, i - runStart);
+
+        switch (escape)
+        {
+            case 'u':
+                result += "\\u00";
+                result.push_back(hexDigits[data[i] >> 4]);
+                result.push_back(hexDigits[data[i] & 0x0F]);
+                break;
+            case '?':
+                result += "\\ufffd";
+                break;
+            default:
+                result.push_back('\\');
+                result.push_back(escape);
+                break;
+        }
+
+        runStart = ++i;
+    }
+
+    result.append(str + runStart, length - runStart);
+}
+
 std::string getAudioCodec(AudioCodec codecId)
 {
     switch (codecId)
@@ -72,3 +185,19 @@ std::string getVideoCodec(VideoCodec codecId)
 
     return "unknown";
 }
+
+SignalBlocker::SignalBlocker()
+{
+#ifndef _WIN32
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, &previousSignals);
+#endif
+}
+
+SignalBlocker::~SignalBlocker()
+{
+#ifndef _WIN32
+    pthread_sigmask(SIG_SETMASK, &previousSignals, nullptr);
+#endif
+}
@@ -8,6 +8,9 @@
 #include <string>
 #include <vector>
 #include <map>
+#ifndef _WIN32
+#  include <signal.h>
+#endif
 
 union IntFloat64
 {
@@ -18,7 +21,7 @@ union IntFloat64
 template <class T>
 inline uint32_t decodeIntBE(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t size, T& result)
 {
-    if (buffer.size() - offset < size)
+    if (offset > buffer.size() || buffer.size() - offset < size)
     {
         return 0;
     }
@@ -37,7 +40,7 @@ inline uint32_t decodeIntBE(const std::vector<uint8_t>& buffer, uint32_t offset,
 template <>
 inline uint32_t decodeIntBE<uint8_t>(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t size, uint8_t& result)
 {
-    if (buffer.size() - offset < size)
+    if (offset > buffer.size() || buffer.size() - offset < size)
     {
         return 0;
     }
@@ -51,7 +54,7 @@ inline uint32_t decodeIntBE<uint8_t>(const std::vector<uint8_t>& buffer, uint32_
 template <class T>
 inline uint32_t decodeIntLE(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t size, T& result)
 {
-    if (buffer.size() - offset < size)
+    if (offset > buffer.size() || buffer.size() - offset < size)
     {
         return 0;
     }
@@ -70,7 +73,7 @@ inline uint32_t decodeIntLE(const std::vector<uint8_t>& buffer, uint32_t offset,
 template <>
 inline uint32_t decodeIntLE<uint8_t>(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t size, uint8_t& result)
 {
-    if (buffer.size() - offset < size)
+    if (offset > buffer.size() || buffer.size() - offset < size)
     {
         return 0;
     }
@@ -83,7 +86,7 @@ inline uint32_t decodeIntLE<uint8_t>(const std::vector<uint8_t>& buffer, uint32_
 
 inline uint32_t decodeDouble(const std::vector<uint8_t>& buffer, uint32_t offset, double& result)
 {
-    if (buffer.size() - offset < 8)
+    if (offset > buffer.size() || buffer.size() - offset < 8)
     {
         return 0;
     }
@@ -113,6 +116,11 @@ inline uint32_t decodeU29(const std::vector<uint8_t>& buffer, uint32_t offset, u
 
     for (uint32_t i = 0; i < 4; ++i)
     {
+        if (offset >= buffer.size())
+        {
+            return 0;
+        }
+
         uint8_t b = *(buffer.data() + offset);
 
         if (i == 3)
@@ -228,32 +236,20 @@ inline void tokenize(const std::string& str, std::vector<std::string>& tokens,
     }
 }
 
-inline std::string escapeString(const std::string& str)
+// appends str to result escaped for a JSON string literal; control characters
+// and invalid UTF-8 sequences are escaped, so arbitrary bytes produce valid JSON
+void appendEscapedString(std::string& result, const char* str, size_t length);
+
+inline void appendEscapedString(std::string& result, const std::string& str)
 {
-    std::map<char, std::string> replace = {
-        {'\b', "\\b"},
-        {'\f', "\\f"},
-        {'\n', "\\n"},
-        {'\r', "\\r"},
-        {'"', "\\\""},
-        {'\\', "\\\\"}
-    };
+    appendEscapedString(result, str.data(), str.size());
+}
 
+inline std::string escapeString(const std::string& str)
+{
     std::string result;
-
-    for (char c : str)
-    {
-        std::map<char, std::string>::iterator i = replace.find(c);
-
-        if (i == replace.end())
-        {
-            result.push_back(c);
-        }
-        else
-        {
-            result += i->second;
-        }
-    }
+    result.reserve(str.size());
+    appendEscapedString(result, str);
 
     return result;
 }
@@ -323,3 +319,20 @@ inline bool isValidName(const std::string& str)
 
     return true;
 }
+
+// blocks all signals of the calling thread while alive, threads created in the meantime inherit the mask,
+// so the signal handlers only run on the relay thread
+class SignalBlocker
+{
+public:
+    SignalBlocker();
+    ~SignalBlocker();
+
+    SignalBlocker(const SignalBlocker&) = delete;
+    SignalBlocker& operator=(const SignalBlocker&) = delete;
+
+private:
+#ifndef _WIN32
+    sigset_t previousSignals;
+#endif
+};
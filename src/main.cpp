@@ -30,25 +30,15 @@ static void signalHandler(int signo)
     {
         case SIGHUP:
             // rehash the server
-            if (!rel.init(config))
-            {
-                Log(Log::Level::ERR) << "Failed to reload config";
-                exit(EXIT_FAILURE);
-            }
+            rel.reload();
             break;
         case SIGTERM:
             // shutdown the server
-            rel.close();
-            rel.closeLog();
-            exit(EXIT_SUCCESS);
+            rel.stop();
             break;
         case SIGUSR1:
-        {
-            std::string str;
-            rel.getStats(str, ReportType::TEXT);
-            Log(Log::Level::INFO) << str;
+            rel.logStats();
             break;
-        }
         case SIGPIPE:
             Log(Log::Level::ERR) << "Received SIGPIPE";
             break;
@@ -284,6 +274,7 @@ int main(int argc, const char* argv[])
     Log(Log::Level::ERR) << "-----------------  RTMP Relay " << VERSION << " -----------------";
 
     rel.run();
+    rel.closeLog();
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,410 @@
+//
+//  rtmp_relay
+//
+
+#include <cstring>
+#include "LoadClient.hpp"
+#include "Constants.hpp"
+#include "Log.hpp"
+#include "Utils.hpp"
+
+namespace relay
+{
+    namespace loadgen
+    {
+        // AVC frame header (frame type, packet type, composition time) followed by the send time
+        static const uint32_t VIDEO_HEADER_SIZE = 5;
+        static const uint32_t TIMESTAMP_SIZE = 8;
+
+        LoadClient::LoadClient(Network& network,
+                               Role aRole,
+                               const std::string& aApplicationName,
+                               const std::string& aStreamName,
+                               uint32_t aChunkSize):
+            socket(network),
+            role(aRole),
+            applicationName(aApplicationName),
+            streamName(aStreamName),
+            outChunkSize(aChunkSize)
+        {
+            socket.setConnectCallback(std::bind(&LoadClient::handleConnect, this, std::placeholders::_1));
+            socket.setConnectErrorCallback(std::bind(&LoadClient::handleConnectError, this, std::placeholders::_1));
+            socket.setReadCallback(std::bind(&LoadClient::handleRead, this, std::placeholders::_1, std::placeholders::_2));
+            socket.setCloseCallback(std::bind(&LoadClient::handleClose, this, std::placeholders::_1));
+        }
+
+        bool LoadClient::connect(const std::string& address)
+        {
+            state = State::CONNECTING;
+            return socket.connect(address);
+        }
+
+        void LoadClient::handleConnect(Socket&)
+        {
+            std::vector<uint8_t> handshake;
+            handshake.reserve(1 + sizeof(rtmp::Challenge));
+            handshake.push_back(RTMP_VERSION);
+
+            rtmp::Challenge clientChallenge;
+            clientChallenge.time = 0;
+            std::copy(RTMP_CLIENT_VERSION, RTMP_CLIENT_VERSION + sizeof(RTMP_CLIENT_VERSION), clientChallenge.version);
+            for (size_t i = 0; i < sizeof(clientChallenge.randomBytes); ++i)
+            {
+                clientChallenge.randomBytes[i] = static_cast<uint8_t>(i * 131);
+            }
+
+            handshake.insert(handshake.end(),
+                             reinterpret_cast<uint8_t*>(&clientChallenge),
+                             reinterpret_cast<uint8_t*>(&clientChallenge) + sizeof(clientChallenge));
+
+            stats.bytesSent += handshake.size();
+            socket.send(handshake);
+
+            state = State::HANDSHAKE;
+        }
+
+        void LoadClient::handleConnectError(Socket&)
+        {
+            Log(Log::Level::ERR) << "Failed to connect to the relay";
+            state = State::CLOSED;
+        }
+
+        void LoadClient::handleClose(Socket&)
+        {
+            if (state != State::CLOSED)
+            {
+                Log(Log::Level::ERR) << "Relay closed the connection";
+                state = State::CLOSED;
+            }
+        }
+
+        void LoadClient::handleRead(Socket&, const std::vector<uint8_t>& newData)
+        {
+            stats.bytesReceived += newData.size();
+            data.insert(data.end(), newData.begin(), newData.end());
+
+            uint32_t offset = 0;
+
+            if (state == State::HANDSHAKE)
+            {
+                // S0, S1 and S2
+                if (data.size() < 1 + sizeof(rtmp::Challenge) + sizeof(rtmp::Ack)) return;
+
+                if (data[0] != RTMP_VERSION)
+                {
+                    Log(Log::Level::ERR) << "Unsupported version " << static_cast<uint32_t>(data[0]);
+                    state = State::CLOSED;
+                    socket.close();
+                    return;
+                }
+
+                // C2 echoes S1
+                std::vector<uint8_t> ack(data.begin() + 1, data.begin() + 1 + sizeof(rtmp::Challenge));
+                stats.bytesSent += ack.size();
+                socket.send(ack);
+
+                offset += static_cast<uint32_t>(1 + sizeof(rtmp::Challenge) + sizeof(rtmp::Ack));
+
+                if (role == Role::IDLE)
+                {
+                    state = State::IDLE;
+                    data.erase(data.begin(), data.begin() + offset);
+                    return;
+                }
+
+                state = State::SETUP;
+
+                if (role == Role::PUBLISHER)
+                {
+                    rtmp::Packet packet;
+                    packet.channel = rtmp::Channel::SYSTEM;
+                    packet.messageType = rtmp::MessageType::SET_CHUNK_SIZE;
+                    encodeIntBE(packet.data, 4, outChunkSize);
+                    sendPacket(packet);
+                }
+                else
+                {
+                    outChunkSize = 128; // players never change it
+                }
+
+                amf::Node argument1;
+                argument1["app"] = applicationName;
+                argument1["type"] = std::string("nonprivate");
+                argument1["flashVer"] = std::string("FMLE/3.0 (compatible; rtmp_relay_loadgen)");
+                argument1["tcUrl"] = "rtmp://127.0.0.1/" + applicationName;
+                argument1["objectEncoding"] = 0.0;
+                sendInvoke("connect", 0, { argument1 });
+
+                createStreamId = invokeId + 1.0;
+                sendInvoke("createStream", 0, { amf::Node(amf::Node::Type::Null) });
+            }
+
+            while (offset < data.size() && state != State::CLOSED)
+            {
+                rtmp::Packet packet;
+                uint32_t ret = packet.decode(data, offset, inChunkSize, receivedPackets);
+
+                if (ret == 0) break;
+
+                offset += ret;
+
+                if (!handlePacket(packet))
+                {
+                    state = State::CLOSED;
+                    socket.close();
+                    return;
+                }
+            }
+
+            data.erase(data.begin(), data.begin() + offset);
+        }
+
+        bool LoadClient::handlePacket(const rtmp::Packet& packet)
+        {
+            switch (packet.messageType)
+            {
+                case rtmp::MessageType::SET_CHUNK_SIZE:
+                {
+                    if (decodeIntBE(packet.data, 0, 4, inChunkSize) == 0) return false;
+                    break;
+                }
+
+                case rtmp::MessageType::USER_CONTROL:
+                {
+                    uint16_t userControlType;
+                    uint32_t param;
+                    if (decodeIntBE(packet.data, 0, 2, userControlType) == 0) return false;
+                    if (decodeIntBE(packet.data, 2, 4, param) == 0) return false;
+
+                    if (static_cast<rtmp::UserControlType>(userControlType) == rtmp::UserControlType::PING)
+                    {
+                        rtmp::Packet pong;
+                        pong.channel = rtmp::Channel::NETWORK;
+                        pong.timestamp = packet.timestamp;
+                        pong.messageType = rtmp::MessageType::USER_CONTROL;
+                        encodeIntBE(pong.data, 2, static_cast<uint16_t>(rtmp::UserControlType::PONG));
+                        encodeIntBE(pong.data, 4, param);
+                        sendPacket(pong);
+                    }
+                    break;
+                }
+
+                case rtmp::MessageType::AMF0_INVOKE:
+                {
+                    uint32_t offset = 0;
+                    uint32_t ret;
+
+                    amf::Node command;
+                    if ((ret = command.decode(amf::Version::AMF0, packet.data, offset)) == 0) return false;
+                    offset += ret;
+
+                    amf::Node transactionId;
+                    if ((ret = transactionId.decode(amf::Version::AMF0, packet.data, offset)) == 0) return false;
+                    offset += ret;
+
+                    if (!command.isString()) return false;
+
+                    if (command.asString() == "_result" &&
+                        transactionId.isNumber() &&
+                        transactionId.asDouble() == createStreamId)
+                    {
+                        amf::Node argument1;
+                        if ((ret = argument1.decode(amf::Version::AMF0, packet.data, offset)) == 0) return false;
+                        offset += ret;
+
+                        amf::Node argument2;
+                        if ((ret = argument2.decode(amf::Version::AMF0, packet.data, offset)) == 0) return false;
+                        if (!argument2.isNumber()) return false;
+
+                        streamId = argument2.asUInt32();
+
+                        if (role == Role::PUBLISHER)
+                        {
+                            sendInvoke("publish", streamId, { amf::Node(amf::Node::Type::Null), amf::Node(streamName), amf::Node(std::string("live")) });
+                        }
+                        else
+                        {
+                            sendInvoke("play", streamId, { amf::Node(amf::Node::Type::Null), amf::Node(streamName) });
+                        }
+                    }
+                    else if (command.asString() == "_error")
+                    {
+                        Log(Log::Level::ERR) << "Relay returned an error";
+                        return false;
+                    }
+                    else if (command.asString() == "onStatus")
+                    {
+                        amf::Node argument1;
+                        if ((ret = argument1.decode(amf::Version::AMF0, packet.data, offset)) == 0) return false;
+                        offset += ret;
+
+                        amf::Node argument2;
+                        if ((ret = argument2.decode(amf::Version::AMF0, packet.data, offset)) == 0) return false;
+
+                        if (argument2.getType() == amf::Node::Type::Object &&
+                            argument2.hasElement("code") &&
+                            argument2["code"].isString())
+                        {
+                            const std::string code = argument2["code"].asString();
+
+                            if (code == "NetStream.Publish.Start")
+                            {
+                                state = State::STREAMING;
+                                sendCodecHeaders();
+                            }
+                            else if (code == "NetStream.Play.Start")
+                            {
+                                state = State::STREAMING;
+                            }
+                        }
+                    }
+                    break;
+                }
+
+                case rtmp::MessageType::VIDEO_PACKET:
+                {
+                    handleVideoFrame(packet);
+                    break;
+                }
+
+                case rtmp::MessageType::AUDIO_PACKET:
+                {
+                    ++stats.audioFrames;
+                    break;
+                }
+
+                default:
+                    break;
+            }
+
+            return true;
+        }
+
+        void LoadClient::handleVideoFrame(const rtmp::Packet& packet)
+        {
+            if (isCodecHeader(packet.data)) return;
+
+            ++stats.videoFrames;
+
+            if (packet.data.size() >= VIDEO_HEADER_SIZE + TIMESTAMP_SIZE)
+            {
+                uint64_t sendTime;
+                decodeIntBE(packet.data, VIDEO_HEADER_SIZE, TIMESTAMP_SIZE, sendTime);
+
+                uint64_t currentTime = getTimeMicroseconds();
+                if (currentTime >= sendTime)
+                {
+                    stats.latencies.push_back(static_cast<uint32_t>(currentTime - sendTime));
+                }
+            }
+        }
+
+        bool LoadClient::sendPacket(const rtmp::Packet& packet)
+        {
+            buffer.clear();
+            uint32_t size = packet.encode(buffer, outChunkSize, sentPackets);
+            if (size == 0) return false;
+
+            stats.bytesSent += size;
+            return socket.send(buffer);
+        }
+
+        bool LoadClient::sendInvoke(const std::string& command, uint32_t messageStreamId, const std::vector<amf::Node>& arguments)
+        {
+            rtmp::Packet packet;
+            packet.channel = rtmp::Channel::SYSTEM;
+            packet.messageType = rtmp::MessageType::AMF0_INVOKE;
+            packet.messageStreamId = messageStreamId;
+
+            amf::Node commandName = command;
+            commandName.encode(amf::Version::AMF0, packet.data);
+
+            amf::Node transactionIdNode = ++invokeId;
+            transactionIdNode.encode(amf::Version::AMF0, packet.data);
+
+            for (const amf::Node& argument : arguments)
+            {
+                argument.encode(amf::Version::AMF0, packet.data);
+            }
+
+            return sendPacket(packet);
+        }
+
+        void LoadClient::sendCodecHeaders()
+        {
+            rtmp::Packet metaData;
+            metaData.channel = rtmp::Channel::AUDIO;
+            metaData.messageType = rtmp::MessageType::AMF0_DATA;
+            metaData.messageStreamId = streamId;
+
+            amf::Node commandName = std::string("@setDataFrame");
+            commandName.encode(amf::Version::AMF0, metaData.data);
+            amf::Node argument1 = std::string("onMetaData");
+            argument1.encode(amf::Version::AMF0, metaData.data);
+            amf::Node argument2(amf::Node::Type::Dictionary);
+            argument2["width"] = 1280.0;
+            argument2["height"] = 720.0;
+            argument2["videocodecid"] = 7.0;
+            argument2["audiocodecid"] = 10.0;
+            argument2["encoder"] = std::string("rtmp_relay_loadgen");
+            argument2.encode(amf::Version::AMF0, metaData.data);
+            sendPacket(metaData);
+
+            rtmp::Packet videoHeader;
+            videoHeader.channel = rtmp::Channel::VIDEO;
+            videoHeader.messageType = rtmp::MessageType::VIDEO_PACKET;
+            videoHeader.messageStreamId = streamId;
+            videoHeader.data = { 0x17, 0x00, 0x00, 0x00, 0x00, 0x01, 0x64, 0x00, 0x1f, 0xff };
+            sendPacket(videoHeader);
+
+            rtmp::Packet audioHeader;
+            audioHeader.channel = rtmp::Channel::AUDIO;
+            audioHeader.messageType = rtmp::MessageType::AUDIO_PACKET;
+            audioHeader.messageStreamId = streamId;
+            audioHeader.data = { 0xaf, 0x00, 0x12, 0x10 };
+            sendPacket(audioHeader);
+        }
+
+        bool LoadClient::sendVideoFrame(uint64_t timestamp, bool keyFrame, uint32_t size)
+        {
+            if (state != State::STREAMING) return false;
+
+            rtmp::Packet packet;
+            packet.channel = rtmp::Channel::VIDEO;
+            packet.messageType = rtmp::MessageType::VIDEO_PACKET;
+            packet.messageStreamId = streamId;
+            packet.timestamp = timestamp;
+
+            packet.data.reserve(std::max(size, VIDEO_HEADER_SIZE + TIMESTAMP_SIZE));
+            packet.data.push_back(keyFrame ? 0x17 : 0x27);
+            packet.data.push_back(0x01); // NALU
+            packet.data.push_back(0x00); // composition time
+            packet.data.push_back(0x00);
+            packet.data.push_back(0x00);
+            encodeIntBE(packet.data, TIMESTAMP_SIZE, getTimeMicroseconds());
+            packet.data.resize(std::max(size, VIDEO_HEADER_SIZE + TIMESTAMP_SIZE), 0xAB);
+
+            ++stats.videoFrames;
+            return sendPacket(packet);
+        }
+
+        bool LoadClient::sendAudioFrame(uint64_t timestamp, uint32_t size)
+        {
+            if (state != State::STREAMING) return false;
+
+            rtmp::Packet packet;
+            packet.channel = rtmp::Channel::AUDIO;
+            packet.messageType = rtmp::MessageType::AUDIO_PACKET;
+            packet.messageStreamId = streamId;
+            packet.timestamp = timestamp;
+
+            packet.data.reserve(std::max(size, 2U));
+            packet.data.push_back(0xaf); // AAC
+            packet.data.push_back(0x01); // raw
+            packet.data.resize(std::max(size, 2U), 0xCD);
+
+            ++stats.audioFrames;
+            return sendPacket(packet);
+        }
+    }
+}
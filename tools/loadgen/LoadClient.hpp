@@ -0,0 +1,110 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "Socket.hpp"
+#include "RTMP.hpp"
+#include "Amf.hpp"
+
+namespace relay
+{
+    namespace loadgen
+    {
+        // minimal RTMP client that publishes synthetic frames or plays them back
+        class LoadClient
+        {
+        public:
+            enum class Role
+            {
+                PUBLISHER,
+                PLAYER,
+                IDLE // completes the handshake and sends nothing else, like a client that has not sent connect yet
+            };
+
+            enum class State
+            {
+                CONNECTING,
+                HANDSHAKE,
+                SETUP, // connect, createStream and publish or play sent
+                STREAMING,
+                IDLE, // handshake done, no commands sent
+                CLOSED
+            };
+
+            struct Stats
+            {
+                uint64_t bytesSent = 0;
+                uint64_t bytesReceived = 0;
+                uint64_t videoFrames = 0;
+                uint64_t audioFrames = 0;
+                // publisher-to-player latency of each received video frame in microseconds
+                std::vector<uint32_t> latencies;
+            };
+
+            LoadClient(Network& network,
+                       Role aRole,
+                       const std::string& aApplicationName,
+                       const std::string& aStreamName,
+                       uint32_t aChunkSize);
+
+            LoadClient(const LoadClient&) = delete;
+            LoadClient& operator=(const LoadClient&) = delete;
+
+            bool connect(const std::string& address);
+
+            bool sendVideoFrame(uint64_t timestamp, bool keyFrame, uint32_t size);
+            bool sendAudioFrame(uint64_t timestamp, uint32_t size);
+
+            State getState() const { return state; }
+            Stats& getStats() { return stats; }
+
+        private:
+            void handleConnect(Socket&);
+            void handleConnectError(Socket&);
+            void handleRead(Socket&, const std::vector<uint8_t>& newData);
+            void handleClose(Socket&);
+
+            bool handlePacket(const rtmp::Packet& packet);
+            void handleVideoFrame(const rtmp::Packet& packet);
+
+            bool sendPacket(const rtmp::Packet& packet);
+            bool sendInvoke(const std::string& command, uint32_t messageStreamId, const std::vector<amf::Node>& arguments);
+            void sendCodecHeaders();
+
+            Socket socket;
+            Role role;
+            std::string applicationName;
+            std::string streamName;
+            State state = State::CONNECTING;
+
+            uint32_t inChunkSize = 128;
+            uint32_t outChunkSize;
+            rtmp::HeaderMap receivedPackets;
+            rtmp::HeaderMap sentPackets;
+
+            std::vector<uint8_t> data;
+            std::vector<uint8_t> buffer;
+            std::vector<uint8_t> challenge;
+            double invokeId = 0.0;
+            double createStreamId = 0.0;
+            uint32_t streamId = 0;
+
+            Stats stats;
+        };
+
+        // clock shared by publishers and players, frames carry its value to measure latency
+        inline uint64_t getTimeMicroseconds()
+        {
+            static const auto startTime = std::chrono::steady_clock::now();
+
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count());
+        }
+    }
+}
@@ -0,0 +1,511 @@
+//
+//  rtmp_relay
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "LoadClient.hpp"
+#include "Network.hpp"
+#include "Json.hpp"
+#include "Log.hpp"
+
+using namespace relay;
+using namespace relay::loadgen;
+
+struct Options
+{
+    std::string address = "127.0.0.1:1935";
+    std::string applicationName = "live";
+    std::string streamName = "loadgen";
+    uint32_t players = 10;
+    uint32_t videoBitrate = 2500; // kbit/s
+    uint32_t audioBitrate = 128; // kbit/s
+    double frameRate = 30.0;
+    double keyFrameInterval = 2.0;
+    uint32_t chunkSize = 4096;
+    double warmup = 2.0;
+    double duration = 10.0;
+    double connectRate = 50.0; // new players per second
+    uint32_t idleConnections = 0; // measure idle connections instead of streaming
+    int relayPid = 0;
+    bool json = true;
+};
+
+// AAC frames of 1024 samples at 48kHz
+static const double AUDIO_FRAME_RATE = 48000.0 / 1024.0;
+static const double PLAY_TIMEOUT = 10.0;
+// time for the relay to process the last C2 after the clients finished their handshakes
+static const double IDLE_SETTLE_TIME = 0.5;
+
+static bool parseOptions(int argc, const char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (i + 1 >= argc) return false;
+
+        const char* name = argv[i];
+        const char* value = argv[++i];
+
+        if (strcmp(name, "--address") == 0) options.address = value;
+        else if (strcmp(name, "--application") == 0) options.applicationName = value;
+        else if (strcmp(name, "--stream") == 0) options.streamName = value;
+        else if (strcmp(name, "--players") == 0) options.players = static_cast<uint32_t>(atoi(value));
+        else if (strcmp(name, "--video-bitrate") == 0) options.videoBitrate = static_cast<uint32_t>(atoi(value));
+        else if (strcmp(name, "--audio-bitrate") == 0) options.audioBitrate = static_cast<uint32_t>(atoi(value));
+        else if (strcmp(name, "--fps") == 0) options.frameRate = atof(value);
+        else if (strcmp(name, "--keyframe-interval") == 0) options.keyFrameInterval = atof(value);
+        else if (strcmp(name, "--chunk-size") == 0) options.chunkSize = static_cast<uint32_t>(atoi(value));
+        else if (strcmp(name, "--warmup") == 0) options.warmup = atof(value);
+        else if (strcmp(name, "--duration") == 0) options.duration = atof(value);
+        else if (strcmp(name, "--connect-rate") == 0) options.connectRate = atof(value);
+        else if (strcmp(name, "--idle") == 0) options.idleConnections = static_cast<uint32_t>(atoi(value));
+        else if (strcmp(name, "--relay-pid") == 0) options.relayPid = atoi(value);
+        else if (strcmp(name, "--format") == 0)
+        {
+            if (strcmp(value, "json") == 0) options.json = true;
+            else if (strcmp(value, "text") == 0) options.json = false;
+            else return false;
+        }
+        else return false;
+    }
+
+    return options.frameRate > 0.0 &&
+        options.keyFrameInterval > 0.0 &&
+        options.duration > 0.0 &&
+        options.connectRate > 0.0 &&
+        options.chunkSize >= 128 &&
+        (options.idleConnections == 0 || options.relayPid != 0);
+}
+
+// CPU time of the given process (or this one for 0) in seconds
+static double getCpuTime(int pid)
+{
+    if (pid == 0)
+    {
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) return 0.0;
+
+        return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0 +
+            usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+    }
+
+    std::ifstream file("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(file, line)) return 0.0;
+
+    // the command name may contain spaces, fields are counted from the closing parenthesis
+    std::string::size_type position = line.rfind(')');
+    if (position == std::string::npos) return 0.0;
+
+    std::vector<std::string> fields;
+    tokenize(line.substr(position + 2), fields, " ", true);
+
+    // utime and stime are fields 14 and 15, the list starts at field 3
+    if (fields.size() < 13) return 0.0;
+
+    double ticks = static_cast<double>(sysconf(_SC_CLK_TCK));
+    return (std::stod(fields[11]) + std::stod(fields[12])) / ticks;
+}
+
+// resident memory of the given process in bytes
+static uint64_t getResidentMemory(int pid)
+{
+    std::ifstream file("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+
+    while (std::getline(file, line))
+    {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+        {
+            return std::stoull(line.substr(6)) * 1024;
+        }
+    }
+
+    return 0;
+}
+
+static double getPercentile(const std::vector<uint32_t>& sortedValues, double percentile)
+{
+    if (sortedValues.empty()) return 0.0;
+
+    size_t index = static_cast<size_t>(std::ceil(percentile * sortedValues.size()));
+    if (index > 0) --index;
+    if (index >= sortedValues.size()) index = sortedValues.size() - 1;
+
+    return sortedValues[index] / 1000.0;
+}
+
+// opens connections that only complete the handshake and measures the resident memory the relay needs for each
+static int runIdle(Network& network, const Options& options)
+{
+    std::vector<std::unique_ptr<LoadClient>> clients;
+
+    uint64_t residentMemoryBefore = getResidentMemory(options.relayPid);
+    uint64_t startTime = getTimeMicroseconds();
+    uint64_t idleTime = 0;
+
+    const std::chrono::microseconds sleepTime(500);
+
+    for (;;)
+    {
+        network.update();
+
+        uint64_t currentTime = getTimeMicroseconds();
+        double elapsed = (currentTime - startTime) / 1000000.0;
+
+        while (clients.size() < options.idleConnections &&
+               clients.size() <= elapsed * options.connectRate)
+        {
+            std::unique_ptr<LoadClient> client(new LoadClient(network, LoadClient::Role::IDLE, options.applicationName, options.streamName, options.chunkSize));
+            client->connect(options.address);
+            clients.push_back(std::move(client));
+        }
+
+        uint32_t clientsIdle = 0;
+
+        for (const auto& client : clients)
+        {
+            if (client->getState() == LoadClient::State::CLOSED)
+            {
+                std::cerr << "Idle connection closed" << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            if (client->getState() == LoadClient::State::IDLE) ++clientsIdle;
+        }
+
+        if (clientsIdle == options.idleConnections)
+        {
+            if (idleTime == 0) idleTime = currentTime;
+            else if (currentTime - idleTime >= IDLE_SETTLE_TIME * 1000000.0) break;
+        }
+        else if (elapsed >= options.idleConnections / options.connectRate + PLAY_TIMEOUT)
+        {
+            std::cerr << "Only " << clientsIdle << " of " << options.idleConnections << " connections finished the handshake" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::this_thread::sleep_for(sleepTime);
+    }
+
+    uint64_t residentMemoryIdle = getResidentMemory(options.relayPid);
+    double duration = (idleTime - startTime) / 1000000.0;
+    int64_t memoryPerConnection = (static_cast<int64_t>(residentMemoryIdle) - static_cast<int64_t>(residentMemoryBefore)) / static_cast<int64_t>(clients.size());
+
+    std::string output;
+
+    if (options.json)
+    {
+        JsonWriter writer(output);
+        writer.beginObject();
+        writer.key("idle_connections").value(options.idleConnections);
+        writer.key("duration").value(duration);
+        writer.key("relay_memory_before").value(residentMemoryBefore);
+        writer.key("relay_memory_idle").value(residentMemoryIdle);
+        writer.key("relay_memory_per_idle_connection").value(memoryPerConnection);
+        writer.endObject();
+        output.push_back('\n');
+    }
+    else
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "idle connections: %u, connected in %.1fs\n", options.idleConnections, duration);
+        output += line;
+        snprintf(line, sizeof(line), "relay memory: %llu bytes before, %llu bytes idle\n",
+                 static_cast<unsigned long long>(residentMemoryBefore), static_cast<unsigned long long>(residentMemoryIdle));
+        output += line;
+        snprintf(line, sizeof(line), "relay memory: %lld bytes per idle connection\n", static_cast<long long>(memoryPerConnection));
+        output += line;
+    }
+
+    std::cout << output;
+
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, const char* argv[])
+{
+    Options options;
+
+    if (!parseOptions(argc, argv, options))
+    {
+        std::cerr << "Usage: " << argv[0] << " [--address <host:port>] [--application <name>] [--stream <name>] [--players <count>]"
+            " [--video-bitrate <kbit/s>] [--audio-bitrate <kbit/s>] [--fps <rate>] [--keyframe-interval <seconds>] [--chunk-size <bytes>]"
+            " [--connect-rate <players/s>] [--warmup <seconds>] [--duration <seconds>] [--idle <count>] [--relay-pid <pid>] [--format json|text]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Log::threshold = Log::Level::ERR;
+
+    Network network;
+
+    if (options.idleConnections) return runIdle(network, options);
+
+    const uint32_t videoFrameSize = static_cast<uint32_t>(options.videoBitrate * 1000.0 / 8.0 / options.frameRate);
+    const uint32_t audioFrameSize = static_cast<uint32_t>(options.audioBitrate * 1000.0 / 8.0 / AUDIO_FRAME_RATE);
+    const uint64_t keyFrameDistance = std::max(static_cast<uint64_t>(options.keyFrameInterval * options.frameRate), static_cast<uint64_t>(1));
+
+    LoadClient publisher(network, LoadClient::Role::PUBLISHER, options.applicationName, options.streamName, options.chunkSize);
+    std::vector<std::unique_ptr<LoadClient>> players;
+
+    if (!publisher.connect(options.address))
+    {
+        std::cerr << "Failed to connect to " << options.address << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    enum class Phase
+    {
+        PUBLISHING, // waiting for the publisher to start
+        PLAYING, // waiting for all players to start
+        WARMUP,
+        MEASURING
+    };
+
+    Phase phase = Phase::PUBLISHING;
+    uint64_t phaseStartTime = getTimeMicroseconds();
+    uint64_t publishStartTime = 0;
+    uint64_t videoFrames = 0;
+    uint64_t audioFrames = 0;
+
+    uint64_t residentMemoryBeforePlayers = 0;
+    uint64_t residentMemoryWithPlayers = 0;
+    double relayCpuTime = 0.0;
+    double loadgenCpuTime = 0.0;
+    uint64_t publisherBytesSent = 0;
+    uint64_t publisherVideoFrames = 0;
+
+    const std::chrono::microseconds sleepTime(500);
+
+    for (;;)
+    {
+        network.update();
+
+        uint64_t currentTime = getTimeMicroseconds();
+
+        if (publisher.getState() == LoadClient::State::CLOSED)
+        {
+            std::cerr << "Publisher disconnected" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        if (publisher.getState() == LoadClient::State::STREAMING)
+        {
+            if (publishStartTime == 0) publishStartTime = currentTime;
+
+            double elapsed = (currentTime - publishStartTime) / 1000000.0;
+
+            while (videoFrames <= elapsed * options.frameRate)
+            {
+                uint64_t timestamp = static_cast<uint64_t>(videoFrames * 1000.0 / options.frameRate);
+                publisher.sendVideoFrame(timestamp, videoFrames % keyFrameDistance == 0, videoFrameSize);
+                ++videoFrames;
+            }
+
+            while (audioFrames <= elapsed * AUDIO_FRAME_RATE)
+            {
+                uint64_t timestamp = static_cast<uint64_t>(audioFrames * 1000.0 / AUDIO_FRAME_RATE);
+                publisher.sendAudioFrame(timestamp, audioFrameSize);
+                ++audioFrames;
+            }
+        }
+
+        switch (phase)
+        {
+            case Phase::PUBLISHING:
+            {
+                if (publisher.getState() == LoadClient::State::STREAMING)
+                {
+                    if (options.relayPid) residentMemoryBeforePlayers = getResidentMemory(options.relayPid);
+
+                    phase = Phase::PLAYING;
+                    phaseStartTime = currentTime;
+                }
+                break;
+            }
+
+            case Phase::PLAYING:
+            {
+                // ramp up players so the relay's accept queue does not overflow
+                double elapsed = (currentTime - phaseStartTime) / 1000000.0;
+
+                while (players.size() < options.players &&
+                       players.size() <= elapsed * options.connectRate)
+                {
+                    std::unique_ptr<LoadClient> player(new LoadClient(network, LoadClient::Role::PLAYER, options.applicationName, options.streamName, options.chunkSize));
+                    player->connect(options.address);
+                    players.push_back(std::move(player));
+                }
+
+                uint32_t playersStreaming = 0;
+
+                for (const auto& player : players)
+                {
+                    if (player->getState() == LoadClient::State::CLOSED)
+                    {
+                        std::cerr << "Player disconnected" << std::endl;
+                        return EXIT_FAILURE;
+                    }
+
+                    // players skip frames until the next keyframe, so wait for the first one
+                    if (player->getState() == LoadClient::State::STREAMING &&
+                        player->getStats().videoFrames > 0) ++playersStreaming;
+                }
+
+                bool allStreaming = (playersStreaming == options.players);
+
+                if (!allStreaming && elapsed >= options.players / options.connectRate + PLAY_TIMEOUT)
+                {
+                    std::cerr << "Only " << playersStreaming << " of " << options.players << " players started playing" << std::endl;
+                    return EXIT_FAILURE;
+                }
+
+                if (allStreaming)
+                {
+                    phase = Phase::WARMUP;
+                    phaseStartTime = currentTime;
+                }
+                break;
+            }
+
+            case Phase::WARMUP:
+            {
+                if (currentTime - phaseStartTime >= options.warmup * 1000000.0)
+                {
+                    if (options.relayPid)
+                    {
+                        residentMemoryWithPlayers = getResidentMemory(options.relayPid);
+                        relayCpuTime = getCpuTime(options.relayPid);
+                    }
+
+                    loadgenCpuTime = getCpuTime(0);
+                    publisherBytesSent = publisher.getStats().bytesSent;
+                    publisherVideoFrames = publisher.getStats().videoFrames;
+
+                    for (const auto& player : players)
+                    {
+                        LoadClient::Stats& stats = player->getStats();
+                        stats.bytesReceived = 0;
+                        stats.videoFrames = 0;
+                        stats.audioFrames = 0;
+                        stats.latencies.clear();
+                        stats.latencies.reserve(static_cast<size_t>(options.duration * options.frameRate * 1.5));
+                    }
+
+                    phase = Phase::MEASURING;
+                    phaseStartTime = currentTime;
+                }
+                break;
+            }
+
+            case Phase::MEASURING:
+                break;
+        }
+
+        if (phase == Phase::MEASURING &&
+            currentTime - phaseStartTime >= options.duration * 1000000.0)
+        {
+            break;
+        }
+
+        std::this_thread::sleep_for(sleepTime);
+    }
+
+    double duration = (getTimeMicroseconds() - phaseStartTime) / 1000000.0;
+
+    uint64_t bytesReceived = 0;
+    uint64_t videoFramesReceived = 0;
+    uint32_t playersStreaming = 0;
+    std::vector<uint32_t> latencies;
+
+    for (const auto& player : players)
+    {
+        LoadClient::Stats& stats = player->getStats();
+        bytesReceived += stats.bytesReceived;
+        videoFramesReceived += stats.videoFrames;
+        latencies.insert(latencies.end(), stats.latencies.begin(), stats.latencies.end());
+
+        if (player->getState() == LoadClient::State::STREAMING) ++playersStreaming;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    double ingressMbps = (publisher.getStats().bytesSent - publisherBytesSent) * 8.0 / duration / 1000000.0;
+    double egressMbps = bytesReceived * 8.0 / duration / 1000000.0;
+    double publishedFps = (publisher.getStats().videoFrames - publisherVideoFrames) / duration;
+    double receivedFps = players.empty() ? 0.0 : videoFramesReceived / duration / players.size();
+    double loadgenCpu = (getCpuTime(0) - loadgenCpuTime) / duration;
+    double relayCpu = options.relayPid ? (getCpuTime(options.relayPid) - relayCpuTime) / duration : 0.0;
+    double relayCpuPerGbps = (egressMbps > 0.0) ? relayCpu / (egressMbps / 1000.0) : 0.0;
+    int64_t memoryPerConnection = players.empty() ? 0 :
+        (static_cast<int64_t>(residentMemoryWithPlayers) - static_cast<int64_t>(residentMemoryBeforePlayers)) / static_cast<int64_t>(players.size());
+
+    std::string output;
+
+    if (options.json)
+    {
+        JsonWriter writer(output);
+        writer.beginObject();
+        writer.key("players").value(options.players);
+        writer.key("players_streaming").value(playersStreaming);
+        writer.key("duration").value(duration);
+        writer.key("ingress_mbps").value(ingressMbps);
+        writer.key("egress_mbps").value(egressMbps);
+        writer.key("published_fps").value(publishedFps);
+        writer.key("received_fps_per_player").value(receivedFps);
+        writer.key("latency_ms").beginObject();
+        writer.key("p50").value(getPercentile(latencies, 0.5));
+        writer.key("p99").value(getPercentile(latencies, 0.99));
+        writer.key("p999").value(getPercentile(latencies, 0.999));
+        writer.key("max").value(getPercentile(latencies, 1.0));
+        writer.key("samples").value(latencies.size());
+        writer.endObject();
+        writer.key("loadgen_cpu_cores").value(loadgenCpu);
+
+        if (options.relayPid)
+        {
+            writer.key("relay_cpu_cores").value(relayCpu);
+            writer.key("relay_cpu_cores_per_gbps").value(relayCpuPerGbps);
+            writer.key("relay_memory_per_connection").value(memoryPerConnection);
+        }
+
+        writer.endObject();
+        output.push_back('\n');
+    }
+    else
+    {
+        char line[256];
+        snprintf(line, sizeof(line), "players: %u (%u streaming), duration: %.1fs\n", options.players, playersStreaming, duration);
+        output += line;
+        snprintf(line, sizeof(line), "ingress: %.2f Mbps, egress: %.2f Mbps\n", ingressMbps, egressMbps);
+        output += line;
+        snprintf(line, sizeof(line), "published: %.1f fps, received: %.1f fps per player\n", publishedFps, receivedFps);
+        output += line;
+        snprintf(line, sizeof(line), "latency: p50 %.3f ms, p99 %.3f ms, p999 %.3f ms, max %.3f ms (%zu samples)\n",
+                 getPercentile(latencies, 0.5), getPercentile(latencies, 0.99), getPercentile(latencies, 0.999), getPercentile(latencies, 1.0), latencies.size());
+        output += line;
+        snprintf(line, sizeof(line), "loadgen CPU: %.2f cores\n", loadgenCpu);
+        output += line;
+
+        if (options.relayPid)
+        {
+            snprintf(line, sizeof(line), "relay CPU: %.2f cores, %.2f cores per Gbps\n", relayCpu, relayCpuPerGbps);
+            output += line;
+            snprintf(line, sizeof(line), "relay memory: %lld bytes per connection\n", static_cast<long long>(memoryPerConnection));
+            output += line;
+        }
+    }
+
+    std::cout << output;
+
+    return (playersStreaming == options.players) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
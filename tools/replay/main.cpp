@@ -0,0 +1,234 @@
+//
+//  rtmp_relay
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Capture.hpp"
+#include "Connection.hpp"
+#include "Log.hpp"
+#include "Network.hpp"
+#include "Relay.hpp"
+
+using namespace relay;
+
+// a connected socket whose peer discards everything the relay sends
+class ReplaySocket: public Socket
+{
+public:
+    ReplaySocket(Network& aNetwork, socket_t aSocketFd, const CaptureHeader& header):
+        Socket(aNetwork, aSocketFd, true,
+               header.localIPAddress, header.localPort,
+               header.remoteIPAddress, header.remotePort)
+    {
+    }
+};
+
+struct Replay
+{
+    std::string path;
+    CaptureReader reader;
+    std::unique_ptr<Connection> connection;
+    int peerFd = -1;
+
+    uint64_t nextTime = 0; // microseconds since the start of the capture
+    std::vector<uint8_t> nextData;
+    bool finished = false;
+
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+
+    ~Replay()
+    {
+        connection.reset();
+        if (peerFd != -1) ::close(peerFd);
+    }
+
+    void readNext()
+    {
+        uint64_t delay;
+
+        if (reader.read(delay, nextData))
+        {
+            nextTime += delay;
+        }
+        else
+        {
+            finished = true;
+        }
+    }
+};
+
+static bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// discards the data the relay wrote to the replayed connections
+static uint64_t drain(std::vector<std::unique_ptr<Replay>>& replays)
+{
+    static std::vector<uint8_t> buffer(65536);
+    uint64_t total = 0;
+
+    for (const auto& replay : replays)
+    {
+        ssize_t size;
+        while ((size = ::read(replay->peerFd, buffer.data(), buffer.size())) > 0)
+        {
+            total += static_cast<uint64_t>(size);
+        }
+    }
+
+    return total;
+}
+
+int main(int argc, const char* argv[])
+{
+    std::string config;
+    std::string address;
+    bool realTime = false;
+    bool verbose = false;
+    std::vector<std::string> paths;
+    bool validArguments = true;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) config = argv[++i];
+        else if (strcmp(argv[i], "--address") == 0 && i + 1 < argc) address = argv[++i];
+        else if (strcmp(argv[i], "--real-time") == 0) realTime = true;
+        else if (strcmp(argv[i], "--verbose") == 0) verbose = true;
+        else if (argv[i][0] == '-') validArguments = false;
+        else paths.push_back(argv[i]);
+    }
+
+    if (!validArguments || config.empty() || paths.empty())
+    {
+        std::cerr << "Usage: " << argv[0] << " --config <config_file> [--address <host:port>] [--real-time] [--verbose] <capture_file>..." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Network network;
+    Relay relay(network);
+
+    if (!relay.init(config)) return EXIT_FAILURE;
+
+    if (!verbose) Log::threshold = Log::Level::ERR;
+
+    std::pair<uint32_t, uint16_t> localAddress(0, 0);
+
+    if (!address.empty() && !Socket::getAddress(address, localAddress))
+    {
+        std::cerr << "Invalid address " << address << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::unique_ptr<Replay>> replays;
+
+    for (const std::string& path : paths)
+    {
+        std::unique_ptr<Replay> replay(new Replay());
+        replay->path = path;
+
+        if (!replay->reader.open(path)) return EXIT_FAILURE;
+
+        CaptureHeader header = replay->reader.getHeader();
+
+        // endpoints are matched by the local address the connection was accepted on
+        if (!address.empty())
+        {
+            header.localIPAddress = localAddress.first;
+            header.localPort = localAddress.second;
+        }
+
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0 ||
+            !setNonBlocking(fds[0]) ||
+            !setNonBlocking(fds[1]))
+        {
+            std::cerr << "Failed to create a socket pair" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        replay->peerFd = fds[1];
+
+        ReplaySocket socket(network, fds[0], header);
+        replay->connection.reset(new Connection(relay, socket));
+        replay->readNext();
+
+        replays.push_back(std::move(replay));
+    }
+
+    const uint64_t FLUSH_SIZE = 1024 * 1024;
+
+    uint64_t totalRecords = 0;
+    uint64_t totalBytes = 0;
+    uint64_t bytesSent = 0;
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (;;)
+    {
+        // feed the captures in the order the data arrived
+        Replay* next = nullptr;
+
+        for (const auto& replay : replays)
+        {
+            if (!replay->finished && (!next || replay->nextTime < next->nextTime))
+            {
+                next = replay.get();
+            }
+        }
+
+        if (!next) break;
+
+        if (realTime)
+        {
+            auto targetTime = startTime + std::chrono::microseconds(next->nextTime);
+
+            if (std::chrono::steady_clock::now() < targetTime)
+            {
+                network.update();
+                bytesSent += drain(replays);
+                std::this_thread::sleep_until(targetTime);
+            }
+        }
+
+        next->connection->replay(next->nextData);
+
+        ++next->records;
+        next->bytes += next->nextData.size();
+        ++totalRecords;
+        totalBytes += next->nextData.size();
+
+        // keep the relay's output buffers from growing without bound
+        if (network.getQueuedBytes() >= FLUSH_SIZE)
+        {
+            network.update();
+            bytesSent += drain(replays);
+        }
+
+        next->readNext();
+    }
+
+    network.update();
+    bytesSent += drain(replays);
+
+    double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    for (const auto& replay : replays)
+    {
+        std::cout << replay->path << ": " << replay->records << " reads, " << replay->bytes << " bytes" << std::endl;
+    }
+
+    std::cout << "Replayed " << totalRecords << " reads, " << totalBytes << " bytes in " << duration << " s (" <<
+        (duration > 0.0 ? totalBytes / duration / 1000000.0 : 0.0) << " MB/s), relay sent " << bytesSent << " bytes" << std::endl;
+
+    return EXIT_SUCCESS;
+}